@@ -8,18 +8,122 @@
 //  The two comment string forms of the calls allow you to easily
 //  compose a comment from text and a symbol name for example. 
 //
+//  Instructions are no longer printed as they are emitted.  They are
+//  kept in a buffer indexed by location so a backpatch simply
+//  overwrites a slot, and the finished program is written once, in
+//  address order, by flushCode().  flushCode() writes either the text
+//  listing or a binary object file (see tmobject.h).
+//
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
 #include "emitcode.h"
+#include "tmobject.h"
 
 extern FILE *code;
+extern bool binaryOutput;   // write a binary TM object instead of a listing
+extern bool leanCode;       // drop all comments
 
 
 //  TM location number for current instruction emission
 static int emitLoc = 0;   // next empty slot in Imem growing to lower memory
-static int litLoc = 0;    // next empty slot in Dmem growing to higher memory
+static int litLoc = 1;    // next empty slot in Dmem growing to higher memory (0 holds the memory size)
+
+
+// A single buffered TM instruction.  The args are in the same order
+// as they are written: r,s,t for register only instructions and
+// r,d(s) for register to memory instructions.
+struct Instruction {
+    bool used;
+    OpCode op;
+    long long int arg1;
+    long long int arg2;
+    long long int arg3;
+    int comment;          // offset of the comment in commentPool
+};
+
+// A comment line that is written just before the instruction at loc
+struct CommentLine {
+    int loc;
+    int text;
+};
+
+struct Literal {
+    int loc;
+    std::string text;
+};
+
+struct Fixup {
+    int loc;
+    int label;
+};
+
+static std::vector<Instruction> instructions;
+static std::vector<CommentLine> commentLines;
+static std::vector<Literal> literals;
+static std::map<std::string, int> literalLocs;   // address of each distinct literal
+static std::string commentPool;      // all comment text, null separated
+
+static std::vector<int> labels;      // location of each label, -1 if unbound
+static std::vector<Fixup> fixups;    // references to labels that were unbound when emitted
+
+
+static const char *opCodeNames[] = {
+    "HALT", "NOP", "IN", "INB", "INC", "OUT", "OUTB", "OUTC", "OUTNL",
+    "ADD", "SUB", "MUL", "DIV", "MOD", "AND", "OR", "XOR", "NOT", "NEG", "SWP", "RND",
+    "TLT", "SLT", "TLE", "TGT", "SGT", "TGE", "TEQ", "TNE",
+    "MOV", "SET", "CO", "COA",
+    "RRLim",
+    "LD", "ST", "LDA", "LDC", "JZR", "JNZ", "JMP",
+    "RALim",
+    "LIT"
+};
+
+const char *opCodeName(OpCode op)
+{
+    return opCodeNames[(int) op];
+}
+
+
+// stores "c cc" in the comment pool and returns its offset
+static int poolComment(char *c, char *cc)
+{
+    if (leanCode) return TMO_NO_STRING;
+
+    int offset = commentPool.size();
+    commentPool += c;
+    if (cc != NULL) {
+        commentPool += ' ';
+        commentPool += cc;
+    }
+    commentPool += '\0';
+
+    return offset;
+}
+
+
+// places an instruction in the buffer at emitLoc
+static void emitInstruction(OpCode op, long long int arg1, long long int arg2, long long int arg3, char *c, char *cc)
+{
+    if (emitLoc >= (int) instructions.size()) {
+        instructions.resize(emitLoc + 1);
+    }
+
+    Instruction &inst = instructions[emitLoc];
+    inst.used = true;
+    inst.op = op;
+    inst.arg1 = arg1;
+    inst.arg2 = arg2;
+    inst.arg3 = arg3;
+    inst.comment = poolComment(c, cc);
+    emitLoc++;
+}
 
 
 //  Procedure emitComment prints a comment line 
@@ -27,7 +131,8 @@ static int litLoc = 0;    // next empty slot in Dmem growing to higher memory
 // 
 void emitComment(char *c, char *cc)
 {
-    fprintf(code, "* %s %s\n", c, cc);
+    if (leanCode) return;
+    commentLines.push_back({emitLoc, poolComment(c, cc)});
 }
 
 //  Procedure emitComment prints a comment line 
@@ -35,7 +140,8 @@ void emitComment(char *c, char *cc)
 // 
 void emitComment(char *c)
 {
-    fprintf(code, "* %s\n", c);
+    if (leanCode) return;
+    commentLines.push_back({emitLoc, poolComment(c, NULL)});
 }
 
 
@@ -47,14 +153,12 @@ void emitComment(char *c)
 // t = 2nd source register
 // c = a comment
 // 
-void emitRO(char *op, long long int r, long long int s, long long int t, char *c, char *cc)
+void emitRO(OpCode op, long long int r, long long int s, long long int t, char *c, char *cc)
 {
-    fprintf(code, "%3d:  %5s  %lld,%lld,%lld\t%s %s\n", emitLoc, op, r, s, t, c, cc);
-    fflush(code);
-    emitLoc++;
+    emitInstruction(op, r, s, t, c, cc);
 }
 
-void emitRO(char *op,long long int r,long long int s,long long int t, char *c)
+void emitRO(OpCode op,long long int r,long long int s,long long int t, char *c)
 {
     emitRO(op, r, s, t, c, (char *)"");
 }
@@ -68,14 +172,12 @@ void emitRO(char *op,long long int r,long long int s,long long int t, char *c)
 // s = the base register
 // c = a comment
 // 
-void emitRM(char *op, long long int r, long long int d, long long int s, char *c, char *cc)
+void emitRM(OpCode op, long long int r, long long int d, long long int s, char *c, char *cc)
 {
-    fprintf(code, "%3d:  %5s  %lld,%lld(%lld)\t%s %s\n", emitLoc, op, r, d, s, c, cc);
-    fflush(code);
-    emitLoc++;
+    emitInstruction(op, r, d, s, c, cc);
 }
 
-void emitRM(char *op,long long int r,long long int d,long long int s, char *c)
+void emitRM(OpCode op,long long int r,long long int d,long long int s, char *c)
 {
     emitRM(op, r, d, s, c, (char *)"");
 }
@@ -83,7 +185,7 @@ void emitRM(char *op,long long int r,long long int d,long long int s, char *c)
 
 void emitGoto(int d,long long int s, char *c, char *cc)
 {
-    emitRM((char *)"JMP", (long long int)PC, d, s, c, cc);
+    emitRM(OpCode::JMP, (long long int)PC, d, s, c, cc);
 }
 
 
@@ -102,16 +204,13 @@ void emitGoto(int d,long long int s, char *c)
 // a = the absolute location in memory
 // c = a comment
 // 
-void emitRMAbs(char *op, long long int r, long long int a, char *c, char *cc)
+void emitRMAbs(OpCode op, long long int r, long long int a, char *c, char *cc)
 {
-    fprintf(code, "%3d:  %5s  %lld,%lld(%lld)\t%s %s\n", emitLoc, op, r, a - (long long int)(emitLoc + 1),
-	    (long long int)PC, c, cc);
-    fflush(code);
-    emitLoc++;
+    emitRM(op, r, a - (long long int)(emitLoc + 1), (long long int)PC, c, cc);
 }
 
 
-void emitRMAbs(char *op,long long int r,long long int a, char *c)
+void emitRMAbs(OpCode op,long long int r,long long int a, char *c)
 {
     emitRMAbs(op, r, a, c, (char *)"");
 }
@@ -119,7 +218,7 @@ void emitRMAbs(char *op,long long int r,long long int a, char *c)
 
 void emitGotoAbs(int a, char *c, char *cc)
 {
-    emitRMAbs((char *)"JMP", (long long int)PC, a, c, cc);
+    emitRMAbs(OpCode::JMP, (long long int)PC, a, c, cc);
 }
 
 
@@ -142,25 +241,42 @@ void emitGotoAbs(int a, char *c)
 // 7  h  <-- return this address
 // 8  5
 // 9  blah   <-- ending litLoc
+//
+// Identical literals share storage.  The data is put in place by LIT
+// when the program is loaded so nothing is stored at run time.
 
-int emitLit(char *s)
+// places the literal without emitting code and returns its address
+int litAddress(char *s, int len)
 {
+    std::string text(s, len);
+    std::map<std::string, int>::iterator found = literalLocs.find(text);
     int loc;
-    
-    litLoc += strlen(s)-1;
-    loc = litLoc;
-    fprintf(code, "%3d:  %5s  \"%s\"\n", litLoc, (char *)"LIT", s);
-    emitRM((char *)"LDC", 3, loc, 6, (char *)"Load address of literal char array");
-    litLoc+=2;  // next empty spot which is past length
+
+    if (found != literalLocs.end()) {
+        loc = found->second;
+    }
+    else {
+        litLoc += (len > 0 ? len : 1) - 1;
+        loc = litLoc;
+        literals.push_back({litLoc, text});
+        literalLocs[text] = loc;
+        litLoc+=2;  // next empty spot which is past length
+    }
 
     return loc;
 }
 
-// load the literal at the address given
-void emitLitAbs(int a, char *s)
+int emitLit(char *s, int len)
 {
-    fprintf(code, "%3d:  %5s  \"%s\"\n", a, (char *)"LIT", s);
-    emitRM((char *)"LDC", 3, a+strlen(s), 6, (char *)"Load literal value");
+    int loc = litAddress(s, len);
+    emitRM(OpCode::LDC, 3, loc, 6, (char *)"Load address of literal char array");
+
+    return loc;
+}
+
+int emitLit(char *s)
+{
+    return emitLit(s, strlen(s));
 }
 
 
@@ -207,7 +323,7 @@ void backPatchAJumpToHere(int addr, char *comment)
 
 // this back patches a JZR or JNZ at the instruction address addr that
 // jumps to the current instruction location now that it is known.
-void backPatchAJumpToHere(char *cmd, int reg, int addr, char *comment)
+void backPatchAJumpToHere(OpCode cmd, int reg, int addr, char *comment)
 {
     int currloc;
 
@@ -217,3 +333,423 @@ void backPatchAJumpToHere(char *cmd, int reg, int addr, char *comment)
     emitBackup(currloc);            // restore addr
 }
 
+
+//
+//  Label Functions
+//
+
+// creates a new label that is not bound to any location yet
+int newLabel()
+{
+    labels.push_back(-1);
+
+    return labels.size() - 1;
+}
+
+
+// binds the label to the current location and patches every
+// instruction that referenced it before it was known
+void bindLabel(int label)
+{
+    labels[label] = emitLoc;
+
+    size_t kept = 0;
+    for (size_t i = 0; i < fixups.size(); i++) {
+        Fixup &f = fixups[i];
+        if (f.label == label) {
+            instructions[f.loc].arg2 = emitLoc - (f.loc + 1);
+        } else {
+            fixups[kept++] = f;
+        }
+    }
+    fixups.resize(kept);
+}
+
+
+// emits a pc relative reference to the label
+// op = the opcode (JMP, JZR, JNZ, LDA...)
+// r = target register
+void emitRMLabel(OpCode op, long long int r, int label, char *c)
+{
+    if (labels[label] >= 0) {
+        emitRMAbs(op, r, labels[label], c);
+    } else {
+        fixups.push_back({emitLoc, label});
+        emitRM(op, r, 0, (long long int)PC, c);
+    }
+}
+
+
+void emitGotoLabel(int label, char *c)
+{
+    emitRMLabel(OpCode::JMP, (long long int)PC, label, c);
+}
+
+
+//
+//  Peephole Optimization
+//
+
+static std::vector<int> entryPoints;   // code that is kept even if nothing jumps to it
+
+
+// declares that loc is entered from outside the straight line code
+// around it, like the first instruction of a function
+void markEntryPoint(int loc)
+{
+    entryPoints.push_back(loc);
+}
+
+
+// true if the d(s) operand of the instruction is a pc relative code
+// location: a jump target or a return address
+static bool isPcRelative(const Instruction &inst)
+{
+    if (!inst.used || inst.arg3 != PC) return false;
+    return inst.op == OpCode::LDA || inst.op == OpCode::JZR || inst.op == OpCode::JNZ || inst.op == OpCode::JMP;
+}
+
+
+// true if execution never continues with the next instruction
+static bool isUnconditionalJump(const Instruction &inst)
+{
+    if (!inst.used) return false;
+    switch (inst.op) {
+    case OpCode::HALT:
+    case OpCode::JMP:
+        return true;
+    case OpCode::LD:
+    case OpCode::LDA:
+    case OpCode::LDC:
+        return inst.arg1 == PC;
+    default:
+        return false;
+    }
+}
+
+
+// true if the instruction sets reg without looking at its old value
+static bool overwrites(const Instruction &inst, long long int reg)
+{
+    if (!inst.used || inst.arg1 != reg || reg == PC) return false;
+    switch (inst.op) {
+    case OpCode::IN:
+    case OpCode::INB:
+    case OpCode::INC:
+    case OpCode::LDC:
+        return true;
+    case OpCode::LD:
+    case OpCode::LDA:
+        return inst.arg3 != reg;    // arg2 is a displacement, not a register
+    case OpCode::NOT:
+    case OpCode::NEG:
+    case OpCode::ADD: case OpCode::SUB: case OpCode::MUL: case OpCode::DIV: case OpCode::MOD:
+    case OpCode::AND: case OpCode::OR: case OpCode::XOR:
+    case OpCode::TLT: case OpCode::SLT: case OpCode::TLE: case OpCode::TGT:
+    case OpCode::SGT: case OpCode::TGE: case OpCode::TEQ: case OpCode::TNE:
+        return inst.arg2 != reg && inst.arg3 != reg;
+    default:
+        return false;
+    }
+}
+
+
+// Instructions are deleted by marking them.  Something that jumped
+// to a deleted instruction now lands on the next live one, so a jump
+// target stays marked as one.
+struct Peephole {
+    std::vector<bool> deleted;
+    std::vector<bool> isTarget;
+
+    int nextLive(int loc)
+    {
+        while (loc < (int) deleted.size() && deleted[loc]) loc++;
+        return loc;
+    }
+
+    void remove(int loc)
+    {
+        deleted[loc] = true;
+        int next = nextLive(loc);
+        if (isTarget[loc] && next < (int) isTarget.size()) isTarget[next] = true;
+    }
+
+    void findTargets()
+    {
+        int size = instructions.size();
+        isTarget.assign(size + 1, false);
+        isTarget[nextLive(0)] = true;
+        for (size_t i = 0; i < entryPoints.size(); i++) {
+            isTarget[nextLive(entryPoints[i])] = true;
+        }
+        for (int loc = 0; loc < size; loc++) {
+            Instruction &inst = instructions[loc];
+            if (deleted[loc] || !isPcRelative(inst)) continue;
+            int target = loc + 1 + inst.arg2;
+            if (target >= 0 && target <= size) isTarget[nextLive(target)] = true;
+        }
+    }
+
+    // one pass over the code, returns true if anything changed
+    bool pass()
+    {
+        bool changed = false;
+        bool reachable = true;
+        int size = instructions.size();
+
+        findTargets();
+        for (int loc = 0; loc < size; loc++) {
+            if (deleted[loc]) continue;
+            Instruction &inst = instructions[loc];
+            if (isTarget[loc]) reachable = true;
+            if (!reachable) {  // falls after a jump and nothing jumps here
+                remove(loc);
+                changed = true;
+                continue;
+            }
+            if (isUnconditionalJump(inst)) reachable = false;
+
+            int next = nextLive(loc + 1);
+            if (next >= size) continue;
+            Instruction &following = instructions[next];
+
+            // a jump to the next instruction
+            if (isPcRelative(inst) && (inst.op != OpCode::LDA || inst.arg1 == PC)) {
+                int target = loc + 1 + inst.arg2;
+                if (target > loc && nextLive(target) == next) {
+                    remove(loc);
+                    reachable = true;
+                    changed = true;
+                    continue;
+                }
+            }
+
+            // a register load that is overwritten before it is used,
+            // typically LDA AC,0(RT) after a call whose value is unused
+            if (inst.used && (inst.op == OpCode::LDA || inst.op == OpCode::LDC) && overwrites(following, inst.arg1)) {
+                remove(loc);
+                changed = true;
+                continue;
+            }
+
+            // a store followed by a load of the same slot, unless the
+            // load can be reached some other way
+            if (inst.used && following.used && inst.op == OpCode::ST && following.op == OpCode::LD && !isTarget[next]
+                && following.arg2 == inst.arg2 && following.arg3 == inst.arg3 && inst.arg3 != PC) {
+                if (following.arg1 == inst.arg1) {
+                    remove(next);
+                } else {   // copy the register instead
+                    following.op = OpCode::LDA;
+                    following.arg2 = 0;
+                    following.arg3 = inst.arg1;
+                }
+                changed = true;
+            }
+        }
+
+        return changed;
+    }
+
+    // squeezes out the deleted instructions and moves every pc
+    // relative operand and comment line to match
+    void compact()
+    {
+        int size = instructions.size();
+        std::vector<int> newLoc(size + 1);
+        int live = 0;
+        for (int loc = 0; loc < size; loc++) {
+            newLoc[loc] = live;
+            if (!deleted[loc]) live++;
+        }
+        newLoc[size] = live;
+
+        for (int loc = 0; loc < size; loc++) {
+            Instruction &inst = instructions[loc];
+            if (deleted[loc] || !isPcRelative(inst)) continue;
+            int target = loc + 1 + inst.arg2;
+            if (target >= 0 && target <= size) {
+                inst.arg2 = newLoc[nextLive(target)] - (newLoc[loc] + 1);
+            }
+        }
+
+        for (size_t i = 0; i < commentLines.size(); i++) {
+            int loc = commentLines[i].loc;
+            commentLines[i].loc = loc < size ? newLoc[nextLive(loc)] : live + loc - size;
+        }
+
+        int kept = 0;
+        for (int loc = 0; loc < size; loc++) {
+            if (!deleted[loc]) instructions[kept++] = instructions[loc];
+        }
+        instructions.resize(kept);
+    }
+};
+
+
+// removes redundant and unreachable instructions from the buffered
+// program.  Must be called after all labels are bound.
+void optimizeCode()
+{
+    Peephole peephole;
+    peephole.deleted.assign(instructions.size(), false);
+    while (peephole.pass());
+    peephole.compact();
+    emitLoc = instructions.size();
+}
+
+
+//
+//  Output
+//
+
+// true if the TM can read the literal back as a quoted string.  It
+// does not understand quotes, escapes or control characters inside
+// a string and reads lines of limited length.
+static bool isPlainLiteral(const std::string &text)
+{
+    if (text.size() > 100) return false;
+    for (size_t k = 0; k < text.size(); k++) {
+        unsigned char c = text[k];
+        if (c < ' ' || c > '~' || c == '"' || c == '\\' || c == '^') return false;
+    }
+
+    return true;
+}
+
+
+// writes the buffered program as a text listing.  Comment lines come
+// just before the instruction they preceded when emitted and the
+// literals come last.  Everything is formatted into a single buffer
+// and written with one call.
+static void writeListing()
+{
+    std::string out;
+    out.reserve(instructions.size() * 64 + commentLines.size() * 32);
+
+    char line[64];
+    const char *pool = commentPool.c_str();
+    size_t nextComment = 0;
+    for (int loc = 0; loc < (int) instructions.size(); loc++) {
+        while (nextComment < commentLines.size() && commentLines[nextComment].loc <= loc) {
+            out += "* ";
+            out += pool + commentLines[nextComment].text;
+            out += '\n';
+            nextComment++;
+        }
+
+        Instruction &inst = instructions[loc];
+        if (!inst.used) continue;
+        if (inst.op < OpCode::RRLIM) {
+            snprintf(line, sizeof(line), "%3d:  %5s  %lld,%lld,%lld", loc, opCodeName(inst.op), inst.arg1, inst.arg2, inst.arg3);
+        } else {
+            snprintf(line, sizeof(line), "%3d:  %5s  %lld,%lld(%lld)", loc, opCodeName(inst.op), inst.arg1, inst.arg2, inst.arg3);
+        }
+        out += line;
+        if (inst.comment != TMO_NO_STRING) {
+            out += '\t';
+            out += pool + inst.comment;
+        }
+        out += '\n';
+    }
+    for (; nextComment < commentLines.size(); nextComment++) {
+        out += "* ";
+        out += pool + commentLines[nextComment].text;
+        out += '\n';
+    }
+
+    for (size_t i = 0; i < literals.size(); i++) {
+        const std::string &text = literals[i].text;
+        if (isPlainLiteral(text)) {
+            snprintf(line, sizeof(line), "%3d:  %5s  ", literals[i].loc, "LIT");
+            out += line;
+            out += '"';
+            out += text;
+            out += "\"\n";
+        }
+        else {
+            // one word at a time, laid out just as the string form is
+            for (size_t k = 0; k < text.size(); k++) {
+                snprintf(line, sizeof(line), "%3d:  %5s  %d\n", literals[i].loc - (int) k, "LIT", (unsigned char) text[k]);
+                out += line;
+            }
+            snprintf(line, sizeof(line), "%3d:  %5s  %d\n", literals[i].loc + 1, "LIT", (int) text.size());
+            out += line;
+        }
+    }
+
+    fwrite(out.data(), 1, out.size(), code);
+}
+
+
+// writes the buffered program as a binary TM object.  The comment pool
+// already is a table of null terminated strings so it is written as is.
+static void writeObject()
+{
+    std::vector<TMOInstruction> objInstructions(instructions.size());
+    for (size_t loc = 0; loc < instructions.size(); loc++) {
+        Instruction &inst = instructions[loc];
+        TMOInstruction &obj = objInstructions[loc];
+        obj.op = inst.used ? (int32_t) inst.op : TMO_UNUSED;
+        obj.arg1 = inst.arg1;
+        obj.arg2 = inst.arg2;
+        obj.arg3 = inst.arg3;
+        obj.comment = inst.used ? inst.comment : TMO_NO_STRING;
+    }
+
+    // a string literal is laid out like an array: the characters count
+    // down from loc and the length is stored just above it
+    std::vector<TMOData> data;
+    for (size_t i = 0; i < literals.size(); i++) {
+        const std::string &text = literals[i].text;
+        for (size_t k = 0; k < text.size(); k++) {
+            data.push_back({literals[i].loc - (int64_t) k, (unsigned char) text[k]});
+        }
+        data.push_back({literals[i].loc + 1, (int64_t) text.size()});
+    }
+
+    std::vector<TMOComment> objComments(commentLines.size());
+    for (size_t i = 0; i < commentLines.size(); i++) {
+        objComments[i].loc = commentLines[i].loc;
+        objComments[i].text = commentLines[i].text;
+    }
+
+    TMOHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = TMO_MAGIC;
+    header.version = TMO_VERSION;
+    header.flags = leanCode ? 0 : TMO_HAS_COMMENTS;
+    header.instrCount = objInstructions.size();
+    header.dataCount = data.size();
+    header.commentLineCount = objComments.size();
+    header.stringBytes = commentPool.size();
+
+    std::string out;
+    out.reserve(sizeof(header) + objInstructions.size() * sizeof(TMOInstruction) + data.size() * sizeof(TMOData)
+        + objComments.size() * sizeof(TMOComment) + commentPool.size());
+    out.append((char *) &header, sizeof(header));
+    out.append((char *) objInstructions.data(), objInstructions.size() * sizeof(TMOInstruction));
+    out.append((char *) data.data(), data.size() * sizeof(TMOData));
+    out.append((char *) objComments.data(), objComments.size() * sizeof(TMOComment));
+    out.append(commentPool);
+
+    fwrite(out.data(), 1, out.size(), code);
+}
+
+
+// writes the buffered program to the code file
+void flushCode()
+{
+    if (!fixups.empty()) {
+        throw std::runtime_error("ERROR: Jump to a label that was never bound.");
+    }
+
+    std::stable_sort(commentLines.begin(), commentLines.end(),
+        [](const CommentLine &a, const CommentLine &b) { return a.loc < b.loc; });
+
+    if (binaryOutput) {
+        writeObject();
+    } else {
+        writeListing();
+    }
+    fflush(code);
+}
@@ -2,7 +2,7 @@
 #define EMIT_CODE_H__
 
 //
-//  REGISTER DEFINES for optional use in calling the 
+//  REGISTER DEFINES for optional use in calling the
 //  routines below.
 //
 #define GP   0	//  The global pointer
@@ -20,6 +20,27 @@
 #define NO_COMMENT (char *)""
 
 
+//
+//  TM opcodes.  These are kept in the same order as the OPCODE
+//  enum in test/tiny/tm.c so an opcode can be handed to the
+//  machine as is.  Everything before RRLIM is a register only
+//  instruction, everything between RRLIM and RALIM is a register
+//  to memory instruction.
+//
+enum class OpCode {
+    HALT, NOP, IN, INB, INC, OUT, OUTB, OUTC, OUTNL,
+    ADD, SUB, MUL, DIV, MOD, AND, OR, XOR, NOT, NEG, SWP, RND,
+    TLT, SLT, TLE, TGT, SGT, TGE, TEQ, TNE,
+    MOV, SET, CO, COA,
+    RRLIM,
+    LD, ST, LDA, LDC, JZR, JNZ, JMP,
+    RALIM,
+    LIT
+};
+
+const char *opCodeName(OpCode op);
+
+
 //
 //  The following functions were borrowed from Tiny compiler code generator
 //
@@ -34,17 +55,49 @@ void emitGoto(int d, long long int s, char *c, char *cc);
 void emitGotoAbs(int a, char *c);
 void emitGotoAbs(int a, char *c, char *cc);
 
-void emitRM(char *op, long long int r, long long int d, long long int s, char *c);
-void emitRM(char *op, long long int r, long long int d, long long int s, char *c, char *cc);
-void emitRMAbs(char *op, long long int r, long long int a, char *c);
-void emitRMAbs(char *op, long long int r, long long int a, char *c, char *cc);
+void emitRM(OpCode op, long long int r, long long int d, long long int s, char *c);
+void emitRM(OpCode op, long long int r, long long int d, long long int s, char *c, char *cc);
+void emitRMAbs(OpCode op, long long int r, long long int a, char *c);
+void emitRMAbs(OpCode op, long long int r, long long int a, char *c, char *cc);
 
-void emitRO(char *op, long long int r, long long int s, long long int t, char *c);
-void emitRO(char *op, long long int r, long long int s, long long int t, char *c, char *cc);
+void emitRO(OpCode op, long long int r, long long int s, long long int t, char *c);
+void emitRO(OpCode op, long long int r, long long int s, long long int t, char *c, char *cc);
 
 void backPatchAJumpToHere(int addr, char *comment);
-void backPatchAJumpToHere(char *cmd, int reg, int addr, char *comment);
+void backPatchAJumpToHere(OpCode cmd, int reg, int addr, char *comment);
 
 int emitLit(char *s);  // for char arrays returns the address where the array was stored.
+int emitLit(char *s, int len);  // same for a string that may hold null characters
+int litAddress(char *s, int len);  // where emitLit puts the literal, without emitting code
+
+
+//
+//  Labels and fixups.  A label names a code location that may not be
+//  known yet.  Jumps to an unbound label are recorded as fixups and
+//  patched in the buffer as soon as the label is bound.
+//
+int newLabel();
+void bindLabel(int label);    // the label now refers to the current location
+void emitRMLabel(OpCode op, long long int r, int label, char *c);   // pc relative reference to label
+void emitGotoLabel(int label, char *c);
+
+
+//
+//  Peephole optimization.  optimizeCode removes redundant and
+//  unreachable instructions from the buffer and moves every pc
+//  relative jump and return address to match.  Code is assumed to be
+//  reached only through pc relative references, the first
+//  instruction and the locations given to markEntryPoint.
+//
+void markEntryPoint(int loc);
+void optimizeCode();      // after all labels are bound, before flushCode
+
+
+//
+//  Code is buffered in memory indexed by location.  flushCode writes
+//  the whole program to the code file in address order in one write,
+//  either as a text listing or as a binary TM object (tmobject.h).
+//
+void flushCode();
 
-#endif
\ No newline at end of file
+#endif
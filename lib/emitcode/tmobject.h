@@ -0,0 +1,63 @@
+#ifndef TM_OBJECT_H__
+#define TM_OBJECT_H__
+
+//
+//  Binary TM object file (.tmo)
+//
+//  A compact alternative to the text listing that the TM can load
+//  without parsing.  All fields are stored in host byte order.
+//
+//      TMOHeader
+//      TMOInstruction  instructions[instrCount]   (address 0 on up)
+//      TMOData         data[dataCount]            (the LIT data segment)
+//      TMOComment      commentLines[commentLineCount]
+//      char            strings[stringBytes]       (null terminated strings)
+//
+//  The comment lines and strings are only present when the
+//  TMO_HAS_COMMENTS flag is set.  Instruction and comment line text
+//  are offsets into the string table.
+//
+//  Opcodes use the numbering of OPCODE in test/tiny/tm.c.
+//
+
+#include <stdint.h>
+
+#define TMO_MAGIC        0x314f4d54    // "TMO1"
+#define TMO_VERSION      1
+
+#define TMO_HAS_COMMENTS 0x1
+
+#define TMO_UNUSED       -1    // opcode of an instruction slot that was never filled
+#define TMO_NO_STRING    -1    // string offset when there is no text
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t flags;
+    uint32_t instrCount;
+    uint32_t dataCount;
+    uint32_t commentLineCount;
+    uint32_t stringBytes;
+    uint32_t reserved;
+} TMOHeader;
+
+typedef struct {
+    int32_t op;
+    int32_t arg1;
+    int64_t arg2;
+    int32_t arg3;
+    int32_t comment;
+} TMOInstruction;
+
+typedef struct {
+    int64_t addr;
+    int64_t value;
+} TMOData;
+
+// a whole line comment that comes before the instruction at loc
+typedef struct {
+    int32_t loc;
+    int32_t text;
+} TMOComment;
+
+#endif
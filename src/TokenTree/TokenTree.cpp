@@ -192,6 +192,14 @@ ExprType TokenTree::getExprType() {
     return this->exprType;
 }
 
+void TokenTree::setOpKind(OpKind ok) {
+    this->opKind = ok;
+}
+
+OpKind TokenTree::getOpKind() {
+    return this->opKind;
+}
+
 const char *TokenTree::getTypeString() {
     switch (getExprType()) {
         case ExprType::BOOL:
@@ -622,18 +630,34 @@ void TokenTree::setGenerated(bool b, bool applyToChildren) {
     }
 }
 
-bool TokenTree::hasLastLine() {
-    return _hasLastLine;
+void TokenTree::setTempsNeeded(int n) {
+    this->tempsNeeded = n;
 }
 
-void TokenTree::setHasLastLine(bool b) {
-    this->_hasLastLine = b;
+int TokenTree::getTempsNeeded() {
+    return this->tempsNeeded;
 }
 
-int TokenTree::getLastLine() {
-    return this->lastLine;
+void TokenTree::setClobbers(int regs) {
+    this->clobbers = regs;
 }
 
-void TokenTree::setLastLine(int line) {
-    this->lastLine = line;
-}
\ No newline at end of file
+int TokenTree::getClobbers() {
+    return this->clobbers;
+}
+
+void TokenTree::setIsPure(bool b) {
+    this->_isPure = b;
+}
+
+bool TokenTree::isPure() {
+    return this->_isPure;
+}
+
+void TokenTree::setMayFault(bool b) {
+    this->_mayFault = b;
+}
+
+bool TokenTree::mayFault() {
+    return this->_mayFault;
+}
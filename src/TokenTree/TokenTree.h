@@ -11,6 +11,11 @@ enum class ExprKind { CALL, CONSTANT, ID, OP, ASSIGN };
 enum class StmtKind { COMPOUND, SELECTION, FOR, WHILE, RETURN, BREAK };
 enum class ExprType { INT, BOOL, CHAR, VOID, UNDEFINED };
 enum class MemoryType { LOCAL, LOCAL_STATIC, PARAM, GLOBAL, UNDEFINED };
+// Operators in the order of the semantic and codegen dispatch tables
+enum class OpKind {
+    LEQ, LESS, GEQ, GREATER, AND, OR, NOT, PLUS, MINUS, TIMES, DIVIDE, MOD, INC, DEC, RANDOM, EQ, NEQ, INDEX,
+    ASSIGN, ADDASS, SUBASS, MULASS, DIVASS, NONE
+};
 
 /**
  * TokenTree is a single class utilized by both the scanner and the parser.
@@ -39,13 +44,14 @@ class TokenTree {
             StmtKind stmtKind;
         } subKind;
         ExprType exprType = ExprType::UNDEFINED;
+        OpKind opKind = OpKind::NONE; // Set by the parser for OP and ASSIGN nodes
         char *exprName;
         bool _isArray = false;
         bool _isStatic = false;
 
         // Semantic information
         bool checkInitialized = true;
-        bool _isUsed = false; // For varibles (maybe functions/params in future)
+        bool _isUsed = false; // For varibles and functions
         bool _isInitialized = false; // For checking variable declarations
         bool _hasReturn = false; // For determining whether a function has a return value
 
@@ -54,8 +60,11 @@ class TokenTree {
         MemoryType memoryType = MemoryType::UNDEFINED;
         int memoryOffset;
         bool _wasGenerated = false;
-        bool _hasLastLine = false;
-        int lastLine;
+        // Worked out once per expression before code generation
+        int tempsNeeded = 0;    // Sethi-Ullman number
+        int clobbers = 0;       // registers besides AC the code may overwrite
+        bool _isPure = true;
+        bool _mayFault = false;
 
         void _printTree(int level, bool isChild, bool isSibling, int num);
         void _setParent();
@@ -130,6 +139,8 @@ class TokenTree {
         ExprType getExprType();
         const char *getTypeString();
         bool isExprTypeUndefined();
+        void setOpKind(OpKind ok);
+        OpKind getOpKind();
         /**
          * Prevents cascading errors from occuring in type checking by
          * verifying that none of the children have undefined types.
@@ -222,10 +233,34 @@ class TokenTree {
         void setGenerated();
         void setGenerated(bool b);
         void setGenerated(bool b, bool applyToChildren);
-        bool hasLastLine();
-        void setHasLastLine(bool b);
-        int getLastLine();
-        void setLastLine(int line);
+
+        // What code generation knows about the subtree rooted here, not
+        // counting siblings.  Set by analyzeTree in codegen.
+        /**
+         * Sethi-Ullman number: how many temporaries evaluating the
+         * subtree needs.
+         */
+        void setTempsNeeded(int n);
+        int getTempsNeeded();
+        /**
+         * Registers other than AC that the code for the subtree may
+         * overwrite, not counting temporaries, which are only ever taken
+         * from freeTemps.
+         */
+        void setClobbers(int regs);
+        int getClobbers();
+        /**
+         * True if evaluating the subtree cannot change anything another
+         * expression could see, so it may be evaluated out of order.
+         */
+        void setIsPure(bool b);
+        bool isPure();
+        /**
+         * True if some part of the subtree could stop the machine: a
+         * division by zero or an array index out of range.
+         */
+        void setMayFault(bool b);
+        bool mayFault();
 };
 
 #endif
\ No newline at end of file
@@ -3,21 +3,54 @@
 #include "emitcode.h"
 #include "symbolTable.h"
 #include "TokenTree.h"
+#include <algorithm>
+#include <map>
+#include <set>
 #include <stack>
+#include <stdexcept>
+#include <string>
+#include <stdarg.h>
+#include <stdlib.h>
 #include "string.h"
 
 // Prototypes
 void _generateCode(TokenTree *tree);
+bool isInlinable(TokenTree *func);
 
 extern TokenTree *syntaxTree;
 extern SymbolTable *symbolTable;
 extern int globalOffset;
+extern bool leanCode;
+extern bool shortCircuit;
 int initLine = -1;
 
 int tOffset = globalOffset;
 int fOffset;
+int frameShift = 0; // Frame of the code being generated relative to FP, moved by inlined calls
 
-std::stack<int> lastLineOfWhile;
+std::stack<int> breakLabels; // Label of the end of each enclosing loop
+
+// Formats a comment into a scratch buffer that the next call reuses,
+// so it must be emitted right away.  Lean code has no comments so
+// nothing is formatted at all.
+char *commentf(const char *format, ...) {
+    static char *buffer = NULL;
+    static int bufferSize = 0;
+    va_list args;
+
+    if (leanCode) return NO_COMMENT;
+    va_start(args, format);
+    int length = vsnprintf(buffer, bufferSize, format, args);
+    va_end(args);
+    if (length >= bufferSize) {
+        bufferSize = length + 1;
+        buffer = (char *) realloc(buffer, bufferSize);
+        va_start(args, format);
+        vsnprintf(buffer, bufferSize, format, args);
+        va_end(args);
+    }
+    return buffer;
+}
 
 void lineSep() {
     emitComment((char *) "** ** ** ** ** ** ** ** ** ** ** **");
@@ -25,29 +58,237 @@ void lineSep() {
 
 void funcHeader(char *funcName) {
     lineSep();
-    char *line;
-    asprintf(&line, "FUNCTION %s", funcName);
+    char *line = commentf("FUNCTION %s", funcName);
     emitComment(line);
-    free(line);
     // Save function address!
     TokenTree *func = (TokenTree *) symbolTable->lookupGlobal(funcName);
     if (func == NULL) {
         throw std::runtime_error("ERROR: Symbol table lookup error.");
     }
     func->setMemoryOffset(emitSkip(0));
-    emitRM((char *) "ST", 3, -1, 1, (char *) "Store return address");
+    markEntryPoint(func->getMemoryOffset());
+    emitRM(OpCode::ST, 3, -1, 1, (char *) "Store return address");
+}
+
+// Offset of a variable from GP, or from FP for one in the frame
+int memoryOffset(TokenTree *var) {
+    if (var->isInGlobalMemory()) return var->getMemoryOffset();
+    return var->getMemoryOffset() + frameShift;
+}
+
+// Loads the base address of array arr into register reg.  Array
+// parameters hold the address, everything else is at an offset.
+void loadArrayBase(int reg, TokenTree *arr, char *comment) {
+    if (arr->isInGlobalMemory()) {
+        emitRM(OpCode::LDA, reg, memoryOffset(arr), GP, comment);
+    } else {
+        if (arr->getMemoryType() == MemoryType::PARAM) {
+            emitRM(OpCode::LD, reg, memoryOffset(arr), FP, comment);
+        } else {
+            emitRM(OpCode::LDA, reg, memoryOffset(arr), FP, comment);
+        }
+    }
+}
+
+// Copies the array whose base address is in AC into the array dest.
+// Only as many elements as both arrays can hold are copied.
+void copyArray(TokenTree *dest) {
+    loadArrayBase(AC1, dest, commentf("Load address of lhs array %s", dest->getStringValue()));
+    emitRM(OpCode::LD, AC2, 1, AC, (char *) "AC2 <- |RHS|");
+    emitRM(OpCode::LD, AC3, 1, AC1, (char *) "AC3 <- |LHS|");
+    emitRO(OpCode::SWP, AC2, AC3, AC3, (char *) "Pick smallest size");
+    emitRO(OpCode::MOV, AC1, AC, AC2, (char *) "Array op =");
+}
+
+// Expression temporaries.  While one side of a binary operation is
+// evaluated the other side is held in a free accumulator, or pushed
+// onto the temp stack when none is free.  Holds nest like the
+// expression tree so a stack is enough to find them again.
+#define TEMP_REGS ((1 << AC2) | (1 << AC3))
+#define ALL_REGS ((1 << AC1) | TEMP_REGS)
+
+struct HeldOperand {
+    int reg;        // register holding the operand, -1 if on the temp stack
+    bool isRight;   // the right operand was evaluated first
+};
+
+std::stack<HeldOperand> heldOperands;
+int freeTemps = TEMP_REGS;
+
+bool isBinaryOp(TokenTree *tree) {
+    return tree->getNodeKind() == NodeKind::EXPRESSION && tree->getExprKind() == ExprKind::OP
+        && tree->getNumChildren() > 1 && tree->getOpKind() != OpKind::INDEX;
+}
+
+bool isArrayElementAssign(TokenTree *tree) {
+    TokenTree *lhs = tree->children[0];
+    return lhs != NULL && lhs->getNodeKind() == NodeKind::EXPRESSION && lhs->getExprKind() == ExprKind::OP;
+}
+
+// A variable or constant.  Loading one only touches AC, so an
+// operand held across it can sit in AC1.
+bool isLeaf(TokenTree *tree) {
+    return tree->getNodeKind() == NodeKind::EXPRESSION && tree->getNumChildren() == 0
+        && (tree->getExprKind() == ExprKind::ID || tree->getExprKind() == ExprKind::CONSTANT);
+}
+
+// & and | skip their right operand once the left one decides the
+// result.  Always with -C, otherwise only when nobody could tell
+// because the right operand has no side effects and cannot fault.
+bool isShortCircuit(TokenTree *tree) {
+    if (!isBinaryOp(tree)) return false;
+    if (tree->getOpKind() != OpKind::AND && tree->getOpKind() != OpKind::OR) return false;
+    return shortCircuit || (tree->children[1]->isPure() && !tree->children[1]->mayFault());
+}
+
+// Temporaries a binary operation needs when evaluated left side first
+// and right side first.  Holding one side costs a temporary for the
+// whole evaluation of the other, unless that is a leaf.
+void orderCosts(TokenTree *tree, int *leftFirst, int *rightFirst) {
+    int left = tree->children[0]->getTempsNeeded();
+    int right = tree->children[1]->getTempsNeeded();
+    *leftFirst = std::max(left, right + !isLeaf(tree->children[1]));
+    *rightFirst = std::max(right, left + !isLeaf(tree->children[0]));
+}
+
+// Fills in the clobbers, purity, faults and temporaries needed of
+// tree, its children and its siblings, children first, so that each
+// is a lookup on the node while the code is generated.  A call
+// overwrites everything, except the IO library which only uses AC and
+// RT and inlined calls which use what their body does.  Functions are
+// declared before they are called, so the body of an inlined call is
+// already done.
+void analyzeTree(TokenTree *tree) {
+    for (; tree != NULL; tree = tree->sibling) {
+        int regs = 0;
+        int needed = 0;
+        bool pure = true;
+        bool fault = false;
+        for (int i = 0; i < MAX_CHILDREN; i++) {
+            analyzeTree(tree->children[i]);
+            for (TokenTree *child = tree->children[i]; child != NULL; child = child->sibling) {
+                regs |= child->getClobbers();
+                needed = std::max(needed, child->getTempsNeeded());
+                pure = pure && child->isPure();
+                fault = fault || child->mayFault();
+            }
+        }
+        switch (tree->getNodeKind()) {
+            case NodeKind::EXPRESSION: {
+                if (tree->getExprKind() == ExprKind::CALL) {
+                    pure = false;
+                    TokenTree *func = (TokenTree *) symbolTable->lookupGlobal(tree->getStringValue());
+                    if (func == NULL) {
+                        regs = ALL_REGS;
+                    } else if (func->getLineNum() != -1) {
+                        if (!isInlinable(func)) regs = ALL_REGS;
+                        else regs |= func->children[1]->getClobbers();
+                    }
+                }
+                if (tree->getExprKind() == ExprKind::ASSIGN) {
+                    pure = false;
+                    if (isArrayElementAssign(tree)) {
+                        regs |= 1 << AC2; // when the index had to be spilled
+                    } else if (tree->children[0]->isArray()) {
+                        regs |= TEMP_REGS; // copyArray
+                    }
+                }
+                if (tree->getExprKind() == ExprKind::OP) {
+                    OpKind op = tree->getOpKind();
+                    if (op == OpKind::RANDOM) pure = false;
+                    if (tree->children[1] != NULL && (op == OpKind::DIVIDE || op == OpKind::MOD || op == OpKind::INDEX)) {
+                        fault = true;
+                    }
+                }
+                break;
+            }
+            case NodeKind::DECLARATION: {
+                if (tree->isArray() && tree->children[0] != NULL) regs |= TEMP_REGS; // copyArray
+                break;
+            }
+            case NodeKind::STATEMENT: {
+                if (tree->getStmtKind() == StmtKind::FOR) regs |= TEMP_REGS; // May keep its cursor in them
+                break;
+            }
+        }
+        tree->setClobbers(regs);
+        tree->setIsPure(pure);
+        tree->setMayFault(fault);
+        if (isShortCircuit(tree)) { // Nothing is held
+            needed = std::max(tree->children[0]->getTempsNeeded(), tree->children[1]->getTempsNeeded());
+        } else if (isBinaryOp(tree)) {
+            int leftFirst, rightFirst;
+            orderCosts(tree, &leftFirst, &rightFirst);
+            needed = rightFirst < leftFirst && pure ? rightFirst : leftFirst;
+        }
+        tree->setTempsNeeded(needed);
+    }
+}
+
+// Evaluate the right operand of a binary operation before the left?
+// Only done when it saves a temporary and neither side has side
+// effects.
+bool evaluateRightFirst(TokenTree *tree) {
+    if (!isBinaryOp(tree) || isShortCircuit(tree)) return false;
+    int leftFirst, rightFirst;
+    orderCosts(tree, &leftFirst, &rightFirst);
+    return rightFirst < leftFirst && tree->isPure();
+}
+
+// Holds the value in AC while rest is evaluated.  Uses AC1 if rest
+// is a leaf, else a free accumulator that rest does not touch, and
+// the temp stack as a last resort.
+void holdOperand(TokenTree *rest, bool isRight, const char *what) {
+    HeldOperand held = { -1, isRight };
+    if (rest == NULL || isLeaf(rest)) {
+        held.reg = AC1;
+    } else {
+        int usable = freeTemps & ~rest->getClobbers();
+        for (int reg = AC2; reg <= AC3; reg++) {
+            if (usable & (1 << reg)) {
+                held.reg = reg;
+                freeTemps &= ~(1 << reg);
+                break;
+            }
+        }
+    }
+    if (held.reg < 0) {
+        emitRM(OpCode::ST, AC, tOffset, FP, commentf("Push %s onto temp stack", what));
+        tOffset--;
+    } else {
+        emitRM(OpCode::LDA, held.reg, 0, AC, commentf("Hold %s in AC%d", what, held.reg - AC));
+    }
+    heldOperands.push(held);
+}
+
+// Releases the innermost held operand and returns the register it is
+// in, popping it into AC1 if it was spilled.
+HeldOperand releaseOperand() {
+    HeldOperand held = heldOperands.top();
+    heldOperands.pop();
+    if (held.reg < 0) {
+        tOffset++;
+        emitRM(OpCode::LD, AC1, tOffset, FP, (char *) "Pop temp stack into AC1");
+        held.reg = AC1;
+    } else if (held.reg != AC1) {
+        freeTemps |= 1 << held.reg;
+    }
+    return held;
 }
 
-void popLeftIntoAC1() {
-    tOffset++;
-    emitRM((char *) "LD", AC1, tOffset, 1, (char *) "Pop left hand side into AC1");
+// Gets the registers holding the left and right operands of a binary
+// operation.  One of them is always AC.
+void popOperands(int *left, int *right) {
+    HeldOperand held = releaseOperand();
+    *left = held.isRight ? AC : held.reg;
+    *right = held.isRight ? held.reg : AC;
 }
 
 void standardClosing() {
     emitComment((char *) "Add standard closing in case there is no return statement");
-    emitRM((char *) "LDC", 2, 0, 0, (char *) "Set return value to 0");
-    emitRM((char *) "LD", 3, -1, 1, (char *) "Load return address");
-    emitRM((char *) "LD", 1, 0, 1, (char *) "Adjust frame pointer");
+    emitRM(OpCode::LDC, 2, 0, 0, (char *) "Set return value to 0");
+    emitRM(OpCode::LD, 3, -1, 1, (char *) "Load return address");
+    emitRM(OpCode::LD, 1, 0, 1, (char *) "Adjust frame pointer");
     emitGoto(0, 3, (char *) "Return");
 }
 
@@ -56,9 +297,8 @@ void funcFooter(char *funcName, bool includeStdClosing) {
     if (includeStdClosing) {
         standardClosing();
     }
-    asprintf(&line, "END FUNCTION %s", funcName);
+    line = commentf("END FUNCTION %s", funcName);
     emitComment(line);
-    free(line);
     emitComment((char *) "");
 }
 
@@ -72,160 +312,128 @@ void generateHeader() {
 }
 
 void jumpToFunction(char *funcName) {
-    char *comment;
-    asprintf(&comment, "Jump to function %s", funcName);
     TokenTree *func = (TokenTree *) symbolTable->lookupGlobal(funcName);
-    emitGotoAbs(func->getMemoryOffset(), comment);
-    free(comment);
+    emitGotoAbs(func->getMemoryOffset(), commentf("Jump to function %s", funcName));
 }
 
 void handlePlus(TokenTree *tree) {
-    popLeftIntoAC1();
-    emitRO((char *) "ADD", AC, AC1, AC, (char *) "+ Operation");
+    int left, right;
+    popOperands(&left, &right);
+    emitRO(OpCode::ADD, AC, left, right, (char *) "+ Operation");
 }
 
 void handleChSignOrMinus(TokenTree *tree) {
     if (tree->children[1] == NULL) {
-        emitRO((char *) "NEG", 3, 3, 0, (char *) "- Change Sign Operation");
+        emitRO(OpCode::NEG, 3, 3, 0, (char *) "- Change Sign Operation");
     } else {
-        popLeftIntoAC1();
-        emitRO((char *) "SUB", AC, AC1, AC, (char *) "- Subtraction Operation");
+        int left, right;
+        popOperands(&left, &right);
+        emitRO(OpCode::SUB, AC, left, right, (char *) "- Subtraction Operation");
     }
 }
 
 void handleSizeOfOrTimes(TokenTree *tree) {
     if (tree->children[1] == NULL) {
-        char *line;
-        asprintf(&line, "Load address of base array %s", tree->children[0]->getStringValue());
-        if (tree->children[0]->isInGlobalMemory()) {
-            emitRM((char *) "LDA", AC, tree->children[0]->getMemoryOffset(), GP, line);
-        } else {
-            if (tree->children[0]->getMemoryType() == MemoryType::PARAM) {
-                emitRM((char *) "LD", AC, tree->children[0]->getMemoryOffset(), FP, line);
-            } else {
-                emitRM((char *) "LDA", AC, tree->children[0]->getMemoryOffset(), FP, line);
-            }
+        if (tree->children[0]->getExprKind() != ExprKind::CONSTANT) { // A literal's address is already in AC
+            loadArrayBase(AC, tree->children[0], commentf("Load address of base array %s", tree->children[0]->getStringValue()));
         }
-        free(line);
-        emitRM((char *) "LD", AC, 1, AC, (char *) "Load array size");
+        emitRM(OpCode::LD, AC, 1, AC, (char *) "Load array size");
     } else {
-        popLeftIntoAC1();
-        emitRO((char *) "MUL", AC, AC1, AC, (char *) "* Multiplication Operation");
+        int left, right;
+        popOperands(&left, &right);
+        emitRO(OpCode::MUL, AC, left, right, (char *) "* Multiplication Operation");
     }
 }
 
 void handleEquality(TokenTree *tree) {
-    popLeftIntoAC1();
-    emitRO((char *) "TEQ", AC, AC1, AC, (char *) "== Equality Operation");
+    int left, right;
+    popOperands(&left, &right);
+    emitRO(OpCode::TEQ, AC, left, right, (char *) "== Equality Operation");
 }
 
 void handleNotEquality(TokenTree *tree) {
-    popLeftIntoAC1();
-    emitRO((char *) "TNE", AC, AC1, AC, (char *) "!= Equality Operation");
+    int left, right;
+    popOperands(&left, &right);
+    emitRO(OpCode::TNE, AC, left, right, (char *) "!= Equality Operation");
 }
 
 void handleAnd(TokenTree *tree) {
-    popLeftIntoAC1();
-    emitRO((char *) "AND", AC, AC1, AC, (char *) "AND operation store in AC");
+    if (isShortCircuit(tree)) return; // Done before the operands
+    int left, right;
+    popOperands(&left, &right);
+    emitRO(OpCode::AND, AC, left, right, (char *) "AND operation store in AC");
 }
 
 void handleOr(TokenTree *tree) {
-    popLeftIntoAC1();
-    emitRO((char *) "OR", AC, AC1, AC, (char *) "OR operation store in AC");
+    if (isShortCircuit(tree)) return; // Done before the operands
+    int left, right;
+    popOperands(&left, &right);
+    emitRO(OpCode::OR, AC, left, right, (char *) "OR operation store in AC");
 }
 
 void handleRand(TokenTree *tree) {
-    emitRO((char *) "RND", AC, AC, 0, (char *) "Gen rand between 0 and value of AC1 in AC");
+    emitRO(OpCode::RND, AC, AC, 0, (char *) "Gen rand between 0 and value of AC1 in AC");
 }
 
 void handleLEQ(TokenTree *tree) {
-    popLeftIntoAC1();
-    emitRO((char *) "TLE", AC, AC1, AC, (char *) "LEQ <= operation store in AC");
+    int left, right;
+    popOperands(&left, &right);
+    emitRO(OpCode::TLE, AC, left, right, (char *) "LEQ <= operation store in AC");
 }
 
 void handleLessThan(TokenTree *tree) {
-    popLeftIntoAC1();
-    emitRO((char *) "TLT", AC, AC1, AC, (char *) "Less than < operation store in AC");
+    int left, right;
+    popOperands(&left, &right);
+    emitRO(OpCode::TLT, AC, left, right, (char *) "Less than < operation store in AC");
 }
 
 void handleGEQ(TokenTree *tree) {
-    popLeftIntoAC1();
-    emitRO((char *) "TGE", AC, AC1, AC, (char *) "GEQ >- operation store in AC");
+    int left, right;
+    popOperands(&left, &right);
+    emitRO(OpCode::TGE, AC, left, right, (char *) "GEQ >- operation store in AC");
 }
 
 void handleGreaterThan(TokenTree *tree) {
-    popLeftIntoAC1();
-    emitRO((char *) "TGT", AC, AC1, AC, (char *) "Greather than > operation store in AC");
+    int left, right;
+    popOperands(&left, &right);
+    emitRO(OpCode::TGT, AC, left, right, (char *) "Greather than > operation store in AC");
 }
 
 void handleNotCG(TokenTree *tree) {
-    emitRM((char *) "LDC", AC1, 1, 0, (char *) "Load 1 into AC1 for not operation");
-    emitRO((char * ) "TNE", AC, AC1, AC, (char * ) "Not ! operation store in AC");
+    emitRM(OpCode::LDC, AC1, 1, 0, (char *) "Load 1 into AC1 for not operation");
+    emitRO(OpCode::TNE, AC, AC1, AC, (char * ) "Not ! operation store in AC");
 }
 
 void handleDivision(TokenTree *tree) {
-    popLeftIntoAC1();
-    emitRO((char *) "DIV", AC, AC1, AC, (char *) "/ Division operation");
+    int left, right;
+    popOperands(&left, &right);
+    emitRO(OpCode::DIV, AC, left, right, (char *) "/ Division operation");
 }
 
 void handleMod(TokenTree *tree) {
-    popLeftIntoAC1();
-    emitRO((char *) "MOD", AC, AC1, AC, (char *) "% mod operation");
+    int left, right;
+    popOperands(&left, &right);
+    emitRO(OpCode::MOD, AC, left, right, (char *) "% mod operation");
 }
 
 void handleUnimplemented(TokenTree *tree) {
-    char *line;
-    asprintf(&line, "Operation %s not implemented!", tree->getStringValue());
-    throw std::runtime_error(line);
+    throw std::runtime_error(std::string("Operation ") + tree->getStringValue() + " not implemented!");
 }
 
 void handleArrayAccessCG(TokenTree *tree) {
     
     if (tree->parent->getNodeKind() == NodeKind::EXPRESSION && tree->parent->getExprKind() == ExprKind::ASSIGN && tree->parent->children[0] == tree) {
-        emitRM((char *) "ST", 3, tOffset, FP, (char *) "Push array index onto temp stack");
-        tOffset--;
+        holdOperand(tree->parent->children[1], false, "array index");
     } else {
         TokenTree *arr = tree->children[0];
-        char *line;
-        asprintf(&line, "Load base address of array %s into AC2", arr->getStringValue());
-        if (arr->isInGlobalMemory()) {
-            emitRM((char *) "LDA", AC2, arr->getMemoryOffset(), GP, line);
-        } else {
-            if (arr->getMemoryType() == MemoryType::PARAM) {
-                emitRM((char *) "LD", AC2, arr->getMemoryOffset(), FP, line);
-            } else {
-                emitRM((char *) "LDA", AC2, arr->getMemoryOffset(), FP, line);
-            }
-        }
-        free(line);
-        emitRO((char *) "SUB", AC2, AC2, AC, (char *) "Compute offset for array");
-        asprintf(&line, "Load array element %s from AC into loc from AC2", arr->getStringValue());
-        emitRM((char *) "LD", AC, 0, AC2, line);
-        free(line);
-    }
-}
-
-const char *operationsCodeGen[NUM_OPS] = {
-    "<=",
-    "<",
-    ">=",
-    ">",
-    "&",
-    "|",
-    "!",
-    "+",
-    "-",
-    "*",
-    "/",
-    "%",
-    "++",
-    "--",
-    "?",
-    "==",
-    "!=",
-    "["
-};
+        loadArrayBase(AC1, arr, commentf("Load base address of array %s into AC1", arr->getStringValue()));
+        emitRO(OpCode::SUB, AC1, AC1, AC, (char *) "Compute offset for array");
+        char *line = commentf("Load array element %s from AC into loc from AC1", arr->getStringValue());
+        emitRM(OpCode::LD, AC, 0, AC1, line);
+    }
+}
 
+// Handlers indexed by OpKind
 void (*functionPointersCodeGen[NUM_OPS])(TokenTree *) = {
     handleLEQ, // LEQ
     handleLessThan, // LESS THAN
@@ -247,15 +455,23 @@ void (*functionPointersCodeGen[NUM_OPS])(TokenTree *) = {
     handleArrayAccessCG, // ARRAY ACCESSOR []
 };
 
-int indexOfOperationCodeGen(TokenTree *tree) {
-    for (int i = 0; i < NUM_OPS; i++) {
-        if (strcmp(tree->getTokenString(), operationsCodeGen[i]) == 0) {
-            return i;
-        }
+
+// True if the code for a declaration can be left out because
+// nothing refers to what it declares
+bool isUnused(TokenTree *decl) {
+    if (decl->getNodeKind() != NodeKind::DECLARATION || decl->isUsed()) return false;
+    switch (decl->getDeclKind()) {
+        case DeclKind::FUNCTION:
+            return true;
+        case DeclKind::VARIABLE: // Keep an initializer that does anything but produce a value
+            return decl->children[0] == NULL || (decl->children[0]->isPure() && !decl->children[0]->mayFault());
     }
-    return -1;
+    return false;
 }
 
+bool needsCode(const char *name) {
+    return !isUnused((TokenTree *) symbolTable->lookupGlobal((char *) name));
+}
 
 void initGlobal(TokenTree *tree) {
     for (int i = 0; i < MAX_CHILDREN; i++) {
@@ -263,15 +479,17 @@ void initGlobal(TokenTree *tree) {
             initGlobal(tree->children[i]);
         }
     }
-    if (tree->getNodeKind() == NodeKind::DECLARATION && tree->getDeclKind() == DeclKind::VARIABLE && tree->isInGlobalMemory()) {
+    if (tree->getNodeKind() == NodeKind::DECLARATION && tree->getDeclKind() == DeclKind::VARIABLE && tree->isInGlobalMemory() && !isUnused(tree)) {
         if (tree->isArray()) {
-            char *line;
-            asprintf(&line, "Load size of %s into AC", tree->getStringValue());
-            emitRM((char *) "LDC", 3, tree->getMemorySize() - 1, 0, line);
-            free(line);
-            asprintf(&line, "Store size of %s in data memory", tree->getStringValue());
-            emitRM((char *) "ST", 3, tree->getMemoryOffset() + 1, 0, line);
-            free(line);
+            char *line = commentf("Load size of %s into AC", tree->getStringValue());
+            emitRM(OpCode::LDC, 3, tree->getMemorySize() - 1, 0, line);
+            line = commentf("Store size of %s in data memory", tree->getStringValue());
+            emitRM(OpCode::ST, 3, tree->getMemoryOffset() + 1, 0, line);
+            if (tree->children[0] != NULL) {
+                tree->children[0]->setGenerated(false, true);
+                _generateCode(tree->children[0]);
+                copyArray(tree);
+            }
         } else {
             tree->setGenerated(false, true);
             for (int i = 0; i < MAX_CHILDREN; i++) {
@@ -280,10 +498,8 @@ void initGlobal(TokenTree *tree) {
                 }
             }
             if (tree->children[0] != NULL) {
-                char *line;
-                asprintf(&line, "Assigning variable %s in %s", tree->getStringValue(), tree->getMemoryTypeString());
-                emitRM((char *) "ST", AC, tree->getMemoryOffset(), 0, line);
-                free(line);
+                char *line = commentf("Assigning variable %s in %s", tree->getStringValue(), tree->getMemoryTypeString());
+                emitRM(OpCode::ST, AC, tree->getMemoryOffset(), 0, line);
             }
         }
     }
@@ -293,114 +509,410 @@ void initGlobal(TokenTree *tree) {
     }
 }
 
-void processBreaks(TokenTree *whileParent, int lastLine, TokenTree *tree) {
-    if (tree == NULL) {
+void processMathAssign(TokenTree *tree) {
+    switch (tree->getOpKind()) {
+        case OpKind::ADDASS:
+            emitRO(OpCode::ADD, AC, AC1, AC, (char *) "+= operation");
+            break;
+        case OpKind::SUBASS:
+            emitRO(OpCode::SUB, AC, AC1, AC, (char *) "-= operation");
+            break;
+        case OpKind::MULASS:
+            emitRO(OpCode::MUL, AC, AC1, AC, (char *) "*= operation");
+            break;
+        case OpKind::DIVASS:
+            emitRO(OpCode::DIV, AC, AC1, AC, (char *) "+= operation");
+            break;
+        case OpKind::INC:
+            emitRM(OpCode::LDA, AC, 1, AC1, (char *) "++ Increment accumulator operation");
+            break;
+        case OpKind::DEC:
+            emitRM(OpCode::LDA, AC, -1, AC1, (char *) "-- Decrement accumulator operation");
+            break;
+    }
+}
+
+void generateInit() {
+    emitComment((char *) "INIT");
+    backPatchAJumpToHere(0, (char *) "Jump to init backpatch");
+    emitRM(OpCode::LD, 0, 0, 0, (char *) "Set the global pointer");
+    emitRM(OpCode::LDA, 1, globalOffset, 0, (char *) "Set the first frame at the end of globals");
+    emitRM(OpCode::ST, 1, 0, 1, (char *) "Store old frame pointer (point to self)");
+    emitComment((char *) "INIT GLOBALS AND STATICS");
+    initGlobal(syntaxTree);
+    emitComment((char *) "END INIT GLOBALS AND STATICS");
+    emitRM(OpCode::LDA, 3, 1, 7, (char *) "Return address in ac");
+    jumpToFunction((char *) "main");
+    emitRO(OpCode::HALT, 0, 0, 0, (char *) "DONE!");
+    emitComment((char *) "END INIT");
+}
+
+// Only routines that something jumps to get code, the calls are
+// normally inlined
+void generateIOLibrary() {
+    if (needsCode("output")) {
+        funcHeader((char *) "output");
+        emitRM(OpCode::LD, 3, -2, 1, (char *) "Load parameter");
+        emitRO(OpCode::OUT, 3, 3, 3, (char *) "Output integer");
+        emitRM(OpCode::LD, 3, -1, 1, (char *) "Load return address");
+        emitRM(OpCode::LD, 1, 0, 1, (char *) "Adjust frame pointer");
+        emitGoto(0, 3, (char *) "Return");
+        funcFooter((char *) "output");
+    }
+
+    if (needsCode("outputb")) {
+        funcHeader((char *) "outputb");
+        emitRM(OpCode::LD, 3, -2, 1, (char *) "Load parameter");
+        emitRO(OpCode::OUTB, 3, 3, 3, (char *) "Output bool");
+        emitRM(OpCode::LD, 3, -1, 1, (char *) "Load return address");
+        emitRM(OpCode::LD, 1, 0, 1, (char *) "Adjust frame pointer");
+        emitGoto(0, 3, (char *) "Return");
+        funcFooter((char *) "outputb");
+    }
+
+    if (needsCode("outputc")) {
+        funcHeader((char *) "outputc");
+        emitRM(OpCode::LD, 3, -2, 1, (char *) "Load parameter");
+        emitRO(OpCode::OUTC, 3, 3, 3, (char *) "Output char");
+        emitRM(OpCode::LD, 3, -1, 1, (char *) "Load return address");
+        emitRM(OpCode::LD, 1, 0, 1, (char *) "Adjust frame pointer");
+        emitGoto(0, 3, (char *) "Return");
+        funcFooter((char *) "outputc");
+    }
+
+    if (needsCode("input")) {
+        funcHeader((char *) "input");
+        emitRO(OpCode::IN, 2, 2, 2, (char *) "Grab int input");
+        emitRM(OpCode::LD, 3, -1, 1, (char *) "Load return address");
+        emitRM(OpCode::LD, 1, 0, 1, (char *) "Adjust frame pointer");
+        emitGoto(0, 3, (char *) "Return");
+        funcFooter((char *) "input");
+    }
+
+    if (needsCode("inputb")) {
+        funcHeader((char *) "inputb");
+        emitRO(OpCode::INB, 2, 2, 2, (char *) "Grab bool input");
+        emitRM(OpCode::LD, 3, -1, 1, (char *) "Load return address");
+        emitRM(OpCode::LD, 1, 0, 1, (char *) "Adjust frame pointer");
+        emitGoto(0, 3, (char *) "Return");
+        funcFooter((char *) "inputb");
+    }
+
+    if (needsCode("inputc")) {
+        funcHeader((char *) "inputc");
+        emitRO(OpCode::INC, 2, 2, 2, (char *) "Grab char input");
+        emitRM(OpCode::LD, 3, -1, 1, (char *) "Load return address");
+        emitRM(OpCode::LD, 1, 0, 1, (char *) "Adjust frame pointer");
+        emitGoto(0, 3, (char *) "Return");
+        funcFooter((char *) "inputc");
+    }
+
+    if (needsCode("outnl")) {
+        funcHeader((char *) "outnl");
+        emitRO(OpCode::OUTNL, 3, 3, 3, (char *) "Output a new line");
+        emitRM(OpCode::LD, 3, -1, 1, (char *) "Load return address");
+        emitRM(OpCode::LD, 1, 0, 1, (char *) "Adjust frame pointer");
+        emitGoto(0, 3, (char *) "Return");
+        funcFooter((char *) "outnl");
+    }
+}
+
+// Leaves the value of a short circuit & or | in AC.  When the left
+// operand decides the result it is also the value.
+void generateShortCircuit(TokenTree *tree) {
+    bool isAnd = tree->getOpKind() == OpKind::AND;
+    int endLabel = newLabel();
+    _generateCode(tree->children[0]);
+    if (isAnd) {
+        emitRMLabel(OpCode::JZR, AC, endLabel, (char *) "& is false, skip right side");
+    } else {
+        emitRMLabel(OpCode::JNZ, AC, endLabel, (char *) "| is true, skip right side");
+    }
+    _generateCode(tree->children[1]);
+    bindLabel(endLabel);
+}
+
+bool isConstant(TokenTree *tree, int value) {
+    return tree->getNodeKind() == NodeKind::EXPRESSION && tree->getExprKind() == ExprKind::CONSTANT
+        && !tree->isArray() && tree->getNumValue() == value && tree->getExprType() != ExprType::CHAR;
+}
+
+// Jumps to label if cond evaluates to when and falls through
+// otherwise.  Short circuit operators branch on each operand in turn
+// so their value is never put together, ! just turns the test around
+// and a comparison with 0 tests the other operand directly.
+void branchOn(TokenTree *cond, bool when, int label, char *comment) {
+    if (cond->getNodeKind() == NodeKind::EXPRESSION && cond->getExprKind() == ExprKind::CONSTANT) {
+        cond->setGenerated();
+        if ((cond->getNumValue() != 0) == when) emitGotoLabel(label, comment);
         return;
     }
-    if (tree->getNodeKind() == NodeKind::STATEMENT && tree->getStmtKind() == StmtKind::BREAK) {
-        if (tree->hasLastLine()) {
-            emitBackup(tree->getLastLine());
-            tree->setHasLastLine(false);
-            emitRMAbs((char *) "JMP", 0, lastLine, (char *) "Break statement backpatch jump");
+    if (cond->getNodeKind() == NodeKind::EXPRESSION && cond->getExprKind() == ExprKind::OP) {
+        OpKind op = cond->getOpKind();
+        if (op == OpKind::NOT) {
+            cond->setGenerated();
+            branchOn(cond->children[0], !when, label, comment);
+            return;
         }
+        if (op == OpKind::EQ || op == OpKind::NEQ) {
+            TokenTree *other = NULL;
+            if (isConstant(cond->children[1], 0)) other = cond->children[0];
+            if (isConstant(cond->children[0], 0)) other = cond->children[1];
+            if (other != NULL) {
+                cond->setGenerated();
+                _generateCode(other);
+                bool jumpIfZero = (op == OpKind::EQ) == when;
+                emitRMLabel(jumpIfZero ? OpCode::JZR : OpCode::JNZ, AC, label, comment);
+                return;
+            }
+        }
+    }
+    if (isShortCircuit(cond)) {
+        bool isAnd = cond->getOpKind() == OpKind::AND;
+        cond->setGenerated();
+        if (isAnd != when) { // Either operand decides on its own
+            branchOn(cond->children[0], when, label, comment);
+            branchOn(cond->children[1], when, label, comment);
+        } else {
+            int skipLabel = newLabel();
+            branchOn(cond->children[0], !when, skipLabel, comment);
+            branchOn(cond->children[1], when, label, comment);
+            bindLabel(skipLabel);
+        }
+        return;
     }
+    _generateCode(cond);
+    emitRMLabel(when ? OpCode::JNZ : OpCode::JZR, AC, label, comment);
+}
 
-    for (int i = 0; i < MAX_CHILDREN; i++) {
-        TokenTree *child = tree->children[i];
-        if (child != NULL) {
-            processBreaks(whileParent, lastLine, child);
+// Inlining.  A call to a small function gets a copy of the function
+// body instead of a jump.  The
+// arguments still go where the ghost frame would have been and the
+// body addresses its variables there, frameShift away from FP, so
+// nothing but the frame link and return address is saved.  Calls to
+// the IO library become the single instruction the routine does.
+#define INLINE_SIZE_LIMIT 24
+#define NUM_IO_ROUTINES 7
+
+const char *ioRoutines[NUM_IO_ROUTINES] = { "output", "outputb", "outputc", "input", "inputb", "inputc", "outnl" };
+OpCode ioInstructions[NUM_IO_ROUTINES] = { OpCode::OUT, OpCode::OUTB, OpCode::OUTC, OpCode::IN, OpCode::INB, OpCode::INC, OpCode::OUTNL };
+
+std::stack<int> inlineReturns; // Label after each body being inlined
+
+// Calls are inlined into inlined bodies too, so what a function costs
+// is its body together with everything inlined into it.  That is
+// worked out once per function.  A call back to a function whose size
+// is still being worked out makes the body it is in too big, so a
+// recursive call is never inlined.
+std::map<TokenTree *, bool> inlinable;
+std::map<TokenTree *, int> inlinedSizes; // At most INLINE_SIZE_LIMIT + 1
+std::set<TokenTree *> sizing;
+
+// Nodes in tree, counting the bodies of the calls that get inlined
+int inlinedSize(TokenTree *tree) {
+    int count = 0;
+    for (; tree != NULL; tree = tree->sibling) {
+        count++;
+        if (tree->getNodeKind() == NodeKind::EXPRESSION && tree->getExprKind() == ExprKind::CALL) {
+            TokenTree *func = (TokenTree *) symbolTable->lookupGlobal(tree->getStringValue());
+            if (sizing.count(func) > 0) return INLINE_SIZE_LIMIT + 1;
+            if (isInlinable(func)) count += inlinedSizes[func];
+        }
+        for (int i = 0; i < MAX_CHILDREN; i++) {
+            count += inlinedSize(tree->children[i]);
         }
     }
+    return count;
+}
 
-    if (tree->sibling != NULL) {
-        processBreaks(whileParent, lastLine, tree->sibling);
+bool isInlinable(TokenTree *func) {
+    if (func == NULL || func->getLineNum() == -1 || func->children[1] == NULL) return false;
+    std::map<TokenTree *, bool>::iterator known = inlinable.find(func);
+    if (known != inlinable.end()) return known->second;
+    sizing.insert(func);
+    inlinedSizes[func] = std::min(inlinedSize(func->children[1]), INLINE_SIZE_LIMIT + 1);
+    sizing.erase(func);
+    inlinable[func] = inlinedSizes[func] <= INLINE_SIZE_LIMIT;
+    return inlinable[func];
+}
+
+bool isIOCall(TokenTree *call) {
+    TokenTree *func = (TokenTree *) symbolTable->lookupGlobal(call->getStringValue());
+    return func != NULL && func->getLineNum() == -1;
+}
+
+// The instruction an IO library routine is made of
+OpCode ioInstruction(char *name) {
+    for (int i = 0; i < NUM_IO_ROUTINES; i++) {
+        if (strcmp(name, ioRoutines[i]) == 0) return ioInstructions[i];
     }
+    throw std::runtime_error("ERROR: Unknown IO routine.");
 }
 
-void processMathAssign(TokenTree *tree) {
-    char *str = tree->getTokenString();
-    if (strcmp(str, "+=") == 0) {
-        emitRO((char *) "ADD", AC, AC1, AC, (char *) "+= operation");
-    } else if (strcmp(str, "-=") == 0) {
-        emitRO((char *) "SUB", AC, AC1, AC, (char *) "-= operation");
-    } else if (strcmp(str, "*=") == 0) {
-        emitRO((char *) "MUL", AC, AC1, AC, (char *) "*= operation");
-    } else if (strcmp(str, "/=") == 0) {
-        emitRO((char *) "DIV", AC, AC1, AC, (char *) "+= operation");
-    } else if (strcmp(str, "++") == 0) {
-        emitRM((char *) "LDA", AC, 1, AC1, (char *) "++ Increment accumulator operation");
-    } else if (strcmp(str, "--") == 0) {
-        emitRM((char *) "LDA", AC, -1, AC1, (char *) "-- Decrement accumulator operation");
+// Marks tree and everything under it as not generated so a body can
+// be generated once more
+void clearGenerated(TokenTree *tree) {
+    for (; tree != NULL; tree = tree->sibling) {
+        tree->setGenerated(false, false);
+        for (int i = 0; i < MAX_CHILDREN; i++) {
+            clearGenerated(tree->children[i]);
+        }
     }
 }
 
-void generateInit() {
-    emitComment((char *) "INIT");
-    backPatchAJumpToHere(0, (char *) "Jump to init backpatch");
-    emitRM((char *) "LD", 0, 0, 0, (char *) "Set the global pointer");
-    emitRM((char *) "LDA", 1, globalOffset, 0, (char *) "Set the first frame at the end of globals");
-    emitRM((char *) "ST", 1, 0, 1, (char *) "Store old frame pointer (point to self)");
-    emitComment((char *) "INIT GLOBALS AND STATICS");
-    initGlobal(syntaxTree);
-    emitComment((char *) "END INIT GLOBALS AND STATICS");
-    emitRM((char *) "LDA", 3, 1, 7, (char *) "Return address in ac");
-    jumpToFunction((char *) "main");
-    emitRO((char *) "HALT", 0, 0, 0, (char *) "DONE!");
-    emitComment((char *) "END INIT");
+void inlineIOCall(TokenTree *call) {
+    for (int i = 0; i < MAX_CHILDREN; i++) {
+        _generateCode(call->children[i]);
+    }
+    emitRO(ioInstruction(call->getStringValue()), AC, AC, AC, commentf("Inline %s", call->getStringValue()));
 }
 
-void generateIOLibrary() {
-    funcHeader((char *) "output");
-    emitRM((char *) "LD", 3, -2, 1, (char *) "Load parameter");
-    emitRO((char *) "OUT", 3, 3, 3, (char *) "Output integer");
-    emitRM((char *) "LD", 3, -1, 1, (char *) "Load return address");
-    emitRM((char *) "LD", 1, 0, 1, (char *) "Adjust frame pointer");
-    emitGoto(0, 3, (char *) "Return");
-    funcFooter((char *) "output");
+// The body leaves the return value in AC and returns jump past it
+void inlineCall(TokenTree *call, TokenTree *func) {
+    emitComment(commentf("INLINE CALL %s", call->getStringValue()));
+    int previousFoffset = fOffset;
+    int previousTOffset = tOffset;
+    int previousShift = frameShift;
+    fOffset = tOffset - 2;
+    tOffset -= func->getMemorySize();
 
-    funcHeader((char *) "outputb");
-    emitRM((char *) "LD", 3, -2, 1, (char *) "Load parameter");
-    emitRO((char *) "OUTB", 3, 3, 3, (char *) "Output bool");
-    emitRM((char *) "LD", 3, -1, 1, (char *) "Load return address");
-    emitRM((char *) "LD", 1, 0, 1, (char *) "Adjust frame pointer");
-    emitGoto(0, 3, (char *) "Return");
-    funcFooter((char *) "outputb");
+    for (int i = 0; i < MAX_CHILDREN; i++) {
+        _generateCode(call->children[i]);
+    }
 
-    funcHeader((char *) "outputc");
-    emitRM((char *) "LD", 3, -2, 1, (char *) "Load parameter");
-    emitRO((char *) "OUTC", 3, 3, 3, (char *) "Output char");
-    emitRM((char *) "LD", 3, -1, 1, (char *) "Load return address");
-    emitRM((char *) "LD", 1, 0, 1, (char *) "Adjust frame pointer");
-    emitGoto(0, 3, (char *) "Return");
-    funcFooter((char *) "outputc");
+    TokenTree *body = func->children[1];
+    int endLabel = newLabel();
+    frameShift = previousTOffset;
+    inlineReturns.push(endLabel);
+    clearGenerated(body);
+    _generateCode(body);
+    clearGenerated(body); // For the function itself and other calls
+    inlineReturns.pop();
+    if (func->getExprType() != ExprType::VOID) { // Dead after a final return, the peephole drops it
+        emitRM(OpCode::LDC, AC, 0, 0, (char *) "Set return value to 0");
+    }
+    bindLabel(endLabel);
+    frameShift = previousShift;
+    tOffset = previousTOffset;
+    fOffset = previousFoffset;
+    emitComment(commentf("END INLINE CALL %s", call->getStringValue()));
+}
 
-    funcHeader((char *) "input");
-    emitRO((char *) "IN", 2, 2, 2, (char *) "Grab int input");
-    emitRM((char *) "LD", 3, -1, 1, (char *) "Load return address");
-    emitRM((char *) "LD", 1, 0, 1, (char *) "Adjust frame pointer");
-    emitGoto(0, 3, (char *) "Return");
-    funcFooter((char *) "input");
+// Tail calls.  A call whose value is returned right away reuses the
+// frame of the function returning it: the arguments overwrite the
+// parameters and the callee is entered past the store of its return
+// address, which is already in place.  The frame can grow or shrink
+// so any function can be tail called, itself or another one.
+bool isTailCall(TokenTree *call) {
+    TokenTree *parent = call->parent;
+    if (!inlineReturns.empty()) return false; // An inlined body has no frame of its own
+    if (isIOCall(call) || isInlinable((TokenTree *) symbolTable->lookupGlobal(call->getStringValue()))) return false;
+    if (parent->getNodeKind() != NodeKind::STATEMENT || parent->getStmtKind() != StmtKind::RETURN) return false;
+    for (TokenTree *arg = call->children[0]; arg != NULL; arg = arg->sibling) {
+        // The callee's frame would overwrite an array in this one
+        if (arg->isArray() && arg->getExprKind() == ExprKind::ID && !arg->isInGlobalMemory()
+                && arg->getMemoryType() != MemoryType::PARAM) {
+            return false;
+        }
+    }
+    return true;
+}
 
-    funcHeader((char *) "inputb");
-    emitRO((char *) "INB", 2, 2, 2, (char *) "Grab bool input");
-    emitRM((char *) "LD", 3, -1, 1, (char *) "Load return address");
-    emitRM((char *) "LD", 1, 0, 1, (char *) "Adjust frame pointer");
-    emitGoto(0, 3, (char *) "Return");
-    funcFooter((char *) "inputb");
+// The arguments are evaluated into the ghost frame as usual, except
+// the last one which stays in AC, and then moved over the parameters
+void tailCall(TokenTree *call, TokenTree *func) {
+    emitComment(commentf("TAIL CALL %s", call->getStringValue()));
+    int previousFoffset = fOffset;
+    int previousTOffset = tOffset;
+    fOffset = tOffset - 2;
+    tOffset -= func->getMemorySize();
 
-    funcHeader((char *) "inputc");
-    emitRO((char *) "INC", 2, 2, 2, (char *) "Grab char input");
-    emitRM((char *) "LD", 3, -1, 1, (char *) "Load return address");
-    emitRM((char *) "LD", 1, 0, 1, (char *) "Adjust frame pointer");
-    emitGoto(0, 3, (char *) "Return");
-    funcFooter((char *) "inputc");
+    for (int i = 0; i < MAX_CHILDREN; i++) {
+        _generateCode(call->children[i]);
+    }
 
-    funcHeader((char *) "outnl");
-    emitRO((char *) "OUTNL", 3, 3, 3, (char *) "Output a new line");
-    emitRM((char *) "LD", 3, -1, 1, (char *) "Load return address");
-    emitRM((char *) "LD", 1, 0, 1, (char *) "Adjust frame pointer");
-    emitGoto(0, 3, (char *) "Return");
-    funcFooter((char *) "outnl");
+    int slot = previousTOffset - 2;
+    TokenTree *param = func->children[0];
+    for (TokenTree *arg = call->children[0]; arg != NULL; arg = arg->sibling, param = param->sibling, slot--) {
+        if (arg->sibling != NULL) {
+            emitRM(OpCode::LD, AC1, slot, FP, commentf("Load argument for %s", param->getStringValue()));
+            emitRM(OpCode::ST, AC1, param->getMemoryOffset(), FP, commentf("Store argument over parameter %s", param->getStringValue()));
+        } else {
+            emitRM(OpCode::ST, AC, param->getMemoryOffset(), FP, commentf("Store argument over parameter %s", param->getStringValue()));
+        }
+    }
+    emitGotoAbs(func->getMemoryOffset() + 1, (char *) "Tail call, skip storing the return address");
+    tOffset = previousTOffset;
+    fOffset = previousFoffset;
+    emitComment(commentf("END TAIL CALL %s", call->getStringValue()));
+}
+
+// Dead code.  Semantic analysis marks every function that is called
+// somewhere as used.  Before any code is generated that is narrowed
+// down to the functions jumped to from code that can run, starting
+// at main.  A function whose calls are all inlined is not jumped to.
+void markCalls(TokenTree *tree, std::set<TokenTree *> &called, std::set<TokenTree *> &walked) {
+    for (; tree != NULL; tree = tree->sibling) {
+        if (tree->getNodeKind() == NodeKind::EXPRESSION && tree->getExprKind() == ExprKind::CALL && !isIOCall(tree)) {
+            TokenTree *func = (TokenTree *) symbolTable->lookupGlobal(tree->getStringValue());
+            if (func != NULL) {
+                if (!isInlinable(func)) called.insert(func);
+                if (walked.insert(func).second) markCalls(func->children[1], called, walked);
+            }
+        }
+        for (int i = 0; i < MAX_CHILDREN; i++) {
+            markCalls(tree->children[i], called, walked);
+        }
+    }
+}
+
+void markReachable() {
+    std::set<TokenTree *> called;
+    std::set<TokenTree *> walked;
+    TokenTree *main = (TokenTree *) symbolTable->lookupGlobal((char *) "main");
+    called.insert(main);
+    walked.insert(main);
+    markCalls(main->children[1], called, walked);
+    main->setIsUsed(true);
+    for (TokenTree *decl = syntaxTree; decl != NULL; decl = decl->sibling) {
+        if (decl->getNodeKind() == NodeKind::DECLARATION && decl->getDeclKind() == DeclKind::FUNCTION) {
+            decl->setIsUsed(decl->isUsed() && called.count(decl) > 0);
+        }
+    }
+    for (int i = 0; i < NUM_IO_ROUTINES; i++) {
+        TokenTree *func = (TokenTree *) symbolTable->lookupGlobal((char *) ioRoutines[i]);
+        func->setIsUsed(func->isUsed() && called.count(func) > 0);
+    }
+}
+
+// The value of a condition known at compile time
+bool isConstantCondition(TokenTree *cond, bool *value) {
+    if (cond->getNodeKind() != NodeKind::EXPRESSION || cond->getExprKind() != ExprKind::CONSTANT) return false;
+    *value = cond->getNumValue() != 0;
+    return true;
+}
+
+// True if control never gets past stmt, so whatever follows it in
+// the same statement list is never run
+bool endsFlow(TokenTree *stmt) {
+    if (stmt == NULL || stmt->getNodeKind() != NodeKind::STATEMENT) return false;
+    switch (stmt->getStmtKind()) {
+        case StmtKind::RETURN:
+        case StmtKind::BREAK:
+            return true;
+        case StmtKind::COMPOUND: {
+            for (TokenTree *child = stmt->children[1]; child != NULL; child = child->sibling) {
+                if (endsFlow(child)) return true;
+            }
+            return false;
+        }
+        case StmtKind::SELECTION: {
+            bool value;
+            if (isConstantCondition(stmt->children[0], &value)) return endsFlow(value ? stmt->children[1] : stmt->children[2]);
+            return endsFlow(stmt->children[1]) && endsFlow(stmt->children[2]);
+        }
+    }
+    return false;
 }
 
 void beforeChildrenCodeGen(TokenTree *tree) {
@@ -413,6 +925,15 @@ void beforeChildrenCodeGen(TokenTree *tree) {
                     fOffset = -2;
                     break;
                 }
+                case DeclKind::VARIABLE: {
+                    if (tree->isArray() && !tree->isInGlobalMemory()) { // Size goes in before any initializer is copied
+                        char *line = commentf("Load size of %s into AC", tree->getStringValue());
+                        emitRM(OpCode::LDC, 3, tree->getMemorySize() - 1, 0, line);
+                        line = commentf("Store size of %s in data memory", tree->getStringValue());
+                        emitRM(OpCode::ST, 3, memoryOffset(tree) + 1, FP, line);
+                    }
+                    break;
+                }
             }
             break;
         }
@@ -420,16 +941,24 @@ void beforeChildrenCodeGen(TokenTree *tree) {
             switch (tree->getExprKind()) {
                 case ExprKind::CALL: {
                     TokenTree *func = (TokenTree *) symbolTable->lookup(tree->getStringValue());
-                    char *line;
-                    asprintf(&line, "CALL %s", tree->getStringValue());
-                    emitComment(line);
-                    asprintf(&line, "Store frame pointer in ghost frame for %s", tree->getStringValue());
-                    emitRM((char *) "ST", FP, tOffset, FP, (char *) line);
+                    if (isIOCall(tree)) {
+                        inlineIOCall(tree);
+                        break;
+                    }
+                    if (isInlinable(func)) {
+                        inlineCall(tree, func);
+                        break;
+                    }
+                    if (isTailCall(tree)) {
+                        tailCall(tree, func);
+                        break;
+                    }
+                    emitComment(commentf("CALL %s", tree->getStringValue()));
+                    emitRM(OpCode::ST, FP, tOffset, FP, commentf("Store frame pointer in ghost frame for %s", tree->getStringValue()));
                     int previousFoffset = fOffset;
                     int previousTOffset = tOffset;
                     fOffset = tOffset - 2;
                     tOffset -= func->getMemorySize();
-                    free(line);
 
                     for (int i = 0; i < MAX_CHILDREN; i++) {
                         TokenTree *child = tree->children[i];
@@ -439,23 +968,27 @@ void beforeChildrenCodeGen(TokenTree *tree) {
                     }
 
                     emitComment((char *) "Begin call");
-                    emitRM((char *) "LDA", 1, previousTOffset, 1, (char *) "Move the frame pointer to the new frame");
-                    emitRM((char *) "LDA", AC, 1, 7, (char *) "Store the return address in ac (skip 1 ahead)");
+                    emitRM(OpCode::LDA, 1, previousTOffset, 1, (char *) "Move the frame pointer to the new frame");
+                    emitRM(OpCode::LDA, AC, 1, 7, (char *) "Store the return address in ac (skip 1 ahead)");
                     emitGotoAbs(func->getMemoryOffset(), (char *) "Call function");
                     tOffset += func->getMemorySize();
                     fOffset = previousFoffset;
-                    emitRM((char *) "LDA", AC, 0, RT, (char *) "Save return result in accumulator");
-                    asprintf(&line, "END CALL %s", tree->getStringValue());
-                    emitComment(line);
-                    free(line);
+                    emitRM(OpCode::LDA, AC, 0, RT, (char *) "Save return result in accumulator");
+                    emitComment(commentf("END CALL %s", tree->getStringValue()));
+                    break;
+                }
+                case ExprKind::OP: {
+                    if (isShortCircuit(tree)) generateShortCircuit(tree);
                     break;
                 }
                 case ExprKind::CONSTANT: {
+                    if (tree->isArray()) {
+                        emitLit(tree->getStringValue(), tree->getNumValue());
+                        break;
+                    }
                     int constValue = tree->getExprType() == ExprType::CHAR ? (int) tree->getCharValue() : tree->getNumValue();
-                    char *line;
-                    asprintf(&line, "Load %s constant", tree->getTypeString());
-                    emitRM((char *) "LDC", AC, constValue, 0, line);
-                    free(line);
+                    char *line = commentf("Load %s constant", tree->getTypeString());
+                    emitRM(OpCode::LDC, AC, constValue, 0, line);
                     break;
                 }
             }
@@ -469,39 +1002,119 @@ void beforeChildrenCodeGen(TokenTree *tree) {
                 }
                 case StmtKind::SELECTION: {
                     emitComment((char *) "BEGIN IF BLOCK");
-                    int currentLoc, saveLoc1, saveLoc2;
-                    _generateCode(tree->children[0]);
-                    saveLoc1 = emitSkip(1);
+                    bool value;
+                    if (isConstantCondition(tree->children[0], &value)) { // Only one side can run
+                        TokenTree *skipped = tree->children[value ? 2 : 1];
+                        tree->children[0]->setGenerated();
+                        if (skipped != NULL) skipped->setGenerated();
+                        _generateCode(tree->children[value ? 1 : 2]);
+                        emitComment((char *) "END IF");
+                        break;
+                    }
+                    int elseLabel = newLabel();
+                    branchOn(tree->children[0], false, elseLabel, (char *) "IF JMP TO ELSE");
                     emitComment((char *) "IF JUMP TO ELSE");
                     _generateCode(tree->children[1]);
-                    saveLoc2 = emitSkip(1);
-                    emitComment((char *) "IF JUMP TO END");
-                    currentLoc = emitSkip(0);
-                    emitBackup(saveLoc1);
-                    emitRMAbs((char *) "JZR", AC, currentLoc, (char *) "IF JMP TO ELSE");
-                    emitBackup(currentLoc);
-                    _generateCode(tree->children[2]);
-                    currentLoc = emitSkip(0);
-                    emitBackup(saveLoc2);
-                    emitRMAbs((char *) "LDA", PC, currentLoc, (char *) "JUMP TO END");
-                    emitBackup(currentLoc);
+                    if (tree->children[2] != NULL) {
+                        int endLabel = newLabel();
+                        emitRMLabel(OpCode::LDA, PC, endLabel, (char *) "JUMP TO END");
+                        emitComment((char *) "IF JUMP TO END");
+                        bindLabel(elseLabel);
+                        _generateCode(tree->children[2]);
+                        bindLabel(endLabel);
+                    } else {
+                        bindLabel(elseLabel);
+                    }
                     emitComment((char *) "END IF");
                     break;
                 }
+                case StmtKind::FOR: {
+                    // The cursor walks down from the first element to the
+                    // bound, the address just past the last one.  Both stay
+                    // in AC2/AC3 unless the body needs those registers,
+                    // then they get two temp stack slots.
+                    emitComment((char *) "Beginning FOR statement");
+                    TokenTree *var = tree->children[0];
+                    TokenTree *arr = tree->children[1];
+                    TokenTree *body = tree->children[2];
+                    var->setGenerated();
+                    arr->setGenerated();
+                    int bodyLabel = newLabel();
+                    int testLabel = newLabel();
+                    int endLabel = newLabel();
+                    bool inRegisters = body == NULL || (body->getClobbers() & TEMP_REGS) == 0;
+                    int cursorSlot = tOffset;
+                    int boundSlot = tOffset - 1;
+                    if (inRegisters) {
+                        loadArrayBase(AC2, arr, commentf("Load address of array %s into cursor AC2", arr->getStringValue()));
+                        emitRM(OpCode::LD, AC3, 1, AC2, (char *) "Load array size");
+                        emitRO(OpCode::SUB, AC3, AC2, AC3, (char *) "Bound in AC3 is just past the last element");
+                        freeTemps &= ~TEMP_REGS;
+                    } else {
+                        loadArrayBase(AC, arr, commentf("Load address of array %s", arr->getStringValue()));
+                        emitRM(OpCode::LD, AC1, 1, AC, (char *) "Load array size");
+                        emitRO(OpCode::SUB, AC1, AC, AC1, (char *) "Bound is just past the last element");
+                        emitRM(OpCode::ST, AC, cursorSlot, FP, (char *) "Store cursor on temp stack");
+                        emitRM(OpCode::ST, AC1, boundSlot, FP, (char *) "Store bound on temp stack");
+                        tOffset -= 2;
+                    }
+                    emitGotoLabel(testLabel, (char *) "Jump to FOR test");
+                    bindLabel(bodyLabel);
+                    if (inRegisters) {
+                        emitRM(OpCode::LD, AC, 0, AC2, (char *) "Load element at cursor");
+                    } else {
+                        emitRM(OpCode::LD, AC1, cursorSlot, FP, (char *) "Load cursor");
+                        emitRM(OpCode::LD, AC, 0, AC1, (char *) "Load element at cursor");
+                    }
+                    emitRM(OpCode::ST, AC, memoryOffset(var), FP, commentf("Store element in %s", var->getStringValue()));
+                    breakLabels.push(endLabel);
+                    _generateCode(body);
+                    breakLabels.pop();
+                    if (inRegisters) {
+                        emitRM(OpCode::LDA, AC2, -1, AC2, (char *) "Advance cursor");
+                    } else {
+                        emitRM(OpCode::LD, AC, cursorSlot, FP, (char *) "Load cursor");
+                        emitRM(OpCode::LDA, AC, -1, AC, (char *) "Advance cursor");
+                        emitRM(OpCode::ST, AC, cursorSlot, FP, (char *) "Store cursor");
+                    }
+                    bindLabel(testLabel);
+                    if (inRegisters) {
+                        emitRO(OpCode::SUB, AC, AC2, AC3, (char *) "Compare cursor with bound");
+                        freeTemps |= TEMP_REGS;
+                    } else {
+                        emitRM(OpCode::LD, AC, cursorSlot, FP, (char *) "Load cursor");
+                        emitRM(OpCode::LD, AC1, boundSlot, FP, (char *) "Load bound");
+                        emitRO(OpCode::SUB, AC, AC, AC1, (char *) "Compare cursor with bound");
+                        tOffset += 2;
+                    }
+                    emitRMLabel(OpCode::JNZ, AC, bodyLabel, (char *) "Loop while elements are left");
+                    bindLabel(endLabel);
+                    emitComment((char *) "End FOR statement");
+                    break;
+                }
                 case StmtKind::WHILE: {
+                    // The test is at the bottom so an iteration takes a
+                    // single branch
                     emitComment((char *) "Beginning WHILE statement");
-                    int L1 = emitSkip(0);
-                    _generateCode(tree->children[0]);
-                    int bp = emitSkip(1);
+                    bool value;
+                    bool isConstant = isConstantCondition(tree->children[0], &value);
+                    if (isConstant && !value) { // The body never runs
+                        tree->children[0]->setGenerated();
+                        if (tree->children[1] != NULL) tree->children[1]->setGenerated();
+                        emitComment((char *) "End WHILE statement");
+                        break;
+                    }
+                    int bodyLabel = newLabel();
+                    int testLabel = newLabel();
+                    int endLabel = newLabel();
+                    if (!isConstant) emitGotoLabel(testLabel, (char *) "Jump to WHILE test");
+                    bindLabel(bodyLabel);
+                    breakLabels.push(endLabel);
                     _generateCode(tree->children[1]);
-                    emitGotoAbs(L1, (char *) "Go to L1");
-                    int end = emitSkip(0);
-                    emitBackup(bp);
-                    emitRMAbs((char *) "JZR", AC, end, (char *) "JMP if condition is false");
-                    emitBackup(end);
-
-                    processBreaks(tree, end, tree->children[1]);
-                    emitBackup(end);
+                    breakLabels.pop();
+                    bindLabel(testLabel);
+                    branchOn(tree->children[0], true, bodyLabel, (char *) "JMP back if condition is true");
+                    bindLabel(endLabel);
                     emitComment((char *) "End WHILE statement");
                     break;
                 }
@@ -516,7 +1129,7 @@ void afterChildrenCodeGen(TokenTree *tree) {
         case NodeKind::DECLARATION: {
             switch (tree->getDeclKind()) {
                 case DeclKind::FUNCTION: {
-                    funcFooter(tree->getStringValue(), true);
+                    funcFooter(tree->getStringValue(), !endsFlow(tree->children[1]));
                     tOffset = -tree->getMemorySize();
                     break;
                 }
@@ -529,21 +1142,14 @@ void afterChildrenCodeGen(TokenTree *tree) {
                         return; // Handle in init
                     }
                     if (tree->isArray()) {
-                        char *line;
-                            asprintf(&line, "Load size of %s into AC", tree->getStringValue());
-                            emitRM((char *) "LDC", 3, tree->getMemorySize() - 1, 0, line);
-                            free(line);
-                            asprintf(&line, "Store size of %s in data memory", tree->getStringValue());
-                            emitRM((char *) "ST", 3, tree->getMemoryOffset() + 1, FP, line);
-                            free(line);
-                    }
-                    if (tree->children[0] != NULL) {
+                        if (tree->children[0] != NULL) {
+                            copyArray(tree);
+                        }
+                    } else if (tree->children[0] != NULL) {
                         int tRegister = FP;
                         if (tree->isInGlobalMemory()) tRegister = GP;
-                        char *line;
-                        asprintf(&line, "Assigning variable %s in %s", tree->getStringValue(), tree->getMemoryTypeString());
-                        emitRM((char *) "ST", AC, tree->getMemoryOffset(), tRegister, line);
-                        free(line);
+                        char *line = commentf("Assigning variable %s in %s", tree->getStringValue(), tree->getMemoryTypeString());
+                        emitRM(OpCode::ST, AC, memoryOffset(tree), tRegister, line);
                     }
                     break;
                 }
@@ -560,79 +1166,60 @@ void afterChildrenCodeGen(TokenTree *tree) {
                     char *line;
                     int tRegister = FP;
                     if (tree->isInGlobalMemory()) tRegister = GP;
-                    if (tree->isArray()) {
-                        asprintf(&line, "Load base address of array %s", tree->getStringValue());
-                        if (tree->isInGlobalMemory()) {
-                            emitRM((char *) "LDA", AC, tree->getMemoryOffset(), GP, line);
-                        } else {
-                            if (tree->getMemoryType() == MemoryType::PARAM) {
-                                emitRM((char *) "LD", AC, tree->getMemoryOffset(), FP, line);
-                            } else {
-                                emitRM((char *) "LDA", AC, tree->getMemoryOffset(), FP, line);
-                            }
-                        }
-                        free(line);
+                    bool isLhs = tree->parent->getNodeKind() == NodeKind::EXPRESSION && tree->parent->getExprKind() == ExprKind::ASSIGN && tree->parent->children[0] == tree;
+                    if (isLhs) {
+                        // Dont load if on left hand side
+                    } else if (tree->isArray()) {
+                        loadArrayBase(AC, tree, commentf("Load base address of array %s", tree->getStringValue()));
                     } else {
-                        if (!(tree->parent->getNodeKind() == NodeKind::EXPRESSION && tree->parent->getExprKind() == ExprKind::ASSIGN && tree->parent->children[0] == tree)) { // Dont load if on left hand side
-                            asprintf(&line, "Load variable %s into accumulator", tree->getStringValue());
-                            emitRM((char *) "LD", AC, tree->getMemoryOffset(), tRegister, line);
-                            free(line);
-                        }
+                        line = commentf("Load variable %s into accumulator", tree->getStringValue());
+                        emitRM(OpCode::LD, AC, memoryOffset(tree), tRegister, line);
                     }
                     break;
                 }
                 case ExprKind::OP: {
-                    void (*fp)(TokenTree *) = functionPointersCodeGen[indexOfOperationCodeGen(tree)];
+                    void (*fp)(TokenTree *) = functionPointersCodeGen[(int) tree->getOpKind()];
                     fp(tree);
                     break;
                 }
                 case ExprKind::ASSIGN: {
                     int tRegister = FP;
-                    bool mathAndAssign = strlen(tree->getTokenString()) > 1;
+                    bool mathAndAssign = tree->getOpKind() != OpKind::ASSIGN;
                     if (tree->children[0]->getNodeKind() == NodeKind::EXPRESSION && tree->children[0]->getExprKind() == ExprKind::OP) { // Array handling monstrosity
                         TokenTree *arr = tree->children[0]->children[0];
                         if (arr->isInGlobalMemory()) tRegister = GP;
-                        tOffset++;
-                        emitRM((char *) "LD", AC1, tOffset, 1, (char *) "Pop array index into AC1");
-                        char *line;
-                        asprintf(&line, "Load base address of array %s into AC2", arr->getStringValue());
-                        if (arr->isInGlobalMemory()) {
-                            emitRM((char *) "LDA", AC2, arr->getMemoryOffset(), GP, line);
-                        } else {
-                            if (arr->getMemoryType() == MemoryType::PARAM) {
-                                emitRM((char *) "LD", AC2, arr->getMemoryOffset(), FP, line);
-                            } else {
-                                emitRM((char *) "LDA", AC2, arr->getMemoryOffset(), FP, line);
-                            }
-                        }
-                        free(line);
-                        emitRO((char *) "SUB", AC2, AC2, AC1, (char *) "Compute offset for array");
+                        // The element address goes in the register that held the
+                        // index, or AC2 if the index was spilled to AC1
+                        int index = releaseOperand().reg;
+                        int base = index == AC1 ? AC2 : AC1;
+                        int address = index == AC1 ? AC2 : index;
+                        loadArrayBase(base, arr, commentf("Load base address of array %s into AC%d", arr->getStringValue(), base - AC));
+                        emitRO(OpCode::SUB, address, base, index, (char *) "Compute offset for array");
                         if (mathAndAssign) {
-                            asprintf(&line, "Load lhs variable %s into AC1", arr->getStringValue());
-                            emitRM((char *) "LD", AC1, 0, AC2, (char *) "Load lhs variable");
-                            free(line);
+                            emitRM(OpCode::LD, AC1, 0, address, (char *) "Load lhs variable");
                             processMathAssign(tree);
                         }
-                        asprintf(&line, "Store variable %s from AC into loc from AC2", arr->getStringValue());
-                        emitRM((char *) "ST", 3, 0, AC2, line);
-                        free(line);
+                        char *line = commentf("Store variable %s from AC into loc from AC%d", arr->getStringValue(), address - AC);
+                        emitRM(OpCode::ST, 3, 0, address, line);
+                    } else if (tree->children[0]->isArray()) {
+                        copyArray(tree->children[0]);
                     } else {
                         if (tree->children[0]->isInGlobalMemory()) tRegister = GP;
                         char *line;
                         if (mathAndAssign) {
-                            asprintf(&line, "Load lhs variable %s into AC1", tree->children[0]->getStringValue());
-                            emitRM((char *) "LD", AC1, tree->children[0]->getMemoryOffset(), tRegister, (char *) "Load lhs variable");
-                            free(line);
+                            emitRM(OpCode::LD, AC1, memoryOffset(tree->children[0]), tRegister, (char *) "Load lhs variable");
                             processMathAssign(tree);
                         }
-                        asprintf(&line, "Assigning variable %s in %s", tree->children[0]->getStringValue(), tree->children[0]->getMemoryTypeString());
-                        emitRM((char *) "ST", AC, tree->children[0]->getMemoryOffset(), tRegister, line);
-                        free(line);
+                        line = commentf("Assigning variable %s in %s", tree->children[0]->getStringValue(), tree->children[0]->getMemoryTypeString());
+                        emitRM(OpCode::ST, AC, memoryOffset(tree->children[0]), tRegister, line);
                     }
                 }
             }
-            if (tree->parent->getNodeKind() == NodeKind::EXPRESSION && tree->parent->getExprKind() == ExprKind::CALL) {
-                emitRM((char *) "ST", AC, fOffset, 1, (char *) "Push parameter onto new frame");
+            // The IO library and the last argument of a tail call take
+            // the argument straight from AC
+            if (tree->parent->getNodeKind() == NodeKind::EXPRESSION && tree->parent->getExprKind() == ExprKind::CALL
+                    && !isIOCall(tree->parent) && !(tree->sibling == NULL && isTailCall(tree->parent))) {
+                emitRM(OpCode::ST, AC, fOffset, 1, (char *) "Push parameter onto new frame");
                 fOffset--;
             }
             break;
@@ -644,15 +1231,22 @@ void afterChildrenCodeGen(TokenTree *tree) {
                     break;
                 }
                 case StmtKind::RETURN: {
-                    emitRM((char *) "LDA", RT, 0, AC, (char *) "Copy accumulator to return register");
-                    emitRM((char *) "LD", 3, -1, 1, (char *) "Load return address");
-                    emitRM((char *) "LD", 1, 0, 1, (char *) "Adjust frame pointer");
+                    if (!inlineReturns.empty()) {
+                        emitGotoLabel(inlineReturns.top(), (char *) "Return from inlined call");
+                        break;
+                    }
+                    if (tree->children[0] != NULL && tree->children[0]->getNodeKind() == NodeKind::EXPRESSION
+                            && tree->children[0]->getExprKind() == ExprKind::CALL && isTailCall(tree->children[0])) {
+                        break; // Never comes back here
+                    }
+                    emitRM(OpCode::LDA, RT, 0, AC, (char *) "Copy accumulator to return register");
+                    emitRM(OpCode::LD, 3, -1, 1, (char *) "Load return address");
+                    emitRM(OpCode::LD, 1, 0, 1, (char *) "Adjust frame pointer");
                     emitGoto(0, 3, (char *) "Return");
                     break;
                 }
                 case StmtKind::BREAK: {
-                    tree->setLastLine(emitSkip(1));
-                    tree->setHasLastLine(true);
+                    emitGotoLabel(breakLabels.top(), (char *) "Break statement jump");
                     break;
                 }
             }
@@ -665,10 +1259,9 @@ void afterChildCodeGen(TokenTree *tree, int i) {
         case NodeKind::EXPRESSION: {
             switch (tree->getExprKind()) {
                 case ExprKind::OP: {
-                    if (tree->getNumChildren() > 1 && i == 0) {
-                        if (tree->getTokenString()[0] == '[') return;
-                        emitRM((char *) "ST", AC, tOffset, 1, (char *) "Push left side onto temp variable stack");
-                        tOffset--;
+                    if (isBinaryOp(tree) && !tree->children[1 - i]->wasGenerated()) { // First operand done
+                        bool isRight = i == 1;
+                        holdOperand(tree->children[1 - i], isRight, isRight ? "right side" : "left side");
                     }
                     break;
                 }
@@ -686,9 +1279,15 @@ void _generateCode(TokenTree *tree) {
         return;
     }
     tree->setGenerated();
+    if (isUnused(tree)) { // Nothing refers to it, leave it out
+        _generateCode(tree->sibling);
+        return;
+    }
     beforeChildrenCodeGen(tree);
     
-    for (int i = 0; i < MAX_CHILDREN; i++) {
+    bool rightFirst = evaluateRightFirst(tree);
+    for (int n = 0; n < MAX_CHILDREN; n++) {
+        int i = rightFirst && n < 2 ? 1 - n : n;
         TokenTree *child = tree->children[i];
         if (child != NULL) {
             _generateCode(child);
@@ -698,16 +1297,20 @@ void _generateCode(TokenTree *tree) {
 
     afterChildrenCodeGen(tree);
 
-    if (tree->sibling != NULL) {
+    if (tree->sibling != NULL && !endsFlow(tree)) { // Statements after a return or break are dead
         _generateCode(tree->sibling);
     }
     
 }
 
 void generateCode() {
+    analyzeTree(syntaxTree);
+    markReachable();
     generateHeader();
     emitSkip(1); // Leave space for backpatch
     generateIOLibrary();
     _generateCode(syntaxTree);
     generateInit();
+    optimizeCode();
+    flushCode();
 }
\ No newline at end of file
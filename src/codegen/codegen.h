@@ -1,6 +1,13 @@
 #ifndef CODEGEN_H
 #define CODEGEN_H
+#include "TokenTree.h"
 
 void generateCode();
 
+// Shared with the IR and its lowering
+void analyzeTree(TokenTree *tree);
+char *commentf(const char *format, ...);
+bool isShortCircuit(TokenTree *tree);
+bool isUnused(TokenTree *decl);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,931 @@
+#include "ir.h"
+#include "codegen.h"
+#include "symbolTable.h"
+#include <limits.h>
+#include <algorithm>
+#include <set>
+#include <stack>
+#include <stdexcept>
+
+extern TokenTree *syntaxTree;
+extern SymbolTable *symbolTable;
+
+bool isTerminator(IROp op) {
+    return op == IROp::JUMP || op == IROp::BRANCH || op == IROp::RETURN || op == IROp::TAILCALL || op == IROp::RUN;
+}
+
+void getUses(const IRInstr &instr, std::vector<int> &uses) {
+    uses.clear();
+    if (instr.a != NO_TEMP) uses.push_back(instr.a);
+    if (instr.b != NO_TEMP) uses.push_back(instr.b);
+    if (instr.slot.base == IRBase::TEMP) uses.push_back(instr.slot.temp);
+    uses.insert(uses.end(), instr.args.begin(), instr.args.end());
+}
+
+void getSuccessors(const IRBlock &block, std::vector<int> &successors) {
+    successors.clear();
+    const IRInstr &last = block.instrs.back();
+    if (last.op == IROp::JUMP || last.op == IROp::BRANCH) successors.push_back(last.target);
+    if (last.op == IROp::BRANCH) successors.push_back(last.other);
+}
+
+struct IORoutine {
+    const char *name;
+    IROp op;
+};
+
+// The IO library routines are each a single instruction
+static const IORoutine ioOps[] = {
+    { "output", IROp::OUT }, { "outputb", IROp::OUTB }, { "outputc", IROp::OUTC },
+    { "input", IROp::IN }, { "inputb", IROp::INB }, { "inputc", IROp::INC }, { "outnl", IROp::OUTNL }
+};
+
+static IROp ioOp(const std::string &name) {
+    for (const IORoutine &routine : ioOps) {
+        if (name == routine.name) return routine.op;
+    }
+    throw std::runtime_error("ERROR: Unknown IO routine.");
+}
+
+static IROp binaryOp(OpKind op) {
+    switch (op) {
+        case OpKind::PLUS: case OpKind::ADDASS: return IROp::ADD;
+        case OpKind::MINUS: case OpKind::SUBASS: return IROp::SUB;
+        case OpKind::TIMES: case OpKind::MULASS: return IROp::MUL;
+        case OpKind::DIVIDE: case OpKind::DIVASS: return IROp::DIV;
+        case OpKind::MOD: return IROp::MOD;
+        case OpKind::AND: return IROp::AND;
+        case OpKind::OR: return IROp::OR;
+        case OpKind::LESS: return IROp::LT;
+        case OpKind::LEQ: return IROp::LE;
+        case OpKind::GREATER: return IROp::GT;
+        case OpKind::GEQ: return IROp::GE;
+        case OpKind::EQ: return IROp::EQ;
+        case OpKind::NEQ: return IROp::NE;
+    }
+    throw std::runtime_error("ERROR: Operator has no IR operation.");
+}
+
+static bool isScalarConstant(TokenTree *tree) {
+    return tree != NULL && tree->getNodeKind() == NodeKind::EXPRESSION
+        && tree->getExprKind() == ExprKind::CONSTANT && !tree->isArray();
+}
+
+static int constantValue(TokenTree *tree) {
+    if (tree->getExprType() == ExprType::CHAR) return (int) tree->getCharValue();
+    return tree->getNumValue();
+}
+
+static bool isZero(TokenTree *tree) {
+    return isScalarConstant(tree) && tree->getExprType() != ExprType::CHAR && tree->getNumValue() == 0;
+}
+
+static IRSlot slotOf(TokenTree *var) {
+    IRSlot slot;
+    slot.base = var->isInGlobalMemory() ? IRBase::GLOBAL : IRBase::FRAME;
+    slot.offset = var->getMemoryOffset();
+    return slot;
+}
+
+static IRSlot element(int address, int offset) {
+    IRSlot slot;
+    slot.base = IRBase::TEMP;
+    slot.offset = offset;
+    slot.temp = address;
+    return slot;
+}
+
+// Walks the tree of one function, or of the global initializers,
+// appending instructions to the block being filled.  A jump closes
+// the block and whatever follows goes into a new one that nothing
+// jumps to, which is removed afterwards.
+struct IRBuilder {
+    IRFunction *func = NULL;
+    int current = -1;               // block being filled, -1 right after a jump
+    std::vector<int> layout;        // blocks in the order they were started
+    std::stack<int> breakTargets;   // block after each enclosing loop
+    std::vector<TokenTree *> worklist;  // functions called so far, in order
+    std::set<TokenTree *> queued;
+
+    int newTemp() {
+        return func->numTemps++;
+    }
+
+    int newBlock() {
+        func->blocks.push_back(IRBlock());
+        return func->blocks.size() - 1;
+    }
+
+    // Starts filling block.  The block before it falls through into it.
+    void start(int block) {
+        if (current >= 0) jump(block);
+        current = block;
+        layout.push_back(block);
+    }
+
+    // The reference is good until the next instruction is added
+    IRInstr &emit(IROp op) {
+        if (current < 0) start(newBlock());
+        IRBlock &block = func->blocks[current];
+        block.instrs.push_back(IRInstr());
+        block.instrs.back().op = op;
+        if (isTerminator(op)) current = -1;
+        return block.instrs.back();
+    }
+
+    void jump(int block) {
+        emit(IROp::JUMP).target = block;
+    }
+
+    void branch(int cond, int whenTrue, int whenFalse) {
+        IRInstr &instr = emit(IROp::BRANCH);
+        instr.a = cond;
+        instr.target = whenTrue;
+        instr.other = whenFalse;
+    }
+
+    int constant(int value) {
+        IRInstr &instr = emit(IROp::CONST);
+        instr.dst = newTemp();
+        instr.imm = value;
+        return instr.dst;
+    }
+
+    int unary(IROp op, int a) {
+        IRInstr &instr = emit(op);
+        instr.dst = newTemp();
+        instr.a = a;
+        return instr.dst;
+    }
+
+    int binary(IROp op, int a, int b) {
+        IRInstr &instr = emit(op);
+        instr.dst = newTemp();
+        instr.a = a;
+        instr.b = b;
+        return instr.dst;
+    }
+
+    int addImmediate(int a, int value) {
+        IRInstr &instr = emit(IROp::ADDI);
+        instr.dst = newTemp();
+        instr.a = a;
+        instr.imm = value;
+        return instr.dst;
+    }
+
+    void copy(int dst, int a) {
+        IRInstr &instr = emit(IROp::COPY);
+        instr.dst = dst;
+        instr.a = a;
+    }
+
+    int load(IRSlot slot, const char *name) {
+        IRInstr &instr = emit(IROp::LOAD);
+        instr.dst = newTemp();
+        instr.slot = slot;
+        instr.name = name;
+        return instr.dst;
+    }
+
+    void store(IRSlot slot, int value, const char *name) {
+        IRInstr &instr = emit(IROp::STORE);
+        instr.a = value;
+        instr.slot = slot;
+        instr.name = name;
+    }
+
+    int address(IRSlot slot, const char *name) {
+        IRInstr &instr = emit(IROp::ADDR);
+        instr.dst = newTemp();
+        instr.slot = slot;
+        instr.name = name;
+        return instr.dst;
+    }
+
+    void copyArray(int source, int dest, const char *name) {
+        IRInstr &instr = emit(IROp::COPYARRAY);
+        instr.a = source;
+        instr.b = dest;
+        instr.name = name;
+    }
+
+    void queue(TokenTree *decl) {
+        if (queued.insert(decl).second) worklist.push_back(decl);
+    }
+
+    // Array parameters hold the address of the array, everything else
+    // is at an offset
+    int arrayAddress(TokenTree *arr) {
+        if (arr->getExprKind() == ExprKind::CONSTANT) {
+            IRInstr &instr = emit(IROp::LIT);
+            instr.dst = newTemp();
+            instr.text = std::string(arr->getStringValue(), arr->getNumValue());
+            return instr.dst;
+        }
+        if (!arr->isInGlobalMemory() && arr->getMemoryType() == MemoryType::PARAM) {
+            return load(slotOf(arr), arr->getStringValue());
+        }
+        return address(slotOf(arr), arr->getStringValue());
+    }
+
+    // Elements go down from the base address, so a constant index is
+    // just an offset from it
+    IRSlot elementSlot(TokenTree *index) {
+        TokenTree *arr = index->children[0];
+        TokenTree *offset = index->children[1];
+        if (isScalarConstant(offset)) {
+            if (arr->isInGlobalMemory() || arr->getMemoryType() != MemoryType::PARAM) {
+                IRSlot slot = slotOf(arr);
+                slot.offset -= constantValue(offset);
+                slot.inArray = true;
+                return slot;
+            }
+            return element(arrayAddress(arr), -constantValue(offset));
+        }
+        int i = value(offset);
+        return element(binary(IROp::SUB, arrayAddress(arr), i), 0);
+    }
+
+    int value(TokenTree *tree) {
+        switch (tree->getExprKind()) {
+            case ExprKind::CONSTANT:
+                if (tree->isArray()) return arrayAddress(tree);
+                return constant(constantValue(tree));
+            case ExprKind::ID:
+                if (tree->isArray()) return arrayAddress(tree);
+                return load(slotOf(tree), tree->getStringValue());
+            case ExprKind::OP:
+                return operation(tree);
+            case ExprKind::ASSIGN:
+                return assignment(tree);
+            case ExprKind::CALL:
+                return call(tree);
+        }
+        throw std::runtime_error("ERROR: Unknown expression kind.");
+    }
+
+    int operation(TokenTree *tree) {
+        TokenTree *lhs = tree->children[0];
+        TokenTree *rhs = tree->children[1];
+        OpKind op = tree->getOpKind();
+        if (op == OpKind::INDEX) {
+            return load(elementSlot(tree), lhs->getStringValue());
+        }
+        if (rhs == NULL) {
+            switch (op) {
+                case OpKind::MINUS: return unary(IROp::NEG, value(lhs));
+                case OpKind::NOT: return unary(IROp::NOT, value(lhs));
+                case OpKind::RANDOM: return unary(IROp::RAND, value(lhs));
+                case OpKind::TIMES: return load(element(arrayAddress(lhs), 1), "size");
+            }
+            throw std::runtime_error(std::string("Operation ") + tree->getStringValue() + " not implemented!");
+        }
+        if (isShortCircuit(tree)) return shortCircuitValue(tree);
+        // Adding a constant needs no register for it
+        if ((op == OpKind::PLUS || op == OpKind::MINUS) && isScalarConstant(rhs) && constantValue(rhs) != INT_MIN) {
+            int a = value(lhs);
+            return addImmediate(a, op == OpKind::PLUS ? constantValue(rhs) : -constantValue(rhs));
+        }
+        int a = value(lhs);
+        int b = value(rhs);
+        return binary(binaryOp(op), a, b);
+    }
+
+    // When the left operand decides the result it is also the value
+    int shortCircuitValue(TokenTree *tree) {
+        int result = newTemp();
+        copy(result, value(tree->children[0]));
+        int right = newBlock();
+        int join = newBlock();
+        if (tree->getOpKind() == OpKind::AND) {
+            branch(result, right, join);
+        } else {
+            branch(result, join, right);
+        }
+        start(right);
+        copy(result, value(tree->children[1]));
+        start(join);
+        return result;
+    }
+
+    // The new value of the target of op=, ++ or --
+    int update(TokenTree *tree, int old, int operand) {
+        switch (tree->getOpKind()) {
+            case OpKind::INC: return addImmediate(old, 1);
+            case OpKind::DEC: return addImmediate(old, -1);
+        }
+        return binary(binaryOp(tree->getOpKind()), old, operand);
+    }
+
+    int assignment(TokenTree *tree) {
+        TokenTree *lhs = tree->children[0];
+        TokenTree *rhs = tree->children[1];
+        bool mathAndAssign = tree->getOpKind() != OpKind::ASSIGN;
+        if (lhs->getExprKind() == ExprKind::OP) { // An array element
+            TokenTree *arr = lhs->children[0];
+            IRSlot slot = elementSlot(lhs);
+            int operand = rhs == NULL ? NO_TEMP : value(rhs);
+            int result = mathAndAssign ? update(tree, load(slot, arr->getStringValue()), operand) : operand;
+            store(slot, result, arr->getStringValue());
+            return result;
+        }
+        if (lhs->isArray()) {
+            int source = value(rhs);
+            copyArray(source, arrayAddress(lhs), lhs->getStringValue());
+            return source;
+        }
+        IRSlot slot = slotOf(lhs);
+        int result;
+        if ((tree->getOpKind() == OpKind::ADDASS || tree->getOpKind() == OpKind::SUBASS)
+                && isScalarConstant(rhs) && constantValue(rhs) != INT_MIN) {
+            int step = tree->getOpKind() == OpKind::ADDASS ? constantValue(rhs) : -constantValue(rhs);
+            result = addImmediate(load(slot, lhs->getStringValue()), step);
+        } else {
+            int operand = rhs == NULL ? NO_TEMP : value(rhs);
+            result = mathAndAssign ? update(tree, load(slot, lhs->getStringValue()), operand) : operand;
+        }
+        store(slot, result, lhs->getStringValue());
+        return result;
+    }
+
+    void arguments(TokenTree *call, std::vector<int> &args) {
+        for (TokenTree *arg = call->children[0]; arg != NULL; arg = arg->sibling) {
+            args.push_back(value(arg));
+        }
+    }
+
+    // A call to the IO library is the instruction the routine is made of
+    int call(TokenTree *tree) {
+        TokenTree *func = (TokenTree *) symbolTable->lookupGlobal(tree->getStringValue());
+        std::vector<int> args;
+        arguments(tree, args);
+        if (func->getLineNum() == -1) {
+            IROp op = ioOp(tree->getStringValue());
+            IRInstr &instr = emit(op);
+            if (op == IROp::IN || op == IROp::INB || op == IROp::INC) instr.dst = newTemp();
+            if (!args.empty()) instr.a = args[0];
+            return instr.dst;
+        }
+        IRInstr &instr = emit(IROp::CALL);
+        if (func->getExprType() != ExprType::VOID) instr.dst = newTemp();
+        instr.func = func;
+        instr.args = args;
+        instr.name = tree->getStringValue();
+        return instr.dst;
+    }
+
+    // The callee's frame would overwrite an array in this one
+    bool isTailCall(TokenTree *call) {
+        TokenTree *func = (TokenTree *) symbolTable->lookupGlobal(call->getStringValue());
+        if (func->getLineNum() == -1) return false;
+        for (TokenTree *arg = call->children[0]; arg != NULL; arg = arg->sibling) {
+            if (arg->isArray() && arg->getExprKind() == ExprKind::ID && !arg->isInGlobalMemory()
+                    && arg->getMemoryType() != MemoryType::PARAM) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void tailCall(TokenTree *tree) {
+        TokenTree *func = (TokenTree *) symbolTable->lookupGlobal(tree->getStringValue());
+        std::vector<int> args;
+        arguments(tree, args);
+        IRInstr &instr = emit(IROp::TAILCALL);
+        instr.func = func;
+        instr.args = args;
+        instr.name = tree->getStringValue();
+    }
+
+    // Jumps to whenTrue or whenFalse on the value of cond.  Short
+    // circuit operators branch on each operand in turn, ! swaps the
+    // targets and a comparison with 0 tests the other operand.
+    void condition(TokenTree *cond, int whenTrue, int whenFalse) {
+        if (cond->getExprKind() == ExprKind::CONSTANT) {
+            jump(cond->getNumValue() != 0 ? whenTrue : whenFalse);
+            return;
+        }
+        if (cond->getExprKind() == ExprKind::OP) {
+            OpKind op = cond->getOpKind();
+            if (op == OpKind::NOT) {
+                condition(cond->children[0], whenFalse, whenTrue);
+                return;
+            }
+            if (op == OpKind::EQ || op == OpKind::NEQ) {
+                TokenTree *other = NULL;
+                if (isZero(cond->children[1])) other = cond->children[0];
+                if (isZero(cond->children[0])) other = cond->children[1];
+                if (other != NULL) {
+                    int a = value(other);
+                    if (op == OpKind::EQ) {
+                        branch(a, whenFalse, whenTrue);
+                    } else {
+                        branch(a, whenTrue, whenFalse);
+                    }
+                    return;
+                }
+            }
+            if (isShortCircuit(cond)) {
+                int right = newBlock();
+                if (op == OpKind::AND) {
+                    condition(cond->children[0], right, whenFalse);
+                } else {
+                    condition(cond->children[0], whenTrue, right);
+                }
+                start(right);
+                condition(cond->children[1], whenTrue, whenFalse);
+                return;
+            }
+        }
+        branch(value(cond), whenTrue, whenFalse);
+    }
+
+    // Sets up a variable when its declaration is reached: the size of
+    // an array and the initial value
+    void initialize(TokenTree *decl) {
+        if (isUnused(decl)) return;
+        IRSlot slot = slotOf(decl);
+        if (decl->isArray()) { // Size goes in before any initializer is copied
+            IRSlot size = slot;
+            size.offset++;
+            size.inArray = true;
+            store(size, constant(decl->getMemorySize() - 1), decl->getStringValue());
+            if (decl->children[0] != NULL) {
+                int source = value(decl->children[0]);
+                copyArray(source, address(slot, decl->getStringValue()), decl->getStringValue());
+            }
+        } else if (decl->children[0] != NULL) {
+            store(slot, value(decl->children[0]), decl->getStringValue());
+        }
+    }
+
+    void statements(TokenTree *tree) {
+        for (; tree != NULL; tree = tree->sibling) {
+            statement(tree);
+        }
+    }
+
+    void statement(TokenTree *tree) {
+        if (tree == NULL) return;
+        if (tree->getNodeKind() == NodeKind::DECLARATION) {
+            // Globals and statics are set up by init
+            if (tree->getDeclKind() == DeclKind::VARIABLE && !tree->isInGlobalMemory()) initialize(tree);
+            return;
+        }
+        if (tree->getNodeKind() == NodeKind::EXPRESSION) {
+            value(tree);
+            return;
+        }
+        switch (tree->getStmtKind()) {
+            case StmtKind::COMPOUND:
+                statements(tree->children[0]);
+                statements(tree->children[1]);
+                break;
+            case StmtKind::SELECTION: {
+                int thenBlock = newBlock();
+                int elseBlock = tree->children[2] != NULL ? newBlock() : -1;
+                int endBlock = newBlock();
+                condition(tree->children[0], thenBlock, elseBlock >= 0 ? elseBlock : endBlock);
+                start(thenBlock);
+                statement(tree->children[1]);
+                if (elseBlock >= 0) {
+                    jump(endBlock);
+                    start(elseBlock);
+                    statement(tree->children[2]);
+                }
+                start(endBlock);
+                break;
+            }
+            case StmtKind::WHILE: { // The test is at the bottom
+                int body = newBlock();
+                int test = newBlock();
+                int end = newBlock();
+                jump(test);
+                start(body);
+                breakTargets.push(end);
+                statement(tree->children[1]);
+                breakTargets.pop();
+                start(test);
+                condition(tree->children[0], body, end);
+                start(end);
+                break;
+            }
+            case StmtKind::FOR: { // A cursor walks down to the address just past the last element
+                TokenTree *var = tree->children[0];
+                int body = newBlock();
+                int test = newBlock();
+                int end = newBlock();
+                int cursor = arrayAddress(tree->children[1]);
+                int bound = binary(IROp::SUB, cursor, load(element(cursor, 1), "size"));
+                jump(test);
+                start(body);
+                store(slotOf(var), load(element(cursor, 0), tree->children[1]->getStringValue()), var->getStringValue());
+                breakTargets.push(end);
+                statement(tree->children[2]);
+                breakTargets.pop();
+                IRInstr &advance = emit(IROp::ADDI);
+                advance.dst = cursor;
+                advance.a = cursor;
+                advance.imm = -1;
+                start(test);
+                branch(binary(IROp::SUB, cursor, bound), body, end);
+                start(end);
+                break;
+            }
+            case StmtKind::RETURN: {
+                TokenTree *result = tree->children[0];
+                if (result != NULL && result->getExprKind() == ExprKind::CALL && isTailCall(result)) {
+                    tailCall(result);
+                } else {
+                    int a = result == NULL ? NO_TEMP : value(result);
+                    emit(IROp::RETURN).a = a;
+                }
+                break;
+            }
+            case StmtKind::BREAK:
+                jump(breakTargets.top());
+                break;
+        }
+    }
+
+    void globals(TokenTree *tree) {
+        for (; tree != NULL; tree = tree->sibling) {
+            for (int i = 0; i < MAX_CHILDREN; i++) {
+                globals(tree->children[i]);
+            }
+            if (tree->getNodeKind() == NodeKind::DECLARATION && tree->getDeclKind() == DeclKind::VARIABLE
+                    && tree->isInGlobalMemory()) {
+                initialize(tree);
+            }
+        }
+    }
+
+    void begin(TokenTree *decl) {
+        func = new IRFunction();
+        func->decl = decl;
+        current = -1;
+        layout.clear();
+        start(newBlock());
+    }
+
+    IRFunction *function(TokenTree *decl) {
+        begin(decl);
+        statement(decl->children[1]);
+        int zero = constant(0); // Falling off the end returns 0
+        emit(IROp::RETURN).a = zero;
+        return finish();
+    }
+
+    IRFunction *init() {
+        begin(NULL);
+        globals(syntaxTree);
+        emit(IROp::RUN);
+        return finish();
+    }
+
+    IRFunction *finish();
+};
+
+// Passes over a finished function
+
+static void renumberBlocks(IRFunction *func, const std::vector<int> &order) {
+    std::vector<int> newIndex(func->blocks.size(), -1);
+    std::vector<IRBlock> blocks;
+    for (int block : order) {
+        newIndex[block] = blocks.size();
+        blocks.push_back(func->blocks[block]);
+    }
+    for (IRBlock &block : blocks) {
+        IRInstr &last = block.instrs.back();
+        if (last.target >= 0) last.target = newIndex[last.target];
+        if (last.other >= 0) last.other = newIndex[last.other];
+    }
+    func->blocks = blocks;
+}
+
+// Where a jump to block ends up when it goes through blocks that
+// only jump on
+static int finalTarget(IRFunction *func, int block) {
+    for (size_t hops = 0; hops < func->blocks.size(); hops++) {
+        IRBlock &next = func->blocks[block];
+        if (next.instrs.size() != 1 || next.instrs[0].op != IROp::JUMP) break;
+        block = next.instrs[0].target;
+    }
+    return block;
+}
+
+static void threadJumps(IRFunction *func) {
+    for (IRBlock &block : func->blocks) {
+        IRInstr &last = block.instrs.back();
+        if (last.op != IROp::JUMP && last.op != IROp::BRANCH) continue;
+        last.target = finalTarget(func, last.target);
+        if (last.op == IROp::BRANCH) {
+            last.other = finalTarget(func, last.other);
+            if (last.target == last.other) { // Both ways lead to the same place
+                last.op = IROp::JUMP;
+                last.a = NO_TEMP;
+                last.other = -1;
+            }
+        }
+    }
+}
+
+static void removeUnreachableBlocks(IRFunction *func) {
+    std::vector<bool> reached(func->blocks.size(), false);
+    std::vector<int> pending(1, 0);
+    std::vector<int> successors;
+    reached[0] = true;
+    while (!pending.empty()) {
+        int block = pending.back();
+        pending.pop_back();
+        getSuccessors(func->blocks[block], successors);
+        for (int next : successors) {
+            if (!reached[next]) {
+                reached[next] = true;
+                pending.push_back(next);
+            }
+        }
+    }
+    std::vector<int> order;
+    for (size_t block = 0; block < func->blocks.size(); block++) {
+        if (reached[block]) order.push_back(block);
+    }
+    renumberBlocks(func, order);
+}
+
+static bool sameSlot(const IRSlot &x, const IRSlot &y) {
+    return x.base == y.base && x.offset == y.offset && x.temp == y.temp;
+}
+
+struct KnownSlot {
+    IRSlot slot;
+    int temp;       // holds what is in the slot
+};
+
+// Array memory can also be reached through any address
+static bool isArrayMemory(const IRSlot &slot) {
+    return slot.base == IRBase::TEMP || slot.inArray;
+}
+
+template <typename Matches>
+static void forget(std::vector<KnownSlot> &known, Matches matches) {
+    known.erase(std::remove_if(known.begin(), known.end(), matches), known.end());
+}
+
+// Within a block a value that was just stored or loaded is still in
+// a temporary, so loading it again becomes a copy.  A call can change
+// globals and arrays but never the scalars in this frame.
+static void forwardLoads(IRFunction *func) {
+    for (IRBlock &block : func->blocks) {
+        std::vector<KnownSlot> known;
+        for (IRInstr &instr : block.instrs) {
+            IRSlot slot = instr.slot;
+            switch (instr.op) {
+                case IROp::LOAD: {
+                    auto found = std::find_if(known.begin(), known.end(),
+                        [&slot](const KnownSlot &k) { return sameSlot(k.slot, slot); });
+                    if (found != known.end()) {
+                        instr.op = IROp::COPY;
+                        instr.a = found->temp;
+                        instr.slot = IRSlot();
+                    }
+                    break;
+                }
+                case IROp::STORE:
+                    forget(known, [&slot](const KnownSlot &k) {
+                        return sameSlot(k.slot, slot) || (isArrayMemory(slot) && isArrayMemory(k.slot));
+                    });
+                    break;
+                case IROp::CALL:
+                    forget(known, [](const KnownSlot &k) { return k.slot.base == IRBase::GLOBAL || isArrayMemory(k.slot); });
+                    break;
+                case IROp::COPYARRAY:
+                    forget(known, [](const KnownSlot &k) { return isArrayMemory(k.slot); });
+                    break;
+            }
+            if (instr.dst != NO_TEMP) { // Whatever was known through the old value is gone
+                int dst = instr.dst;
+                forget(known, [dst](const KnownSlot &k) { return k.temp == dst || k.slot.temp == dst; });
+            }
+            if (instr.op == IROp::LOAD) known.push_back({ instr.slot, instr.dst });
+            if (instr.op == IROp::STORE) known.push_back({ instr.slot, instr.a });
+        }
+    }
+}
+
+static void countDefinitions(IRFunction *func, std::vector<int> &definitions) {
+    definitions.assign(func->numTemps, 0);
+    for (IRBlock &block : func->blocks) {
+        for (IRInstr &instr : block.instrs) {
+            if (instr.dst != NO_TEMP) definitions[instr.dst]++;
+        }
+    }
+}
+
+static int renamed(const std::vector<int> &rename, int temp) {
+    while (rename[temp] != temp) temp = rename[temp];
+    return temp;
+}
+
+static void renameUses(IRInstr &instr, const std::vector<int> &rename) {
+    if (instr.a != NO_TEMP) instr.a = renamed(rename, instr.a);
+    if (instr.b != NO_TEMP) instr.b = renamed(rename, instr.b);
+    if (instr.slot.base == IRBase::TEMP) instr.slot.temp = renamed(rename, instr.slot.temp);
+    for (int &arg : instr.args) {
+        arg = renamed(rename, arg);
+    }
+}
+
+// A temporary that is only ever a copy of another one that is set
+// once can be replaced by it.  Every temporary set once is set
+// before any use of it, so the original is still the same there.
+static void propagateCopies(IRFunction *func) {
+    std::vector<int> definitions;
+    countDefinitions(func, definitions);
+    std::vector<int> rename(func->numTemps);
+    for (int temp = 0; temp < func->numTemps; temp++) {
+        rename[temp] = temp;
+    }
+    for (IRBlock &block : func->blocks) {
+        for (IRInstr &instr : block.instrs) {
+            renameUses(instr, rename);
+            if (instr.op == IROp::COPY && definitions[instr.dst] == 1 && definitions[instr.a] == 1) {
+                rename[instr.dst] = instr.a;
+            }
+        }
+    }
+    for (IRBlock &block : func->blocks) { // Uses laid out before the copy, in loops
+        for (IRInstr &instr : block.instrs) {
+            renameUses(instr, rename);
+        }
+    }
+}
+
+// True if nothing but the value would be lost by leaving it out.
+// Division and array loads with a bad index can stop the machine and
+// ? moves the random sequence along.
+static bool isRemovable(const IRInstr &instr) {
+    switch (instr.op) {
+        case IROp::CONST: case IROp::LIT: case IROp::COPY: case IROp::ADDR:
+        case IROp::ADD: case IROp::SUB: case IROp::MUL: case IROp::AND: case IROp::OR:
+        case IROp::LT: case IROp::LE: case IROp::GT: case IROp::GE: case IROp::EQ: case IROp::NE:
+        case IROp::ADDI: case IROp::NEG: case IROp::NOT:
+            return true;
+        case IROp::LOAD:
+            return !isArrayMemory(instr.slot);
+    }
+    return false;
+}
+
+static void removeUnusedResults(IRFunction *func) {
+    std::vector<int> uses;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        std::vector<int> useCount(func->numTemps, 0);
+        for (IRBlock &block : func->blocks) {
+            for (IRInstr &instr : block.instrs) {
+                getUses(instr, uses);
+                for (int temp : uses) {
+                    useCount[temp]++;
+                }
+            }
+        }
+        for (IRBlock &block : func->blocks) {
+            size_t kept = 0;
+            for (size_t i = 0; i < block.instrs.size(); i++) {
+                IRInstr &instr = block.instrs[i];
+                bool unused = instr.dst != NO_TEMP && useCount[instr.dst] == 0;
+                bool selfCopy = instr.op == IROp::COPY && instr.a == instr.dst;
+                if (selfCopy || (unused && isRemovable(instr))) {
+                    changed = true;
+                    continue;
+                }
+                if (kept != i) block.instrs[kept] = block.instrs[i];
+                kept++;
+            }
+            block.instrs.resize(kept);
+        }
+    }
+}
+
+IRFunction *IRBuilder::finish() {
+    renumberBlocks(func, layout);
+    threadJumps(func);
+    removeUnreachableBlocks(func);
+    forwardLoads(func);
+    propagateCopies(func);
+    removeUnusedResults(func);
+    for (IRBlock &block : func->blocks) { // Calls that were left out do not need the callee
+        for (IRInstr &instr : block.instrs) {
+            if (instr.func != NULL) queue(instr.func);
+        }
+    }
+    return func;
+}
+
+IRProgram *buildIR() {
+    analyzeTree(syntaxTree);
+    IRBuilder builder;
+    IRProgram *program = new IRProgram();
+    program->init = builder.init();
+    builder.queue((TokenTree *) symbolTable->lookupGlobal("main"));
+    for (size_t i = 0; i < builder.worklist.size(); i++) {
+        program->functions.push_back(builder.function(builder.worklist[i]));
+    }
+    return program;
+}
+
+// Printing
+
+static std::string temp(int t) {
+    return "t" + std::to_string(t);
+}
+
+static std::string slotText(const IRSlot &slot) {
+    std::string base = slot.base == IRBase::FRAME ? "FP" : slot.base == IRBase::GLOBAL ? "GP" : temp(slot.temp);
+    return std::to_string(slot.offset) + "(" + base + ")";
+}
+
+static const char *opSymbol(IROp op) {
+    switch (op) {
+        case IROp::ADD: return "+";
+        case IROp::SUB: return "-";
+        case IROp::MUL: return "*";
+        case IROp::DIV: return "/";
+        case IROp::MOD: return "%";
+        case IROp::AND: return "&";
+        case IROp::OR: return "|";
+        case IROp::LT: return "<";
+        case IROp::LE: return "<=";
+        case IROp::GT: return ">";
+        case IROp::GE: return ">=";
+        case IROp::EQ: return "==";
+        case IROp::NE: return "!=";
+        case IROp::NEG: return "-";
+        case IROp::NOT: return "!";
+        case IROp::RAND: return "?";
+        case IROp::IN: return "input";
+        case IROp::INB: return "inputb";
+        case IROp::INC: return "inputc";
+        case IROp::OUT: return "output";
+        case IROp::OUTB: return "outputb";
+        case IROp::OUTC: return "outputc";
+        case IROp::OUTNL: return "outnl";
+    }
+    return "?";
+}
+
+static std::string callText(const IRInstr &instr) {
+    std::string text = std::string(instr.name) + "(";
+    for (size_t i = 0; i < instr.args.size(); i++) {
+        if (i > 0) text += ", ";
+        text += temp(instr.args[i]);
+    }
+    return text + ")";
+}
+
+std::string describe(const IRInstr &instr) {
+    std::string dst = instr.dst == NO_TEMP ? "" : temp(instr.dst) + " = ";
+    std::string name = instr.name == NULL ? "" : std::string(" ") + instr.name;
+    switch (instr.op) {
+        case IROp::CONST: return dst + std::to_string(instr.imm);
+        case IROp::LIT: return dst + "&\"" + instr.text + "\"";
+        case IROp::COPY: return dst + temp(instr.a);
+        case IROp::ADDR: return dst + "&" + slotText(instr.slot) + name;
+        case IROp::LOAD: return dst + slotText(instr.slot) + name;
+        case IROp::STORE: return slotText(instr.slot) + " = " + temp(instr.a) + name;
+        case IROp::ADDI: return dst + temp(instr.a) + " + " + std::to_string(instr.imm);
+        case IROp::NEG: case IROp::NOT: case IROp::RAND: return dst + opSymbol(instr.op) + temp(instr.a);
+        case IROp::COPYARRAY: return "copy array " + temp(instr.a) + " to " + temp(instr.b) + name;
+        case IROp::IN: case IROp::INB: case IROp::INC: case IROp::OUTNL: return dst + opSymbol(instr.op) + "()";
+        case IROp::OUT: case IROp::OUTB: case IROp::OUTC: return std::string(opSymbol(instr.op)) + "(" + temp(instr.a) + ")";
+        case IROp::CALL: return dst + callText(instr);
+        case IROp::JUMP: return "goto B" + std::to_string(instr.target);
+        case IROp::BRANCH:
+            return "if " + temp(instr.a) + " goto B" + std::to_string(instr.target) + " else B" + std::to_string(instr.other);
+        case IROp::RETURN: return instr.a == NO_TEMP ? "return" : "return " + temp(instr.a);
+        case IROp::TAILCALL: return "return " + callText(instr) + " in place";
+        case IROp::RUN: return "run main";
+    }
+    return dst + temp(instr.a) + " " + opSymbol(instr.op) + " " + temp(instr.b);
+}
+
+static void printFunction(IRFunction *func, FILE *out) {
+    fprintf(out, "FUNCTION %s\n", func->decl == NULL ? "init" : func->decl->getStringValue());
+    for (size_t i = 0; i < func->blocks.size(); i++) {
+        fprintf(out, "B%d:\n", (int) i);
+        for (IRInstr &instr : func->blocks[i].instrs) {
+            fprintf(out, "    %s\n", describe(instr).c_str());
+        }
+    }
+    fprintf(out, "\n");
+}
+
+void printIR(IRProgram *program, FILE *out) {
+    printFunction(program->init, out);
+    for (IRFunction *func : program->functions) {
+        printFunction(func, out);
+    }
+}
@@ -0,0 +1,97 @@
+#ifndef IR_H
+#define IR_H
+#include "TokenTree.h"
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+/**
+ * Three-address intermediate representation.  A function is a list of
+ * basic blocks of instructions on numbered temporaries and only the
+ * last instruction of a block jumps.  Variables stay in memory and are
+ * reached through LOAD and STORE, temporaries hold the values of
+ * expressions.  Blocks are kept in the order the code is laid out so
+ * a jump to the next block costs nothing.
+ */
+
+#define NO_TEMP -1
+
+enum class IROp {
+    CONST,      // dst = imm
+    LIT,        // dst = address of the string literal text
+    COPY,       // dst = a
+    ADDR,       // dst = address of slot
+    LOAD,       // dst = slot
+    STORE,      // slot = a
+    ADD, SUB, MUL, DIV, MOD, AND, OR,   // dst = a op b
+    LT, LE, GT, GE, EQ, NE,             // dst = 1 if a op b else 0
+    ADDI,       // dst = a + imm
+    NEG, NOT, RAND,                     // dst = op a
+    COPYARRAY,  // copy the array at a into the array at b, as much as both hold
+    IN, INB, INC,                       // dst = value read
+    OUT, OUTB, OUTC, OUTNL,             // write a
+    CALL,       // dst = func(args), no dst for a void function
+    // Terminators
+    JUMP,       // goto target
+    BRANCH,     // goto target if a is not 0, else goto other
+    RETURN,     // return a, or nothing without a
+    TAILCALL,   // return func(args), reusing the frame
+    RUN         // end of init: run main in the first frame and halt
+};
+
+enum class IRBase { FRAME, GLOBAL, TEMP };
+
+// A word of memory: offset from FP, from GP or from the address in temp
+struct IRSlot {
+    IRBase base = IRBase::FRAME;
+    int offset = 0;
+    int temp = NO_TEMP;
+    bool inArray = false;       // an element or size at a fixed offset
+};
+
+struct IRInstr {
+    IROp op;
+    int dst = NO_TEMP;
+    int a = NO_TEMP;
+    int b = NO_TEMP;
+    int imm = 0;
+    IRSlot slot;
+    std::string text;           // LIT
+    TokenTree *func = NULL;     // CALL and TAILCALL
+    std::vector<int> args;      // CALL and TAILCALL
+    int target = -1;            // JUMP and BRANCH
+    int other = -1;             // BRANCH
+    const char *name = NULL;    // what a slot or call is, for comments
+};
+
+struct IRBlock {
+    std::vector<IRInstr> instrs;
+};
+
+struct IRFunction {
+    TokenTree *decl;            // NULL for init
+    std::vector<IRBlock> blocks;
+    int numTemps = 0;
+};
+
+struct IRProgram {
+    IRFunction *init;           // initializes globals and statics, then runs main
+    std::vector<IRFunction *> functions;    // main and everything it can call
+};
+
+bool isTerminator(IROp op);
+void getUses(const IRInstr &instr, std::vector<int> &uses);
+void getSuccessors(const IRBlock &block, std::vector<int> &successors);
+std::string describe(const IRInstr &instr);     // one line of text, as printed
+
+/**
+ * Builds the IR for the checked and folded syntax tree.  Only
+ * functions that can be called from main are built.  Unreachable
+ * blocks, jumps to jumps, reloads of values still in a temporary and
+ * unused results are cleaned up before it is returned.
+ */
+IRProgram *buildIR();
+
+void printIR(IRProgram *program, FILE *out);
+
+#endif
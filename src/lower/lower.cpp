@@ -0,0 +1,492 @@
+#include "lower.h"
+#include "codegen.h"
+#include "emitcode.h"
+#include "symbolTable.h"
+#include <limits.h>
+#include <math.h>
+#include <algorithm>
+#include <map>
+#include <stdexcept>
+
+extern SymbolTable *symbolTable;
+extern int globalOffset;
+extern bool leanCode;
+
+// Registers temporaries can be given.  AC1 and RT are left for
+// loading temporaries that are in the frame.
+#define NUM_TEMP_REGS 3
+static const int tempRegs[NUM_TEMP_REGS] = { AC, AC2, AC3 };
+
+static OpCode tmOp(IROp op) {
+    switch (op) {
+        case IROp::ADD: return OpCode::ADD;
+        case IROp::SUB: return OpCode::SUB;
+        case IROp::MUL: return OpCode::MUL;
+        case IROp::DIV: return OpCode::DIV;
+        case IROp::MOD: return OpCode::MOD;
+        case IROp::AND: return OpCode::AND;
+        case IROp::OR: return OpCode::OR;
+        case IROp::LT: return OpCode::TLT;
+        case IROp::LE: return OpCode::TLE;
+        case IROp::GT: return OpCode::TGT;
+        case IROp::GE: return OpCode::TGE;
+        case IROp::EQ: return OpCode::TEQ;
+        case IROp::NE: return OpCode::TNE;
+        case IROp::IN: return OpCode::IN;
+        case IROp::INB: return OpCode::INB;
+        case IROp::INC: return OpCode::INC;
+        case IROp::OUT: return OpCode::OUT;
+        case IROp::OUTB: return OpCode::OUTB;
+        case IROp::OUTC: return OpCode::OUTC;
+        case IROp::OUTNL: return OpCode::OUTNL;
+    }
+    throw std::runtime_error("ERROR: IR operation has no TM instruction.");
+}
+
+struct FunctionLabels {
+    int entry;
+    int tail;   // past the store of the return address
+};
+
+struct Lowering {
+    std::map<TokenTree *, FunctionLabels> functionLabels;
+    IRFunction *func;
+    std::vector<int> blockLabels;
+    std::vector<int> regs;      // register of each temporary, -1 if it is in the frame
+    std::vector<int> spills;    // offset from FP of each temporary in the frame
+    int frameBase;              // where the words for temporaries start
+    int ghostFrame;             // where the frame of a call goes
+    std::string text;           // comment for the instruction being lowered
+
+    FunctionLabels &labels(TokenTree *decl) {
+        auto found = functionLabels.find(decl);
+        if (found == functionLabels.end()) {
+            found = functionLabels.insert({ decl, { newLabel(), newLabel() } }).first;
+        }
+        return found->second;
+    }
+
+    char *note(const IRInstr &instr) {
+        if (leanCode) return NO_COMMENT;
+        text = describe(instr);
+        return (char *) text.c_str();
+    }
+
+    // Live ranges.  Instruction i reads its operands at 2i and sets its
+    // result at 2i+1, so a result can take the register of an operand
+    // that dies there.  A temporary live into or out of a block covers
+    // the whole block, so its range is one interval over the layout.
+    // The weight of a temporary counts its uses and definitions, ten
+    // times over for each loop they are in.
+    void liveRanges(std::vector<int> &start, std::vector<int> &end, std::vector<double> &weight,
+            std::vector<int> &hint, std::vector<int> &clobbers) {
+        int numTemps = func->numTemps;
+        int numBlocks = func->blocks.size();
+        std::vector<int> first(numBlocks);
+        std::vector<int> uses;
+        std::vector<int> successors;
+        std::vector<std::vector<bool>> used(numBlocks, std::vector<bool>(numTemps, false));
+        std::vector<std::vector<bool>> defined(numBlocks, std::vector<bool>(numTemps, false));
+        std::vector<std::vector<bool>> liveIn(numBlocks, std::vector<bool>(numTemps, false));
+        std::vector<std::vector<bool>> liveOut(numBlocks, std::vector<bool>(numTemps, false));
+
+        int position = 0;
+        for (int b = 0; b < numBlocks; b++) {
+            first[b] = position;
+            position += func->blocks[b].instrs.size();
+            for (IRInstr &instr : func->blocks[b].instrs) {
+                getUses(instr, uses);
+                for (int temp : uses) {
+                    if (!defined[b][temp]) used[b][temp] = true;
+                }
+                if (instr.dst != NO_TEMP) defined[b][instr.dst] = true;
+            }
+        }
+
+        // A jump back in the layout closes a loop over the blocks between
+        std::vector<int> depth(numBlocks, 0);
+        for (int b = 0; b < numBlocks; b++) {
+            getSuccessors(func->blocks[b], successors);
+            for (int next : successors) {
+                for (int inside = next; inside <= b; inside++) {
+                    depth[inside]++;
+                }
+            }
+        }
+
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (int b = numBlocks - 1; b >= 0; b--) {
+                std::vector<bool> out(numTemps, false);
+                getSuccessors(func->blocks[b], successors);
+                for (int next : successors) {
+                    for (int temp = 0; temp < numTemps; temp++) {
+                        if (liveIn[next][temp]) out[temp] = true;
+                    }
+                }
+                std::vector<bool> in(numTemps);
+                for (int temp = 0; temp < numTemps; temp++) {
+                    in[temp] = used[b][temp] || (out[temp] && !defined[b][temp]);
+                }
+                if (in != liveIn[b] || out != liveOut[b]) {
+                    liveIn[b] = in;
+                    liveOut[b] = out;
+                    changed = true;
+                }
+            }
+        }
+
+        start.assign(numTemps, INT_MAX);
+        end.assign(numTemps, -1);
+        weight.assign(numTemps, 0);
+        hint.assign(numTemps, NO_TEMP);
+        clobbers.clear();
+        auto extend = [&start, &end](int temp, int point) {
+            start[temp] = std::min(start[temp], point);
+            end[temp] = std::max(end[temp], point);
+        };
+        for (int b = 0; b < numBlocks; b++) {
+            int last = first[b] + func->blocks[b].instrs.size() - 1;
+            for (int temp = 0; temp < numTemps; temp++) {
+                if (liveIn[b][temp]) extend(temp, 2 * first[b]);
+                if (liveOut[b][temp]) extend(temp, 2 * last + 1);
+            }
+            int i = first[b];
+            double frequency = pow(10, std::min(depth[b], 6));
+            for (IRInstr &instr : func->blocks[b].instrs) {
+                getUses(instr, uses);
+                for (int temp : uses) {
+                    extend(temp, 2 * i);
+                    weight[temp] += frequency;
+                }
+                if (instr.dst != NO_TEMP) {
+                    extend(instr.dst, 2 * i + 1);
+                    weight[instr.dst] += frequency;
+                }
+                if (instr.op == IROp::COPY) hint[instr.dst] = instr.a;
+                if (instr.op == IROp::CALL || instr.op == IROp::COPYARRAY) clobbers.push_back(i);
+                i++;
+            }
+        }
+    }
+
+    // Linear scan.  When the registers run out the temporary with the
+    // least weight goes in the frame, and so does everything live
+    // across a call or an array copy, which use every register.
+    void allocate() {
+        std::vector<int> start, end, hint, clobbers;
+        std::vector<double> weight;
+        liveRanges(start, end, weight, hint, clobbers);
+
+        std::vector<int> order;
+        for (int temp = 0; temp < func->numTemps; temp++) {
+            if (end[temp] >= 0) order.push_back(temp);
+        }
+        std::stable_sort(order.begin(), order.end(), [&start](int x, int y) { return start[x] < start[y]; });
+
+        regs.assign(func->numTemps, -1);
+        int owner[PC + 1];
+        std::fill(owner, owner + PC + 1, NO_TEMP);
+        for (int temp : order) {
+            for (int reg : tempRegs) {
+                if (owner[reg] != NO_TEMP && end[owner[reg]] < start[temp]) owner[reg] = NO_TEMP;
+            }
+            std::vector<int>::iterator clobber = std::lower_bound(clobbers.begin(), clobbers.end(), (start[temp] + 1) / 2);
+            if (clobber != clobbers.end() && 2 * *clobber < end[temp]) continue;
+
+            int reg = -1;
+            if (hint[temp] != NO_TEMP && regs[hint[temp]] >= 0 && owner[regs[hint[temp]]] == NO_TEMP) {
+                reg = regs[hint[temp]];
+            }
+            for (int i = 0; i < NUM_TEMP_REGS && reg < 0; i++) {
+                if (owner[tempRegs[i]] == NO_TEMP) reg = tempRegs[i];
+            }
+            if (reg < 0) {
+                int victim = temp;
+                for (int r : tempRegs) {
+                    if (weight[owner[r]] < weight[victim]) victim = owner[r];
+                }
+                if (victim == temp) continue;
+                reg = regs[victim];
+                regs[victim] = -1;
+            }
+            regs[temp] = reg;
+            owner[reg] = temp;
+        }
+
+        // Temporaries in the frame share words when they do not overlap
+        std::vector<int> wordEnd;
+        spills.assign(func->numTemps, 0);
+        for (int temp : order) {
+            if (regs[temp] >= 0) continue;
+            size_t word = 0;
+            while (word < wordEnd.size() && wordEnd[word] >= start[temp]) word++;
+            if (word == wordEnd.size()) wordEnd.push_back(0);
+            wordEnd[word] = end[temp];
+            spills[temp] = -(frameBase + (int) word);
+        }
+        ghostFrame = -(frameBase + (int) wordEnd.size());
+    }
+
+    // The register holding temp, loaded into scratch from the frame
+    // if it is there
+    int use(int temp, int scratch) {
+        if (regs[temp] >= 0) return regs[temp];
+        emitRM(OpCode::LD, scratch, spills[temp], FP, commentf("Load t%d from the frame", temp));
+        return scratch;
+    }
+
+    // The register to compute temp in, AC1 if it goes in the frame
+    int target(int temp) {
+        return regs[temp] >= 0 ? regs[temp] : AC1;
+    }
+
+    void save(int temp) {
+        if (regs[temp] < 0) emitRM(OpCode::ST, AC1, spills[temp], FP, commentf("Store t%d in the frame", temp));
+    }
+
+    void move(int reg, int temp, char *comment) {
+        if (regs[temp] == reg) return;
+        if (regs[temp] >= 0) {
+            emitRM(OpCode::LDA, reg, 0, regs[temp], comment);
+        } else {
+            emitRM(OpCode::LD, reg, spills[temp], FP, comment);
+        }
+    }
+
+    int base(const IRSlot &slot, int scratch) {
+        switch (slot.base) {
+            case IRBase::FRAME: return FP;
+            case IRBase::GLOBAL: return GP;
+        }
+        return use(slot.temp, scratch);
+    }
+
+    // Only as many elements as both arrays can hold are copied
+    void copyArray(const IRInstr &instr, char *comment) {
+        if (regs[instr.b] != AC) {
+            move(AC, instr.a, (char *) "Load address of rhs array");
+            move(AC1, instr.b, (char *) "Load address of lhs array");
+        } else {
+            move(AC1, instr.b, (char *) "Load address of lhs array");
+            move(AC, instr.a, (char *) "Load address of rhs array");
+        }
+        emitRM(OpCode::LD, AC2, 1, AC, (char *) "AC2 <- |RHS|");
+        emitRM(OpCode::LD, AC3, 1, AC1, (char *) "AC3 <- |LHS|");
+        emitRO(OpCode::SWP, AC2, AC3, AC3, (char *) "Pick smallest size");
+        emitRO(OpCode::MOV, AC1, AC, AC2, comment);
+    }
+
+    void call(const IRInstr &instr, char *comment) {
+        emitComment(commentf("CALL %s", instr.name));
+        emitRM(OpCode::ST, FP, ghostFrame, FP, commentf("Store frame pointer in ghost frame for %s", instr.name));
+        for (size_t i = 0; i < instr.args.size(); i++) {
+            emitRM(OpCode::ST, use(instr.args[i], AC1), ghostFrame - 2 - (int) i, FP, (char *) "Push parameter onto new frame");
+        }
+        emitRM(OpCode::LDA, FP, ghostFrame, FP, (char *) "Move the frame pointer to the new frame");
+        emitRM(OpCode::LDA, AC, 1, PC, (char *) "Store the return address in ac (skip 1 ahead)");
+        emitGotoLabel(labels(instr.func).entry, comment);
+        if (instr.dst != NO_TEMP) {
+            if (regs[instr.dst] >= 0) {
+                emitRM(OpCode::LDA, regs[instr.dst], 0, RT, (char *) "Save return result");
+            } else {
+                emitRM(OpCode::ST, RT, spills[instr.dst], FP, (char *) "Save return result in the frame");
+            }
+        }
+        emitComment(commentf("END CALL %s", instr.name));
+    }
+
+    // The arguments overwrite the parameters and the callee is entered
+    // past the store of its return address, which is already in place
+    void tailCall(const IRInstr &instr, char *comment) {
+        TokenTree *param = instr.func->children[0];
+        for (int arg : instr.args) {
+            emitRM(OpCode::ST, use(arg, AC1), param->getMemoryOffset(), FP,
+                commentf("Store argument over parameter %s", param->getStringValue()));
+            param = param->sibling;
+        }
+        emitGotoLabel(labels(instr.func).tail, comment);
+    }
+
+    void returnFrom(const IRInstr &instr, char *comment) {
+        if (instr.a != NO_TEMP) move(RT, instr.a, comment);
+        emitRM(OpCode::LD, AC, -1, FP, (char *) "Load return address");
+        emitRM(OpCode::LD, FP, 0, FP, (char *) "Adjust frame pointer");
+        emitGoto(0, AC, (char *) "Return");
+    }
+
+    // Jumps to the block laid out next are left out
+    void branch(const IRInstr &instr, int next, char *comment) {
+        int cond = use(instr.a, AC1);
+        if (instr.other == next) {
+            emitRMLabel(OpCode::JNZ, cond, blockLabels[instr.target], comment);
+        } else if (instr.target == next) {
+            emitRMLabel(OpCode::JZR, cond, blockLabels[instr.other], comment);
+        } else {
+            emitRMLabel(OpCode::JNZ, cond, blockLabels[instr.target], comment);
+            emitGotoLabel(blockLabels[instr.other], comment);
+        }
+    }
+
+    void lower(const IRInstr &instr, int next) {
+        char *comment = note(instr);
+        int dst = instr.dst;
+        switch (instr.op) {
+            case IROp::CONST:
+                emitRM(OpCode::LDC, target(dst), instr.imm, 0, comment);
+                save(dst);
+                break;
+            case IROp::LIT:
+                emitRM(OpCode::LDC, target(dst), litAddress((char *) instr.text.data(), instr.text.size()), 0, comment);
+                save(dst);
+                break;
+            case IROp::COPY:
+                if (regs[dst] >= 0) {
+                    move(regs[dst], instr.a, comment);
+                } else {
+                    emitRM(OpCode::ST, use(instr.a, AC1), spills[dst], FP, comment);
+                }
+                break;
+            case IROp::ADDR:
+                emitRM(OpCode::LDA, target(dst), instr.slot.offset, base(instr.slot, RT), comment);
+                save(dst);
+                break;
+            case IROp::LOAD:
+                emitRM(OpCode::LD, target(dst), instr.slot.offset, base(instr.slot, RT), comment);
+                save(dst);
+                break;
+            case IROp::STORE: {
+                int value = use(instr.a, AC1);
+                emitRM(OpCode::ST, value, instr.slot.offset, base(instr.slot, RT), comment);
+                break;
+            }
+            case IROp::ADDI:
+                emitRM(OpCode::LDA, target(dst), instr.imm, use(instr.a, AC1), comment);
+                save(dst);
+                break;
+            case IROp::NEG:
+                emitRO(OpCode::NEG, target(dst), use(instr.a, AC1), 0, comment);
+                save(dst);
+                break;
+            case IROp::NOT: {
+                int a = use(instr.a, AC1);
+                emitRM(OpCode::LDC, RT, 1, 0, (char *) "Load 1 for not operation");
+                emitRO(OpCode::TNE, target(dst), RT, a, comment);
+                save(dst);
+                break;
+            }
+            case IROp::RAND:
+                emitRO(OpCode::RND, target(dst), use(instr.a, AC1), 0, comment);
+                save(dst);
+                break;
+            case IROp::COPYARRAY:
+                copyArray(instr, comment);
+                break;
+            case IROp::IN: case IROp::INB: case IROp::INC:
+                emitRO(tmOp(instr.op), target(dst), target(dst), target(dst), comment);
+                save(dst);
+                break;
+            case IROp::OUT: case IROp::OUTB: case IROp::OUTC: {
+                int a = use(instr.a, AC1);
+                emitRO(tmOp(instr.op), a, a, a, comment);
+                break;
+            }
+            case IROp::OUTNL:
+                emitRO(OpCode::OUTNL, AC, AC, AC, comment);
+                break;
+            case IROp::CALL:
+                call(instr, comment);
+                break;
+            case IROp::JUMP:
+                if (instr.target != next) emitGotoLabel(blockLabels[instr.target], comment);
+                break;
+            case IROp::BRANCH:
+                branch(instr, next, comment);
+                break;
+            case IROp::RETURN:
+                returnFrom(instr, comment);
+                break;
+            case IROp::TAILCALL:
+                tailCall(instr, comment);
+                break;
+            case IROp::RUN:
+                emitRM(OpCode::LDA, AC, 1, PC, (char *) "Return address in ac");
+                emitGotoLabel(labels((TokenTree *) symbolTable->lookupGlobal("main")).entry, (char *) "Jump to function main");
+                emitRO(OpCode::HALT, 0, 0, 0, (char *) "DONE!");
+                break;
+            default: { // Binary operations
+                int a = use(instr.a, AC1);
+                int b = use(instr.b, RT);
+                emitRO(tmOp(instr.op), target(dst), a, b, comment);
+                save(dst);
+                break;
+            }
+        }
+    }
+
+    void blocks() {
+        blockLabels.clear();
+        for (size_t b = 0; b < func->blocks.size(); b++) {
+            blockLabels.push_back(newLabel());
+        }
+        for (size_t b = 0; b < func->blocks.size(); b++) {
+            bindLabel(blockLabels[b]);
+            for (IRInstr &instr : func->blocks[b].instrs) {
+                lower(instr, b + 1);
+            }
+        }
+    }
+
+    // A tail call can make the frame as big as the callee's, so the
+    // temporaries go below the largest
+    void function(IRFunction *f) {
+        func = f;
+        frameBase = func->decl->getMemorySize();
+        for (IRBlock &block : func->blocks) {
+            IRInstr &last = block.instrs.back();
+            if (last.op == IROp::TAILCALL) frameBase = std::max(frameBase, (int) last.func->getMemorySize());
+        }
+        allocate();
+
+        emitComment((char *) "** ** ** ** ** ** ** ** ** ** ** **");
+        emitComment(commentf("FUNCTION %s", func->decl->getStringValue()));
+        FunctionLabels &entry = labels(func->decl);
+        markEntryPoint(emitSkip(0));
+        bindLabel(entry.entry);
+        emitRM(OpCode::ST, AC, -1, FP, (char *) "Store return address");
+        bindLabel(entry.tail);
+        blocks();
+        emitComment(commentf("END FUNCTION %s", func->decl->getStringValue()));
+        emitComment((char *) "");
+    }
+
+    // The first frame is right after the globals and main runs in it
+    void init(IRFunction *f) {
+        func = f;
+        frameBase = 2;
+        allocate();
+
+        emitComment((char *) "INIT");
+        backPatchAJumpToHere(0, (char *) "Jump to init backpatch");
+        emitRM(OpCode::LD, GP, 0, 0, (char *) "Set the global pointer");
+        emitRM(OpCode::LDA, FP, globalOffset, GP, (char *) "Set the first frame at the end of globals");
+        emitRM(OpCode::ST, FP, 0, FP, (char *) "Store old frame pointer (point to self)");
+        emitComment((char *) "INIT GLOBALS AND STATICS");
+        blocks();
+        emitComment((char *) "END INIT");
+    }
+};
+
+void lowerIR(IRProgram *program) {
+    Lowering lowering;
+    emitComment((char *) "C- Compiler by Zachary Sugano");
+    emitComment((char *) "");
+    emitSkip(1); // Leave space for backpatch
+    for (IRFunction *func : program->functions) {
+        lowering.function(func);
+    }
+    lowering.init(program->init);
+    optimizeCode();
+    flushCode();
+}
@@ -0,0 +1,11 @@
+#ifndef LOWER_H
+#define LOWER_H
+#include "ir.h"
+/**
+ * Writes the TM code for a program in the IR.  Temporaries get the
+ * accumulators by linear scan over their live ranges, the ones left
+ * over or live across a call get a word of the frame.
+ */
+void lowerIR(IRProgram *program);
+
+#endif
@@ -9,7 +9,10 @@
 #include "symbolTable.h"
 #include "yyerror.h"
 #include "semantic.h"
+#include "optimize/optimize.h"
 #include "codegen/codegen.h"
+#include "ir/ir.h"
+#include "lower/lower.h"
 #include "utils/utils.h"
 
 
@@ -20,6 +23,9 @@ int localOffset = -2;
 int globalOffset = 0;
 bool symtabDebug = false;
 bool printMem = false;
+bool binaryOutput = false;
+bool leanCode = false;
+bool shortCircuit = false;
 TokenTree *syntaxTree;
 SymbolTable *symbolTable;
 FILE *code;
@@ -34,23 +40,42 @@ extern FILE *yyin;
 int main(int argc, char **argv) {
     extern int optind;
     bool printAST = false;
+    bool useIR = false;
+    bool showIR = false;
     char *fileName = NULL;
     char *outputFileName = NULL;
     int c;
 
     initErrorProcessing();
 
-    while ((c = ourGetopt(argc, argv, (char *) "dhPMS")) != EOF) {
+    while ((c = ourGetopt(argc, argv, (char *) "BCdhILPMRS")) != EOF) {
         switch (c) {
+            case 'B':
+                binaryOutput = true;
+                break;
+            case 'C':
+                shortCircuit = true;
+                break;
             case 'd':
                 yydebug = true;
                 break;
+            case 'I':
+                useIR = true;
+                break;
+            case 'L':
+                leanCode = true;
+                break;
             case 'h':
                 printf("Usage: c- [options] [sourceFile]\n");
+                printf("  -B  write a binary TM object file (.tmo) instead of a .tm listing\n");
+                printf("  -C  short circuit & and |, the right operand is skipped when the left decides\n");
                 printf("  -d  turn on Bison debugging\n");
                 printf("  -h  this usage message\n");
+                printf("  -I  generate code through the three-address IR\n");
+                printf("  -L  lean code, generate no comments in the output\n");
                 printf("  -P  print abstract syntax tree + types\n");
                 printf("  -M  print abstract syntax tree + types + memory info\n");
+                printf("  -R  print the three-address IR, implies -I\n");
                 printf("  -S  turn on symbol table debugging\n");
                 return 0;
             case 'P':
@@ -60,6 +85,10 @@ int main(int argc, char **argv) {
                 printAST = true;
                 printMem = true;
                 break;
+            case 'R':
+                useIR = true;
+                showIR = true;
+                break;
             case 'S':
                 symtabDebug = true;
                 break;
@@ -87,17 +116,27 @@ int main(int argc, char **argv) {
         }
 
         if (numErrors == 0) {
+            const char *extension = binaryOutput ? "tmo" : "tm";
             if (fileName == NULL) {
-                outputFileName = (char *) "out.tm";
+                outputFileName = (char *) (binaryOutput ? "out.tmo" : "out.tm");
             } else {
-                int outLength = strlen(fileName) + 1;
+                int baseLength = strlen(fileName) - 2; // Drop the "c-"
+                int outLength = baseLength + strlen(extension) + 1;
                 outputFileName = (char *) malloc(sizeof(char) * outLength);
-                bstrcpy(outputFileName, outLength, fileName);
-                outputFileName[outLength - 3] = 't';
-                outputFileName[outLength - 2] = 'm';
+                bstrcpy(outputFileName, baseLength + 1, fileName);
+                bstrcpy(outputFileName + baseLength, outLength - baseLength, extension);
+            }
+            code = fopen(outputFileName, binaryOutput ? "wb" : "w");
+            foldConstants();
+            if (useIR) {
+                IRProgram *program = buildIR();
+                if (showIR) {
+                    printIR(program, stdout);
+                }
+                lowerIR(program);
+            } else {
+                generateCode();
             }
-            code = fopen(outputFileName, "w");
-            generateCode();
         }
     }
     
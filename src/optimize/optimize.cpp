@@ -0,0 +1,154 @@
+#include "optimize.h"
+#include "TokenTree.h"
+#include <limits.h>
+#include <stdio.h>
+
+extern TokenTree *syntaxTree;
+
+bool isScalarConstant(TokenTree *tree) {
+    return tree != NULL && tree->getNodeKind() == NodeKind::EXPRESSION
+        && tree->getExprKind() == ExprKind::CONSTANT && !tree->isArray();
+}
+
+// The value codegen would load for a constant
+long long constantValue(TokenTree *tree) {
+    if (tree->getExprType() == ExprType::CHAR) return (int) tree->getCharValue();
+    return tree->getNumValue();
+}
+
+// Size of an array whose size is known at compile time.  Array
+// parameters can be passed any array so their size is not known.
+bool arraySize(TokenTree *arr, long long *size) {
+    if (arr->getNodeKind() != NodeKind::EXPRESSION || !arr->isArray()) return false;
+    if (arr->getExprKind() == ExprKind::CONSTANT) {
+        *size = arr->getNumValue();
+        return true;
+    }
+    if (arr->getExprKind() == ExprKind::ID && arr->getMemoryType() != MemoryType::PARAM) {
+        *size = arr->getMemorySize() - 1; // Less the size slot
+        return true;
+    }
+    return false;
+}
+
+// Computes what the TM instructions for the operator would leave in
+// AC.  Fails on anything that has to be left to run time: operands
+// that are not constants, division by zero and ? (random).
+bool evaluateOperation(TokenTree *tree, long long *value) {
+    TokenTree *lhs = tree->children[0];
+    TokenTree *rhs = tree->children[1];
+
+    if (rhs == NULL) {
+        if (tree->getOpKind() == OpKind::TIMES) return arraySize(lhs, value);
+        if (!isScalarConstant(lhs)) return false;
+        long long a = constantValue(lhs);
+        switch (tree->getOpKind()) {
+            case OpKind::MINUS: *value = -a; break;
+            case OpKind::NOT: *value = 1 != a; break;
+            default: return false;
+        }
+        return true;
+    }
+
+    if (!isScalarConstant(lhs) || !isScalarConstant(rhs)) return false;
+    long long a = constantValue(lhs);
+    long long b = constantValue(rhs);
+    switch (tree->getOpKind()) {
+        case OpKind::PLUS: *value = a + b; break;
+        case OpKind::MINUS: *value = a - b; break;
+        case OpKind::TIMES: *value = a * b; break;
+        case OpKind::DIVIDE:
+            if (b == 0) return false;
+            *value = a / b;
+            break;
+        case OpKind::MOD: // C- modulus is never negative
+            if (b == 0) return false;
+            *value = a % b;
+            if (*value < 0) *value += b < 0 ? -b : b;
+            break;
+        case OpKind::AND: *value = a & b; break;
+        case OpKind::OR: *value = a | b; break;
+        case OpKind::LESS: *value = a < b; break;
+        case OpKind::LEQ: *value = a <= b; break;
+        case OpKind::GREATER: *value = a > b; break;
+        case OpKind::GEQ: *value = a >= b; break;
+        case OpKind::EQ: *value = a == b; break;
+        case OpKind::NEQ: *value = a != b; break;
+        default: return false;
+    }
+    return true;
+}
+
+// Turns an operator node into a constant, the way the scanner and
+// parser would have built it
+void makeConstant(TokenTree *tree, long long value) {
+    char text[24];
+    if (tree->getExprType() == ExprType::BOOL) {
+        snprintf(text, sizeof(text), "%s", value ? "true" : "false");
+    } else {
+        snprintf(text, sizeof(text), "%lld", value);
+    }
+    tree->setExprKind(ExprKind::CONSTANT);
+    tree->setOpKind(OpKind::NONE);
+    tree->setTokenString(text);
+    tree->setStringValue(text);
+    tree->setNumValue((int) value);
+    for (int i = 0; i < MAX_CHILDREN; i++) {
+        tree->children[i] = NULL;
+    }
+}
+
+struct Comparison {
+    OpKind op;
+    OpKind inverse;    // true exactly when op is false
+    const char *inverseText;
+};
+
+const Comparison comparisons[] = {
+    { OpKind::LESS, OpKind::GEQ, ">=" }, { OpKind::GEQ, OpKind::LESS, "<" },
+    { OpKind::GREATER, OpKind::LEQ, "<=" }, { OpKind::LEQ, OpKind::GREATER, ">" },
+    { OpKind::EQ, OpKind::NEQ, "!=" }, { OpKind::NEQ, OpKind::EQ, "==" }
+};
+
+// Rewrites !(a < b) as a >= b so no code is spent on the !
+void invertNegatedComparison(TokenTree *tree) {
+    TokenTree *cmp = tree->children[0];
+    if (tree->getOpKind() != OpKind::NOT || cmp->getNodeKind() != NodeKind::EXPRESSION
+            || cmp->getExprKind() != ExprKind::OP || cmp->children[1] == NULL) {
+        return;
+    }
+    for (const Comparison &c : comparisons) {
+        if (c.op != cmp->getOpKind()) continue;
+        tree->setOpKind(c.inverse);
+        tree->setTokenString((char *) c.inverseText);
+        tree->setStringValue((char *) c.inverseText);
+        for (int i = 0; i < MAX_CHILDREN; i++) {
+            tree->children[i] = cmp->children[i];
+            if (tree->children[i] != NULL) tree->children[i]->parent = tree;
+        }
+        return;
+    }
+}
+
+void _foldConstants(TokenTree *tree) {
+    while (tree != NULL) {
+        for (int i = 0; i < MAX_CHILDREN; i++) {
+            _foldConstants(tree->children[i]);
+        }
+        if (tree->getNodeKind() == NodeKind::EXPRESSION && tree->getExprKind() == ExprKind::OP) {
+            long long value;
+            // Registers are wider than an LDC operand so only results
+            // that fit are folded
+            if (evaluateOperation(tree, &value) && value >= INT_MIN && value <= INT_MAX) {
+                makeConstant(tree, value);
+            } else {
+                invertNegatedComparison(tree);
+            }
+        }
+        tree = tree->sibling;
+    }
+}
+
+void foldConstants() {
+    _foldConstants(syntaxTree);
+}
@@ -0,0 +1,11 @@
+#ifndef OPTIMIZE_H
+#define OPTIMIZE_H
+#include "TokenTree.h"
+/**
+ * Replaces every operator whose operands are all constants with a
+ * single constant and folds ! into the comparison under it.  Runs on
+ * the checked tree, before code generation.
+ */
+void foldConstants();
+
+#endif
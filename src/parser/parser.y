@@ -359,6 +359,7 @@ breakStmt       : BREAK ';' {
 exp             : mutable '=' exp   {
                                         $$ = $2;
                                         $$->setExprKind(ExprKind::ASSIGN);
+                                        $$->setOpKind(OpKind::ASSIGN);
                                         $$->children[0] = $1;
                                         $$->children[0]->cancelCheckInit(true);
                                         $$->children[1] = $3;
@@ -366,6 +367,7 @@ exp             : mutable '=' exp   {
                 | mutable ADDASS exp    {
                                             $$ = $2;
                                             $$->setExprKind(ExprKind::ASSIGN);
+                                            $$->setOpKind(OpKind::ADDASS);
                                             $$->children[0] = $1;
                                             $$->children[0]->cancelCheckInit(true);
                                             $$->children[1] = $3;
@@ -373,6 +375,7 @@ exp             : mutable '=' exp   {
                 | mutable SUBASS exp    {
                                             $$ = $2;
                                             $$->setExprKind(ExprKind::ASSIGN);
+                                            $$->setOpKind(OpKind::SUBASS);
                                             $$->children[0] = $1;
                                             $$->children[0]->cancelCheckInit(true);
                                             $$->children[1] = $3;
@@ -380,6 +383,7 @@ exp             : mutable '=' exp   {
                 | mutable MULASS exp    {
                                             $$ = $2;
                                             $$->setExprKind(ExprKind::ASSIGN);
+                                            $$->setOpKind(OpKind::MULASS);
                                             $$->children[0] = $1;
                                             $$->children[0]->cancelCheckInit(true);
                                             $$->children[1] = $3;
@@ -387,6 +391,7 @@ exp             : mutable '=' exp   {
                 | mutable DIVASS exp    {
                                             $$ = $2;
                                             $$->setExprKind(ExprKind::ASSIGN);
+                                            $$->setOpKind(OpKind::DIVASS);
                                             $$->children[0] = $1;
                                             $$->children[0]->cancelCheckInit(true);
                                             $$->children[1] = $3;
@@ -394,11 +399,13 @@ exp             : mutable '=' exp   {
                 | mutable INC   {
                                     $$ = $2;
                                     $$->setExprKind(ExprKind::ASSIGN);
+                                    $$->setOpKind(OpKind::INC);
                                     $$->children[0] = $1;
                                 }
                 | mutable DEC   {
                                     $$ = $2;
                                     $$->setExprKind(ExprKind::ASSIGN);
+                                    $$->setOpKind(OpKind::DEC);
                                     $$->children[0] = $1;
                                 }
                 | simpleExp { $$ = $1; }
@@ -413,6 +420,7 @@ exp             : mutable '=' exp   {
 simpleExp       : simpleExp '|' andExpr {
                                             $$ = $2;
                                             $$->setExprKind(ExprKind::OP);
+                                            $$->setOpKind(OpKind::OR);
                                             $$->children[0] = $1;
                                             $$->children[1] = $3;
                                         }
@@ -422,6 +430,7 @@ simpleExp       : simpleExp '|' andExpr {
 andExpr         : andExpr '&' unaryRelExp   {
                                                 $$ = $2;
                                                 $$->setExprKind(ExprKind::OP);
+                                                $$->setOpKind(OpKind::AND);
                                                 $$->children[0] = $1;
                                                 $$->children[1] = $3;
                                             }
@@ -431,6 +440,7 @@ andExpr         : andExpr '&' unaryRelExp   {
 unaryRelExp     : '!' unaryRelExp   {
                                         $$ = $1;
                                         $$->setExprKind(ExprKind::OP);
+                                        $$->setOpKind(OpKind::NOT);
                                         $$->children[0] = $2;
                                     }
                 | relExp { $$ = $1; }
@@ -445,12 +455,12 @@ relExp          : sumExp relop sumExp   {
                 | sumExp { $$ = $1; }
                 | sumExp relop error    { $$ = NULL; }
                 ;
-relop           : LEQ { $$ = $1; }
-                | '<' { $$ = $1; }
-                | '>' { $$ = $1; }
-                | GEQ { $$ = $1; }
-                | EQ { $$ = $1; }
-                | NEQ  { $$ = $1; }
+relop           : LEQ { $$ = $1; $$->setOpKind(OpKind::LEQ); }
+                | '<' { $$ = $1; $$->setOpKind(OpKind::LESS); }
+                | '>' { $$ = $1; $$->setOpKind(OpKind::GREATER); }
+                | GEQ { $$ = $1; $$->setOpKind(OpKind::GEQ); }
+                | EQ { $$ = $1; $$->setOpKind(OpKind::EQ); }
+                | NEQ  { $$ = $1; $$->setOpKind(OpKind::NEQ); }
                 ;
 sumExp          : sumExp sumop mulExp   {
                                             $$ = $2;
@@ -461,8 +471,8 @@ sumExp          : sumExp sumop mulExp   {
                 | mulExp { $$ = $1; }
                 | sumExp sumop error    { $$ = NULL; }
                 ;
-sumop           : '+' { $$ = $1; }
-                | '-' { $$ = $1; }
+sumop           : '+' { $$ = $1; $$->setOpKind(OpKind::PLUS); }
+                | '-' { $$ = $1; $$->setOpKind(OpKind::MINUS); }
                 ;
 mulExp          : mulExp mulOp unaryExp {
                                             $$ = $2;
@@ -473,9 +483,9 @@ mulExp          : mulExp mulOp unaryExp {
                 | unaryExp { $$ = $1; }
                 | mulExp mulOp error    { $$ = NULL; }
                 ;
-mulOp           : '*' { $$ = $1; }
-                | '/' { $$ = $1; }
-                | '%' { $$ = $1; }
+mulOp           : '*' { $$ = $1; $$->setOpKind(OpKind::TIMES); }
+                | '/' { $$ = $1; $$->setOpKind(OpKind::DIVIDE); }
+                | '%' { $$ = $1; $$->setOpKind(OpKind::MOD); }
                 ;
 unaryExp        : unaryop unaryExp  {
                                         $$ = $1;
@@ -485,9 +495,9 @@ unaryExp        : unaryop unaryExp  {
                 | factor { $$ = $1; }
                 | unaryop error { $$ = NULL; }
                 ;
-unaryop         : '-' { $$ = $1; }
-                | '*' { $$ = $1; }
-                | '?' { $$ = $1; }
+unaryop         : '-' { $$ = $1; $$->setOpKind(OpKind::MINUS); }
+                | '*' { $$ = $1; $$->setOpKind(OpKind::TIMES); }
+                | '?' { $$ = $1; $$->setOpKind(OpKind::RANDOM); }
                 ;
 factor          : immutable { $$ = $1; }
                 | mutable { $$ = $1; }
@@ -500,6 +510,7 @@ mutable         : ID    {
                 | mutable '[' exp ']'   {
                                             $$ = $2;
                                             $$->setExprKind(ExprKind::OP);
+                                            $$->setOpKind(OpKind::INDEX);
                                             $$->children[0] = $1;
                                             $$->children[1] = $3;
                                         }
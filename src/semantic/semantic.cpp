@@ -179,26 +179,7 @@ void handleArrayAccess(TokenTree *tree) {
     }
 }
 
-const char *operations[NUM_OPS] = {
-    "<=",
-    "<",
-    ">=",
-    ">",
-    "&",
-    "|",
-    "!",
-    "+",
-    "-",
-    "*",
-    "/",
-    "%",
-    "++",
-    "--",
-    "?",
-    "==",
-    "!=",
-    "["
-};
+// Handlers indexed by OpKind
 void (*functionPointers[NUM_OPS])(TokenTree *) = {
     handleComparison, // LEQ
     handleComparison, // LESS THAN
@@ -220,15 +201,6 @@ void (*functionPointers[NUM_OPS])(TokenTree *) = {
     handleArrayAccess, // ARRAY ACCESSOR []
 };
 
-int indexOfOperation(TokenTree *tree) {
-    for (int i = 0; i < NUM_OPS; i++) {
-        if (strcmp(tree->getTokenString(), operations[i]) == 0) {
-            return i;
-        }
-    }
-    return -1;
-}
-
 bool compoundShouldEnterScope(TokenTree *parent) {
     if (parent == NULL) {
         return true;
@@ -313,15 +285,14 @@ void beforeChildren(TokenTree *tree, bool *enteredScope, int &previousLocalOffse
                             err(tree);
                             printf("'%s' is a simple variable and cannot be called.\n", tree->getStringValue());
                             tree->setExprType(ExprType::UNDEFINED);
+                        } else {
+                            res->setIsUsed(true);
                         }
                     }
                     break;
                 }
                 case ExprKind::CONSTANT: {
-                    if (tree->isArray()) {
-                        tree->setMemoryType(MemoryType::GLOBAL);
-                        tree->calculateMemoryOffset();
-                    }
+                    // String constants live in the literal pool, not in globals
                     break;
                 }
                 case ExprKind::ID: {
@@ -507,7 +478,7 @@ void afterChildren(TokenTree *tree) {
                             printf("The operation '%s' does not work with arrays.\n", tree->getTokenString());
                         }
                     } else { // ASSIGN,ADDASS,SUBASS,MULASS,DIVASS
-                        bool isAssign = (strcmp(tree->getStringValue(), "=") == 0);
+                        bool isAssign = tree->getOpKind() == OpKind::ASSIGN;
                         if (isAssign) {
                             tree->setExprType(lhs->getExprType());
                             tree->setIsArray(lhs->isArray());
@@ -572,7 +543,7 @@ void afterChildren(TokenTree *tree) {
                     break;
                 }
                 case ExprKind::OP: {
-                    void (*fp)(TokenTree *) = functionPointers[indexOfOperation(tree)];
+                    void (*fp)(TokenTree *) = functionPointers[(int) tree->getOpKind()];
                     fp(tree);
                     break;
                 }
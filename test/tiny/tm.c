@@ -4,6 +4,32 @@
 // The TM ("Tiny Machine") virtual machine
 // Book: Compiler Construction: Principles and Practice
 
+// v5.5    Snapshots (-s with -m): each program runs once to its first
+//           input instruction or a given address and its jobs start
+//           from a copy of that machine.
+// v5.4    The state of a run is a MACHINE and the loaded program a PROGRAM,
+//           so runs are independent.  -m runs a file of jobs (program,
+//           input, expected output) on a pool of threads sharing each
+//           loaded and predecoded program.
+// v5.3    Superinstructions: the fast engines run the common sequences
+//           c- emits (call, return, push, pop and operate) in one
+//           dispatch, still counting every instruction.
+// v5.2    Profile (-p): runs of each instruction are counted and reported
+//           at exit by opcode, function (FUNCTION comments), basic block
+//           and instruction.
+// v5.1    JIT (-j or the j command): 'g' runs iMem translated to x86-64
+//           code.  I/O and the rare instructions call executeInstruction.
+// v5.0    Fast mode (-f or the f command) drops instruction counting, the
+//           execution limit and memory tags from 'g'.
+// v4.9    Memory sizes are set with -d and -i and instruction memory grows
+//           to fit the program.  Memories are mapped on the heap so a
+//           clear is a fresh mapping.  LIT data survives a clear.
+// v4.8    Command line options: -b runs the program in batch and exits
+//           with its status, -l and -o set the limits.
+// v4.7    Fast engine for 'g' without tracing or breakpoints: iMem is
+//           predecoded and run with computed goto.
+// v4.6    Load binary object files (.tmo, see lib/emitcode/tmobject.h)
+//           by mapping them into memory.  -n skips loading comments.
 // v4.5b   Actually detect out of bounds on data memory and instr memory! Duh.
 // v4.5    Modified Robert Heckendorn Nov 16, 2020
 //           JMP, MOD instructions
@@ -65,17 +91,25 @@
 //
 // v1.0 Kenneth C. Louden's original
 //
-// TO COMPILE: gcc tm.c -o tm
+// TO COMPILE: g++ tm.c -I../../lib/emitcode -o tm
 //
 
-char *versionNumber =(char *)"TM version 4.5b";
+char *versionNumber =(char *)"TM version 5.5";
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <limits.h>
+#include <time.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <unistd.h>
+#include <setjmp.h>
+#include <pthread.h>
+#include "tmobject.h"
 
 #ifndef TRUE
 #define TRUE 1
@@ -88,12 +122,13 @@ char *versionNumber =(char *)"TM version 4.5b";
 #define TRACE 1
 #define NOTRACE 0
 #define USED 1
-#define UNUSED -1
+#define UNUSED 0                /* so fresh zero memory is unused */
 #define READONLY -2
 
 /******* const *******/
-#define   IADDR_SIZE  10000	/* increase for large programs */
-#define   DADDR_SIZE  10000	/* increase for large programs */
+#define   DEFAULT_IADDR_SIZE  10000	/* -i to change, grows to fit large programs */
+#define   DEFAULT_DADDR_SIZE  10000	/* -d to change */
+#define   MAX_IADDR_SIZE  (1<<24)
 #define   NO_REGS 8
 #define   PC_REG  7
 
@@ -101,6 +136,8 @@ char *versionNumber =(char *)"TM version 4.5b";
 #define   WORDSIZE  1000        /* maximum length of a word of text */
 #define   DEFAULT_ABORT_LIMIT 50000
 #define   DEFAULT_OUTPUT_LIMIT 1000
+#define   NO_SNAPSHOT -2
+#define   SNAPSHOT_AT_INPUT -1
 
 /******* type  *******/
 
@@ -175,7 +212,8 @@ typedef enum
     srDMEM_RONLY_ERR,
     srDMEM_READ_ERR,
     srZERODIVIDE,
-    srOUTPUTLIMIT_ERR
+    srOUTPUTLIMIT_ERR,
+    srINPUT_ERR
 } STEPRESULT;
 
 /* needs to do a better job of producing error messages */
@@ -187,7 +225,8 @@ char *stepResultTab[] = {
     (char *)"ERROR: Set of Readonly Data Memory",
     (char *)"ERROR: Read Data Memory Range Fault",
     (char *)"ERROR: Division by 0",
-    (char *)"ERROR: Output Instruction Limit Exceeded"
+    (char *)"ERROR: Output Instruction Limit Exceeded",
+    (char *)"ERROR: Illegal Input"
 };
 
 
@@ -201,21 +240,110 @@ typedef struct
     char *comment;
 } INSTRUCTION;
 
+/* A predecoded instruction for the fast engine.  handler is the
+   address of the code that executes it (see runTM) */
+typedef struct
+{
+    void *handler;
+    int r, s, t;
+    long long int d;
+} DECODED;
+
+/* For the profile: the functions marked by FUNCTION and END FUNCTION
+   comment lines.  A function whose first or last instruction has not
+   been loaded yet has start -1 or end -2. */
+typedef struct
+{
+    char *name;
+    int start, end;
+} FUNCRANGE;
+
+/* The LIT data of a program.  It is put back whenever data memory is
+   cleared. */
+typedef struct
+{
+    int addr;
+    long long int value;
+} LITDATA;
+
+/* A loaded program.  Once it is loaded and predecoded nothing writes
+   it while it runs, so any number of machines can share it.
+
+   The memories are anonymous mappings so they read as zero until
+   touched and clearing them is just a fresh mapping.  A zero
+   instruction is a HALT with no comment. */
+typedef struct
+{
+    INSTRUCTION *iMem;
+    int *iMemTag;
+    int iaddrSize;
+    int iMemMapped;          // size of the current mapping
+    int daddrSize;           // data memory a machine needs for this program
+
+    LITDATA *litData;
+    int litCount;
+    int litCapacity;
+    int roLow, roHigh;       // bounds of the read only (LIT) data
+
+    DECODED *dCode;          // iMem predecoded for runTM plus an end sentinel
+    int dCodeEngine;         // engine dCode was decoded for, 0 whenever iMem changes
+
+    long long int *profCount;    // runs of each instruction with -p
+    FUNCRANGE *funcRange;
+    int funcCount;
+    int funcCapacity;
+
+    void *objMap;            // mapped .tmo file, comments point into its string table
+    size_t objMapSize;
+} PROGRAM;
+
+/* The state of one run of a program: registers, data memory, counters
+   and the scanner that reads its input.  Everything that executes
+   instructions works on a MACHINE so several can run at once. */
+typedef struct
+{
+    PROGRAM *prog;
+    long long int reg[NO_REGS];
+    long long int *dMem;
+    int *dMemTag;            // if > 0 then 1 + last address modified, == 0 unused, == -2 read/only
+    char **dMemCmt;
+    int daddrSize;
+    int dMemMapped;          // size of the current mapping
+
+    int pc, lastpc;
+    int instrCount;
+    int outputInstrCount;
+    int tagflag;             // setDMem records the instruction that stored
+
+    FILE *in, *out;          // where IN reads and OUT writes
+    jmp_buf *faultJump;      // where a fault goes, NULL to exit tm
+
+    /* The ad hoc scanner's state */
+    char in_Line[LINESIZE];
+    int lineLen;
+    int inCol;
+    long long int num;
+    char word[WORDSIZE];
+    char ch;
+} MACHINE;
+
 /******** GLOBAL VARIABLES ********/
 int iloc = 0;
 int dloc = 0;
 int promptflag = TRUE;
+int batchflag = FALSE;    // run the program from the command line without prompts or echo
 int traceflag = FALSE;
+int commentsflag = TRUE;
+int fastflag = FALSE;     // 'g' runs without instruction counts, limits or memory tags
+int jitflag = FALSE;      // 'g' runs the program translated to machine code
+int profileflag = FALSE;  // count the runs of each instruction and report them at exit
 int icountflag = FALSE;
 int abortLimit = DEFAULT_ABORT_LIMIT;
 int outputLimit = DEFAULT_OUTPUT_LIMIT;
 int stepcnt;
-int pc, lastpc;
 int savedbreakpoint, breakpoint;
 char *emptyString = (char *)"";
 char pgmName[WORDSIZE];
-int instrCount = 0;
-int outputInstrCount = 0;
 int dmemStart = 0;
 int dmemCount = 0;
 int dmemDown = +1;
@@ -223,12 +351,13 @@ int imemStart = 0;
 int imemCount = 0;
 int imemDown = +1;
 
-INSTRUCTION iMem[IADDR_SIZE];
-int iMemTag[IADDR_SIZE];
-long long int dMem[DADDR_SIZE];
-int dMemTag[DADDR_SIZE];   // if >= 0 then last address modified, == -1 unused, == -2 read/only
-char *dMemCmt[DADDR_SIZE];
-long long int reg[NO_REGS];
+int iaddrDefault = DEFAULT_IADDR_SIZE;   // memory sizes a program starts with
+int daddrDefault = DEFAULT_DADDR_SIZE;
+
+PROGRAM mainProgram;      // the program and machine of the commands
+MACHINE mainMachine;
+
+int jitValid = FALSE;     // the JIT translation is of the current iMem
 
 char *opCodeTab[100];
 
@@ -379,54 +508,63 @@ char *niceChar(int n) {
 }
 
 
-/* The ad hoc scanner's global state */
-char in_Line[LINESIZE];
-char *in_LinePtr;
-int lineLen;
-int inCol;
-long long int num;
-char word[WORDSIZE];
-int wordset;  // bool that says if word was set last (truly horrible, needs total rewrite)
-char ch;
 /********************************************/
 
 void printVersion()
 {
     printf("%s (enter h for help)\n", versionNumber);
-    printf("Data Addresses: 0-%d\n", DADDR_SIZE-1);
-    printf("Instruction Addresses: 0-%d\n", IADDR_SIZE-1);
+    printf("Data Addresses: 0-%d\n", mainMachine.daddrSize-1);
+    printf("Instruction Addresses: 0-%d\n", mainProgram.iaddrSize-1);
     printf("Instruction Execution Limit: %d\n", abortLimit);
     printf("Output Instruction Limit: %d\n", outputLimit);
     fflush(stdout);
 }
 
 
-STEPRESULT setDMem(int m, long long int value) {
-    if (dMemTag[m]==READONLY) {
-        printf("ERROR(setDMem): instruction at addr %d attempting to set data memory marked as read only at loc: %d\n", pc, m);
-        exit(1);
+char *instrComment(PROGRAM *prog, int loc)
+{
+    return prog->iMem[loc].comment ? prog->iMem[loc].comment : (char *)"* initially empty";
+}
+
+
+/* a fault in the running program.  It goes to the machine's fault
+   handler if it has one, otherwise tm exits as it always has. */
+void machineFault(MACHINE *vm, STEPRESULT result)
+{
+    fflush(vm->out);
+    if (vm->faultJump != NULL) longjmp(*vm->faultJump, result);
+    exit(1);
+}
+
+
+STEPRESULT setDMem(MACHINE *vm, int m, long long int value) {
+    if (m<0 ||  m>=vm->daddrSize) {
+        fprintf(vm->out, "ERROR(setDMem): instruction at addr %d attempting to set out of bounds data memory at loc: %d\n", vm->pc, m);
+        machineFault(vm, srDMEM_SET_ERR);
     }
-    if (m<0 ||  m>=DADDR_SIZE) {
-        printf("ERROR(setDMem): instruction at addr %d attempting to set out of bounds data memory at loc: %d\n", pc, m);
-        exit(1);
+    if (vm->dMemTag[m]==READONLY) {
+        fprintf(vm->out, "ERROR(setDMem): instruction at addr %d attempting to set data memory marked as read only at loc: %d\n", vm->pc, m);
+        machineFault(vm, srDMEM_RONLY_ERR);
     }
 
-    dMem[m] = value;
-    dMemTag[m] = pc;
-    dMemCmt[m] = iMem[pc].comment;
+    vm->dMem[m] = value;
+    if (vm->tagflag) {
+        vm->dMemTag[m] = vm->pc + 1;
+        vm->dMemCmt[m] = instrComment(vm->prog, vm->pc);
+    }
     return srOKAY;
 }
 
 
 
-long long int getDMem(int m) {
-    if (m<0 ||  m>=DADDR_SIZE) {
-        printf("ERROR(getDMem): instruction at addr %d attempting to get out of bounds data memory at loc: %d\n", pc, m);
-        
-        exit(1);
+long long int getDMem(MACHINE *vm, int m) {
+    if (m<0 ||  m>=vm->daddrSize) {
+        fprintf(vm->out, "ERROR(getDMem): instruction at addr %d attempting to get out of bounds data memory at loc: %d\n", vm->pc, m);
+        machineFault(vm, srDMEM_READ_ERR);
+        return 0;
     }
     else {
-        return dMem[m];
+        return vm->dMem[m];
     }
 }
 
@@ -442,49 +580,51 @@ int opClass(int c)
 
 
 /********************************************/
-void writeInstruction(int loc, int trace)
+void writeInstruction(MACHINE *vm, int loc, int trace)
 {
+    PROGRAM *prog = vm->prog;
+
 //DEBUG    printf("PC: %d  R7: %lld  loc: %d\n", pc, reg[7], loc);
     printf("%4d: ", loc);
-    if ((loc >= 0) && (loc<IADDR_SIZE)) {
-	printf("%4s%3lld,", opCodeTab[iMem[loc].iop], iMem[loc].iarg1);
-	switch (opClass(iMem[loc].iop)) {
+    if ((loc >= 0) && (loc<prog->iaddrSize)) {
+	printf("%4s%3lld,", opCodeTab[prog->iMem[loc].iop], prog->iMem[loc].iarg1);
+	switch (opClass(prog->iMem[loc].iop)) {
 	case opclRR:
-	    printf("%3lld, %1lld ", iMem[loc].iarg2, iMem[loc].iarg3);
+	    printf("%3lld, %1lld ", prog->iMem[loc].iarg2, prog->iMem[loc].iarg3);
 	    if (trace) {
                 printf(" | ");
                 {
                     int i;
-                    for (i=0; i<7; i++) printf(" r[%1d]:%-3lld", i, reg[i]);
+                    for (i=0; i<7; i++) printf(" r[%1d]:%-3lld", i, vm->reg[i]);
                 }
                 printf(" | ");
 	    }
 	    break;
 	case opclRA:
-	    printf("%4lld(%1lld)", iMem[loc].iarg2, iMem[loc].iarg3);
+	    printf("%4lld(%1lld)", prog->iMem[loc].iarg2, prog->iMem[loc].iarg3);
 	    if (trace) {
                 long long int tmp;
 
                 printf(" | ");
                 {
                     int i;
-                    for (i=0; i<7; i++) printf(" r[%1d]:%-3lld", i, reg[i]);
+                    for (i=0; i<7; i++) printf(" r[%1d]:%-3lld", i, vm->reg[i]);
                 }
 /*   zzz   */
-                tmp = iMem[loc].iarg2 + reg[iMem[loc].iarg3];
-                if ((tmp >= 0) && (tmp<DADDR_SIZE)) {
+                tmp = prog->iMem[loc].iarg2 + vm->reg[prog->iMem[loc].iarg3];
+                if ((tmp >= 0) && (tmp<vm->daddrSize)) {
 
                     printf(" m[%lld]:%-3lld",
-                           iMem[loc].iarg2 + reg[iMem[loc].iarg3],
-                           dMem[iMem[loc].iarg2 + reg[iMem[loc].iarg3]]);
+                           prog->iMem[loc].iarg2 + vm->reg[prog->iMem[loc].iarg3],
+                           vm->dMem[prog->iMem[loc].iarg2 + vm->reg[prog->iMem[loc].iarg3]]);
                     printf(" | ");
                 }
             }
 	    break;
 	}
         if (breakpoint == loc || savedbreakpoint == loc) printf(" %s", "<-[break]");
-        if (reg[7] == loc && !trace) printf(" %s", "<-[pc]");
-	printf(" %s\n", iMem[loc].comment);
+        if (vm->reg[7] == loc && !trace) printf(" %s", "<-[pc]");
+	printf(" %s\n", instrComment(prog, loc));
     }
     fflush(stdout);
 }				/* writeInstruction */
@@ -494,15 +634,15 @@ void writeInstruction(int loc, int trace)
 /********************************************/
 /* get the next character
 */
-int getCh()
+int getCh(MACHINE *vm)
 {
 //    printf("LINE: \'%s\'  LINELEN: %d INCOL: %d\n", in_Line, lineLen, inCol);
-    if (++inCol<lineLen) {
-	ch = in_Line[inCol];
+    if (++vm->inCol<vm->lineLen) {
+	vm->ch = vm->in_Line[vm->inCol];
         return 1;
     }
     else {
-	ch = ' ';
+	vm->ch = ' ';
         return 0;
     }
 }
@@ -512,16 +652,16 @@ int getCh()
 /********************************************/
 /* span a bunch of whitespace
 */
-int nonBlank(void)
+int nonBlank(MACHINE *vm)
 {
-    while ((inCol<lineLen) &&
-	   ((in_Line[inCol] == ' ') || (in_Line[inCol] == '\t'))) inCol++;
-    if (inCol<lineLen) {
-	ch = in_Line[inCol];
+    while ((vm->inCol<vm->lineLen) &&
+	   ((vm->in_Line[vm->inCol] == ' ') || (vm->in_Line[vm->inCol] == '\t'))) vm->inCol++;
+    if (vm->inCol<vm->lineLen) {
+	vm->ch = vm->in_Line[vm->inCol];
 	return TRUE;
     }
     else {
-	ch = ' ';
+	vm->ch = ' ';
 	return FALSE;
     }
 }
@@ -529,15 +669,15 @@ int nonBlank(void)
 /********************************************/
 /* span a bunch of whitespace
 */
-int uptoComment(void)
+int uptoComment(MACHINE *vm)
 {
-    while ((inCol<lineLen) && (in_Line[inCol] != '*')) inCol++;
-    if (inCol<lineLen) {
-	ch = in_Line[inCol];
+    while ((vm->inCol<vm->lineLen) && (vm->in_Line[vm->inCol] != '*')) vm->inCol++;
+    if (vm->inCol<vm->lineLen) {
+	vm->ch = vm->in_Line[vm->inCol];
 	return TRUE;
     }
     else {
-	ch = ' ';
+	vm->ch = ' ';
 	return FALSE;
     }
 }
@@ -546,58 +686,58 @@ int uptoComment(void)
 //  returns the numerical equivalent of a character in num.
 //  returns success or failure in function value
 //
-void getCleanChar(void)
-{
-        getCh();
-        if (ch == '\\') {
-            getCh();
-            if (ch == '0') num = '\0';
-            else if (ch == 't') num = '\t';
-            else if (ch == 'n') num = '\n';
-            else if (ch == '\\') num = '\\';
-            else if (ch == '\'') num = '\'';
-            else num = ch;
+void getCleanChar(MACHINE *vm)
+{
+        getCh(vm);
+        if (vm->ch == '\\') {
+            getCh(vm);
+            if (vm->ch == '0') vm->num = '\0';
+            else if (vm->ch == 't') vm->num = '\t';
+            else if (vm->ch == 'n') vm->num = '\n';
+            else if (vm->ch == '\\') vm->num = '\\';
+            else if (vm->ch == '\'') vm->num = '\'';
+            else vm->num = vm->ch;
         }
-        else if (ch == '^') {
-            getCh();
-            num = ch;
-            num ^= 0x40;
+        else if (vm->ch == '^') {
+            getCh(vm);
+            vm->num = vm->ch;
+            vm->num ^= 0x40;
         }
         else {
-            num = ch;
+            vm->num = vm->ch;
         }
 }
 
 
 // return a string in word[]
-int getString(void)
+int getString(MACHINE *vm)
 {
     int i;
     int ok = FALSE;
-    if (ch == '"') {
+    if (vm->ch == '"') {
         i = 0;
         do {
-            getCleanChar();
-            word[i++] = ch;
-        } while (ch != '"');
-        word[i-1] = '\0';
+            getCleanChar(vm);
+            vm->word[i++] = vm->ch;
+        } while (vm->ch != '"');
+        vm->word[i-1] = '\0';
         ok = TRUE;
     }
 
     return ok;
 }
 
-int getChar(void)
+int getChar(MACHINE *vm)
 {
     int ok = FALSE;
 
-    num = 0;
-    if (ch == '\'') {
-        getCleanChar();
-        getCh();
-        if (ch == '\'') {
+    vm->num = 0;
+    if (vm->ch == '\'') {
+        getCleanChar(vm);
+        getCh(vm);
+        if (vm->ch == '\'') {
             ok = TRUE;
-            getCh();
+            getCh(vm);
         }
     }
 
@@ -607,31 +747,31 @@ int getChar(void)
 //  returns the number in num.
 // returns success or failure in function value
 //
-int getNum(void)
+int getNum(MACHINE *vm)
 {
     int sign;
     long long int term;
     int ok = FALSE;
 
-    num = 0;
-    nonBlank();
+    vm->num = 0;
+    nonBlank(vm);
     do {
 	sign = 1;
-	while ((ch == '+') || (ch == '-')) {
+	while ((vm->ch == '+') || (vm->ch == '-')) {
 	    ok = FALSE;
-	    if (ch == '-')
+	    if (vm->ch == '-')
 		sign = -sign;
-	    getCh();
+	    getCh(vm);
 	}
 	term = 0;
-	while (isdigit(ch)) {
+	while (isdigit(vm->ch)) {
 	    ok = TRUE;
-	    term = term*10 + (ch - '0');
-	    getCh();
+	    term = term*10 + (vm->ch - '0');
+	    getCh(vm);
 	}
-	num = num + (term*sign);
+	vm->num = vm->num + (term*sign);
     }
-    while ((ch == '+') || (ch == '-'));
+    while ((vm->ch == '+') || (vm->ch == '-'));
 
 //    printf("NUM: %d\n", num);
     return ok;
@@ -642,26 +782,26 @@ int getNum(void)
 
 
 /********************************************/
-int getNumOrChar(void)
+int getNumOrChar(MACHINE *vm)
 {
-    nonBlank();
-    if ((ch == '+') || (ch == '-') || isdigit(ch)) return getNum();
-    else return getChar();
+    nonBlank(vm);
+    if ((vm->ch == '+') || (vm->ch == '-') || isdigit(vm->ch)) return getNum(vm);
+    else return getChar(vm);
 }
 
 
 /********************************************/
-int getWord(void)
+int getWord(MACHINE *vm)
 {
     int temp = FALSE;
     int length = 0;
-    if (nonBlank()) {
-	while (isalnum(ch) || ch=='=' || ch=='?') {
+    if (nonBlank(vm)) {
+	while (isalnum(vm->ch) || vm->ch=='=' || vm->ch=='?') {
 	    if (length<WORDSIZE - 1)
-		word[length++] = ch;
-	    getCh();
+		vm->word[length++] = vm->ch;
+	    getCh(vm);
 	}
-	word[length] = '\0';
+	vm->word[length] = '\0';
 	temp = (length != 0);
     }
     return temp;
@@ -669,24 +809,24 @@ int getWord(void)
 
 
 /********************************************/
-int getBool(void)
+int getBool(MACHINE *vm)
 {
-    nonBlank();
+    nonBlank(vm);
 
-    num = 1;
-    if ((ch=='F') || (ch=='f') || (ch=='0')) num = 0;
-    getWord();
+    vm->num = 1;
+    if ((vm->ch=='F') || (vm->ch=='f') || (vm->ch=='0')) vm->num = 0;
+    getWord(vm);
 
     return TRUE;
 }
 
 
 /********************************************/
-int skipCh(char c)
+int skipCh(MACHINE *vm, char c)
 {
     int temp = FALSE;
-    if (nonBlank() && (ch == c)) {
-	getCh();
+    if (nonBlank(vm) && (vm->ch == c)) {
+	getCh(vm);
 	temp = TRUE;
     }
     return temp;
@@ -696,19 +836,19 @@ int skipCh(char c)
 
 /********************************************/
 /* note this returns a duplicate string and not true or false */
-char *getRemaining(void)
+char *getRemaining(MACHINE *vm)
 {
-    skipCh(')');
-    if (nonBlank()) return strdup(&in_Line[inCol]);
+    skipCh(vm, ')');
+    if (nonBlank(vm)) return strdup(&vm->in_Line[vm->inCol]);
     return emptyString;
 }
 
 
 
 /********************************************/
-int atEOL(void)
+int atEOL(MACHINE *vm)
 {
-    return (!nonBlank());
+    return (!nonBlank(vm));
 }				/* atEOL */
 
 
@@ -725,59 +865,337 @@ int error(char *msg, int lineNo, int instNo)
 
 
 
+/* anonymous memory that reads as zero until it is touched */
+void *mapZeroed(size_t bytes)
+{
+    void *p;
+
+    p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        printf("ERROR: unable to allocate %lu bytes of TM memory\n", (unsigned long)bytes);
+        exit(1);
+    }
+    return p;
+}
+
+
+/* give back the data memory of a machine */
+void unmapDMem(MACHINE *vm)
+{
+    if (vm->dMem != NULL) {
+        munmap(vm->dMem, vm->dMemMapped * sizeof(long long int));
+        munmap(vm->dMemTag, vm->dMemMapped * sizeof(int));
+        munmap(vm->dMemCmt, vm->dMemMapped * sizeof(char *));
+        vm->dMem = NULL;
+    }
+}
+
+
+/* replace data memory with fresh zero memory of daddrSize words */
+void mapDMem(MACHINE *vm)
+{
+    unmapDMem(vm);
+    vm->dMem = (long long int *)mapZeroed(vm->daddrSize * sizeof(long long int));
+    vm->dMemTag = (int *)mapZeroed(vm->daddrSize * sizeof(int));
+    vm->dMemCmt = (char **)mapZeroed(vm->daddrSize * sizeof(char *));
+    vm->dMemMapped = vm->daddrSize;
+}
+
+
+/* resize instruction memory to size words keeping the first keep */
+void mapIMem(PROGRAM *prog, int size, int keep)
+{
+    INSTRUCTION *newIMem;
+    int *newIMemTag;
+    long long int *newProfCount;
+
+    newIMem = (INSTRUCTION *)mapZeroed(size * sizeof(INSTRUCTION));
+    newIMemTag = (int *)mapZeroed(size * sizeof(int));
+    newProfCount = (long long int *)mapZeroed((size + 1) * sizeof(long long int));  // and the end sentinel
+    if (prog->iMem != NULL) {
+        memcpy(newIMem, prog->iMem, keep * sizeof(INSTRUCTION));
+        memcpy(newIMemTag, prog->iMemTag, keep * sizeof(int));
+        memcpy(newProfCount, prog->profCount, keep * sizeof(long long int));
+        munmap(prog->iMem, prog->iMemMapped * sizeof(INSTRUCTION));
+        munmap(prog->iMemTag, prog->iMemMapped * sizeof(int));
+        munmap(prog->profCount, (prog->iMemMapped + 1) * sizeof(long long int));
+    }
+    prog->iMem = newIMem;
+    prog->iMemTag = newIMemTag;
+    prog->profCount = newProfCount;
+    prog->iMemMapped = prog->iaddrSize = size;
+
+    prog->dCode = (DECODED *)realloc(prog->dCode, (size + 1) * sizeof(DECODED));
+    prog->dCodeEngine = 0;
+    jitValid = FALSE;
+}
+
+
+/* make room for an instruction at loc while loading */
+void growIMem(PROGRAM *prog, int loc)
+{
+    int size;
+
+    size = prog->iaddrSize;
+    while (size <= loc) size *= 2;
+    if (size > MAX_IADDR_SIZE) size = MAX_IADDR_SIZE;
+    mapIMem(prog, size, prog->iaddrSize);
+}
+
+
+/* remember LIT data, clearMachine puts it in place */
+void setLit(PROGRAM *prog, int addr, long long int value)
+{
+    if (addr < 0) {
+        printf("ERROR: LIT data at out of bounds data memory loc: %d\n", addr);
+        exit(1);
+    }
+    if (prog->litCount == prog->litCapacity) {
+        prog->litCapacity = prog->litCapacity ? 2 * prog->litCapacity : 256;
+        prog->litData = (LITDATA *)realloc(prog->litData, prog->litCapacity * sizeof(LITDATA));
+    }
+    prog->litData[prog->litCount].addr = addr;
+    prog->litData[prog->litCount].value = value;
+    prog->litCount++;
+    if (addr < prog->roLow) prog->roLow = addr;
+    if (addr > prog->roHigh) prog->roHigh = addr;
+    if (addr >= prog->daddrSize) prog->daddrSize = addr + 1;
+}
+
+
 /* clear registers and data memory */
-void clearMachine()
+void clearMachine(MACHINE *vm)
 {
-    int regNo, loc;
+    PROGRAM *prog = vm->prog;
+    int regNo, i;
 
-    iloc = 0;
-    dloc = 0;
-    for (regNo = 0; regNo<NO_REGS; regNo++) reg[regNo] = 0;
+    for (regNo = 0; regNo<NO_REGS; regNo++) vm->reg[regNo] = 0;
+
+    vm->daddrSize = prog->daddrSize;
+    mapDMem(vm);
+    for (i = 0; i<prog->litCount; i++) {
+        vm->dMem[prog->litData[i].addr] = prog->litData[i].value;
+        vm->dMemTag[prog->litData[i].addr] = READONLY;
+    }
+    vm->dMem[0] = vm->daddrSize - 1;
+
+    vm->instrCount = vm->outputInstrCount = 0;
+    vm->tagflag = TRUE;
+    if (profileflag) memset(prog->profCount, 0, (prog->iMemMapped + 1) * sizeof(long long int));
+}
 
-    for (loc = 0; loc<DADDR_SIZE; loc++) {
-	dMem[loc] = 0;
-	dMemTag[loc] = UNUSED;
-        dMemCmt[loc] = (char *)"";
+/* clear registers, data and instruction memory */
+void fullClearMachine(MACHINE *vm)
+{
+    PROGRAM *prog = vm->prog;
+
+    /* fresh instruction memory is all HALTs */
+    prog->litCount = 0;
+    prog->roLow = INT_MAX;
+    prog->roHigh = -1;
+    prog->daddrSize = daddrDefault;
+    mapIMem(prog, iaddrDefault, 0);
+    while (prog->funcCount > 0) free(prog->funcRange[--prog->funcCount].name);
+
+    /* nothing refers to the old object file any more */
+    if (prog->objMap != NULL) {
+        munmap(prog->objMap, prog->objMapSize);
+        prog->objMap = NULL;
+        prog->objMapSize = 0;
     }
-    dMem[0] = DADDR_SIZE - 1;
 
-    dmemStart = dMem[0];
+    /* clear registers and data memory */
+    clearMachine(vm);
+    savedbreakpoint = breakpoint = -1;
+}
+
+
+/* the memory listings start over after a load or clear */
+void clearListings()
+{
+    iloc = 0;
+    dloc = 0;
+    dmemStart = mainMachine.dMem[0];
     dmemCount = 10;
     dmemDown = -1;
     imemStart = 0;
     imemCount = 10;
     imemDown = +1;
-    instrCount = outputInstrCount = 0;
 }
 
-/* clear registers, data and instruction memory */
-void fullClearMachine()
+
+/* note a FUNCTION or END FUNCTION comment line that comes before the
+   instruction at loc, -1 if that is the next instruction loaded */
+void functionComment(PROGRAM *prog, char *text, int loc)
 {
-    int loc;
+    char *name;
+    int len;
 
-    /* clear registers and data memory */
-    clearMachine();
-    savedbreakpoint = breakpoint = -1;
+    while (*text == '*' || *text == ' ' || *text == '\t') text++;
+    if (strncmp(text, "FUNCTION ", 9) == 0) {
+        name = text + 9;
+        if (prog->funcCount == prog->funcCapacity) {
+            prog->funcCapacity = prog->funcCapacity ? 2 * prog->funcCapacity : 64;
+            prog->funcRange = (FUNCRANGE *)realloc(prog->funcRange, prog->funcCapacity * sizeof(FUNCRANGE));
+        }
+        len = strlen(name);
+        while (len > 0 && isspace(name[len - 1])) len--;
+        prog->funcRange[prog->funcCount].name = strndup(name, len);
+        prog->funcRange[prog->funcCount].start = loc;
+        prog->funcRange[prog->funcCount].end = -1;
+        prog->funcCount++;
+    }
+    else if (strncmp(text, "END FUNCTION", 12) == 0 && prog->funcCount > 0) {
+        prog->funcRange[prog->funcCount - 1].end = (loc < 0) ? -2 : loc - 1;
+    }
+}
+
+/* the instruction at loc was loaded, functions waiting for it start or
+   end here.  Only the last few functions can be waiting. */
+void functionLoaded(PROGRAM *prog, int loc)
+{
+    int i;
+
+    for (i = prog->funcCount - 1; i >= 0; i--) {
+        FUNCRANGE *f = &prog->funcRange[i];
+
+        if (f->start != -1 && f->end != -2) break;
+        if (f->start == -1) f->start = loc;
+        if (f->end == -2) f->end = loc - 1;
+    }
+}
+
+/* a function still open at the end of the program ends there */
+void functionsDone(PROGRAM *prog)
+{
+    int i, last;
 
-    /* zero out instruction memory */
-    for (loc = 0; loc<IADDR_SIZE; loc++) {
-	iMem[loc].iop = opHALT;
-	iMem[loc].iarg1 = 0;
-	iMem[loc].iarg2 = 0;
-	iMem[loc].iarg3 = 0;
-	iMem[loc].comment = (char *)"* initially empty";
-	iMemTag[loc] = UNUSED;
+    for (last = prog->iaddrSize - 1; last > 0 && prog->iMemTag[last] != USED; last--);
+    for (i = 0; i < prog->funcCount; i++) {
+        if (prog->funcRange[i].start < 0) prog->funcRange[i].start = last + 1;
+        if (prog->funcRange[i].end < 0) prog->funcRange[i].end = last;
     }
 }
 
 
-int readInstructions(char *fileName)
+/* load a binary object file (see tmobject.h) by mapping it into memory */
+int readObject(MACHINE *vm, char *fileName)
+{
+    PROGRAM *prog = vm->prog;
+    int fd;
+    struct stat st;
+    void *map;
+    TMOHeader *header;
+    TMOInstruction *inst;
+    TMOData *data;
+    char *strings;
+    size_t size;
+    unsigned int i;
+
+    fd = open(fileName, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0) {
+	printf("ERROR(readObject): file '%s' not found\n", fileName);
+        if (fd >= 0) close(fd);
+	return FALSE;
+    }
+    if ((size_t)st.st_size < sizeof(TMOHeader)) {
+        close(fd);
+        return error((char *)"Object file is truncated", 0, -1);
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+	printf("ERROR(readObject): unable to map file '%s'\n", fileName);
+	return FALSE;
+    }
+
+    header = (TMOHeader *)map;
+    size = sizeof(TMOHeader)
+        + (size_t)header->instrCount * sizeof(TMOInstruction)
+        + (size_t)header->dataCount * sizeof(TMOData)
+        + (size_t)header->commentLineCount * sizeof(TMOComment)
+        + header->stringBytes;
+    if (header->magic != TMO_MAGIC || header->version != TMO_VERSION) {
+        munmap(map, st.st_size);
+        return error((char *)"Not a TM object file or wrong version", 0, -1);
+    }
+    if (size != (size_t)st.st_size || header->instrCount > MAX_IADDR_SIZE
+        || (header->stringBytes > 0 && ((char *)map)[size - 1] != '\0')) {
+        munmap(map, st.st_size);
+        return error((char *)"Object file is corrupt", 0, -1);
+    }
+    if (!batchflag) printf("Loading file: %s\n", fileName);
+
+    /* clear the way for the new program */
+    fullClearMachine(vm);
+
+    inst = (TMOInstruction *)(header + 1);
+    data = (TMOData *)(inst + header->instrCount);
+    strings = (char *)((TMOComment *)(data + header->dataCount) + header->commentLineCount);
+
+    /* load program */
+    if ((int)header->instrCount > prog->iaddrSize) growIMem(prog, header->instrCount - 1);
+    for (i = 0; i < header->instrCount; i++) {
+        if (inst[i].op == TMO_UNUSED) continue;
+        if (inst[i].op < 0 || inst[i].op >= opRALim || inst[i].op == opRRLim
+            || inst[i].arg1 < 0 || inst[i].arg1 >= NO_REGS
+            || inst[i].arg3 < 0 || inst[i].arg3 >= NO_REGS
+            || (opClass(inst[i].op) == opclRR && (inst[i].arg2 < 0 || inst[i].arg2 >= NO_REGS))
+            || inst[i].comment >= (int32_t)header->stringBytes) {
+            munmap(map, st.st_size);
+            return error((char *)"Bad instruction in object file", 0, i);
+        }
+        prog->iMem[i].iop = inst[i].op;
+        prog->iMem[i].iarg1 = inst[i].arg1;
+        prog->iMem[i].iarg2 = inst[i].arg2;
+        prog->iMem[i].iarg3 = inst[i].arg3;
+        prog->iMem[i].comment = (commentsflag && inst[i].comment >= 0) ? strings + inst[i].comment : emptyString;
+        prog->iMemTag[i] = USED;
+    }
+
+    /* functions for the profile */
+    if (header->flags & TMO_HAS_COMMENTS) {
+        TMOComment *lines = (TMOComment *)(data + header->dataCount);
+
+        for (i = 0; i < header->commentLineCount; i++) {
+            if (lines[i].text >= 0 && lines[i].text < (int32_t)header->stringBytes) {
+                functionComment(prog, strings + lines[i].text, lines[i].loc);
+            }
+        }
+        functionsDone(prog);
+    }
+
+    /* load the LIT data segment */
+    for (i = 0; i < header->dataCount; i++) {
+        if (data[i].addr < 0 || data[i].addr >= INT_MAX) {
+            munmap(map, st.st_size);
+            return error((char *)"Bad data address in object file", 0, -1);
+        }
+        setLit(prog, data[i].addr, data[i].value);
+    }
+
+    /* only keep the mapping while comments point into it */
+    if (commentsflag) {
+        prog->objMap = map;
+        prog->objMapSize = st.st_size;
+    }
+    else munmap(map, st.st_size);
+
+    clearMachine(vm);    // with the LIT data in place
+    return TRUE;
+}				/* readObject */
+
+
+int readInstructions(MACHINE *vm, char *fileName)
 {
+    PROGRAM *prog = vm->prog;
     FILE *pgm;
     OPCODE op;
     long long int arg1, arg2, arg3;
     int loc, lineNo;
     char errorString[128];
+    uint32_t magic;
+    int wordset;  // bool that says if word was set last (truly horrible, needs total rewrite)
 
     /* load program */
     if (*fileName!='\0') strcpy(pgmName, fileName);
@@ -787,56 +1205,64 @@ int readInstructions(char *fileName)
 	printf("ERROR(readInstructions): file '%s' not found\n", pgmName);
 	return FALSE;
     }
-    printf("Loading file: %s\n", pgmName);
+
+    /* binary object files are mapped rather than parsed */
+    if (fread(&magic, sizeof(magic), 1, pgm) == 1 && magic == TMO_MAGIC) {
+        fclose(pgm);
+        return readObject(vm, pgmName);
+    }
+    rewind(pgm);
+    if (!batchflag) printf("Loading file: %s\n", pgmName);
 
     /* clear the way for the new program */
-    fullClearMachine();
+    fullClearMachine(vm);
 
     /* load program */
     lineNo = 0;
     loc = -1;   /* fist location to load is 0 */
     /* get line */
-    fgets(in_Line, LINESIZE - 2, pgm);
+    fgets(vm->in_Line, LINESIZE - 2, pgm);
     while (!feof(pgm)) {
         /* process line */
-	inCol = 0;
+	vm->inCol = 0;
 	lineNo++;
-	lineLen = strlen(in_Line) - 1;
-	if (in_Line[lineLen] == '\n')
-	    in_Line[lineLen] = '\0';
+	vm->lineLen = strlen(vm->in_Line) - 1;
+	if (vm->in_Line[vm->lineLen] == '\n')
+	    vm->in_Line[vm->lineLen] = '\0';
 	else
-	    in_Line[++lineLen] = '\0';
+	    vm->in_Line[++vm->lineLen] = '\0';
 
         /* process an instruction */
-	if ((nonBlank()) && (in_Line[inCol] != '*')) {
+	if ((nonBlank(vm)) && (vm->in_Line[vm->inCol] != '*')) {
             /* get address */
-	    if (getNum()) {
-                loc = num;
+	    if (getNum(vm)) {
+                loc = vm->num;
 
                 /* colon after address */
-                if (!skipCh(':')) {
+                if (!skipCh(vm, ':')) {
                     return error((char *)"Missing colon", lineNo, loc);
                 }
             }
             else {   /* if no address given then just increment counter */
                 loc++;
             }
-	    if (loc<0 || loc>=IADDR_SIZE) {
+	    if (loc<0 || loc>=MAX_IADDR_SIZE) {
                 printf("ERROR(readInstructions): at line %d attempting to set out of bounds instruction memory at loc: %d\n", lineNo, loc);
                 exit(1);
             }
+            if (loc>=prog->iaddrSize) growIMem(prog, loc);
 
             /* get op code */
-	    if (!getWord())
+	    if (!getWord(vm))
 		return error((char *)"Missing opcode", lineNo, loc);
 
             { int opcnt;
 
                 for (opcnt = 0; opcnt<(int)opEND; opcnt++) {
-                    if (strncmp(opCodeTab[opcnt], word, 4) == 0) break;
+                    if (strncmp(opCodeTab[opcnt], vm->word, 4) == 0) break;
                 }
                 if (opcnt>=(int)opEND) {
-                    sprintf(errorString, (char *)"Illegal opcode: %s", word);
+                    sprintf(errorString, (char *)"Illegal opcode: %s", vm->word);
                     return error(errorString, lineNo, loc);
                 }
 		op = (OPCODE)opcnt;
@@ -845,46 +1271,46 @@ int readInstructions(char *fileName)
             /* process args to op code */
             arg1 = arg2 = arg3 = 0;
             if (op==opHALT || op==opNOP) {
-                uptoComment();
+                uptoComment(vm);
             }
             else {
                 switch (opClass(op)) {
                 case opclRR:
                     /***********************************/
                     /* arg 1 */
-                    if ((!getNum()) || (num<0) || (num >= NO_REGS))
+                    if ((!getNum(vm)) || (vm->num<0) || (vm->num >= NO_REGS))
                         return error((char *)"Bad first register", lineNo, loc);
-                    arg1 = num;
-                    if (!skipCh(','))
+                    arg1 = vm->num;
+                    if (!skipCh(vm, ','))
                         return error((char *)"Missing comma", lineNo, loc);
 
                     /* arg 2 */
-                    if ((!getNum()) || (num<0) || (num >= NO_REGS))
+                    if ((!getNum(vm)) || (vm->num<0) || (vm->num >= NO_REGS))
                         return error((char *)"Bad second register", lineNo, loc);
-                    arg2 = num;
-                    if (!skipCh(','))
+                    arg2 = vm->num;
+                    if (!skipCh(vm, ','))
                         return error((char *)"Missing comma", lineNo, loc);
 
                     /* arg 3 */
-                    if ((!getNum()) || (num<0) || (num >= NO_REGS))
+                    if ((!getNum(vm)) || (vm->num<0) || (vm->num >= NO_REGS))
                         return error((char *)"Bad third register", lineNo, loc);
-                    arg3 = num;
+                    arg3 = vm->num;
                     break;
 
                 case opclRA:
                     /***********************************/
                     /* arg 1 */
-                    if (!getNum() || ((num<0) || (num >= NO_REGS)))
+                    if (!getNum(vm) || ((vm->num<0) || (vm->num >= NO_REGS)))
                         return error((char *)"Bad first register", lineNo, loc);
-                    arg1 = num;
-                    if (!skipCh(','))
+                    arg1 = vm->num;
+                    if (!skipCh(vm, ','))
                         return error((char *)"Missing comma", lineNo, loc);
 
                     /* arg 2 */
-                    if (!getNumOrChar())
+                    if (!getNumOrChar(vm))
                         return error((char *)"Bad displacement", lineNo, loc);
-                    arg2 = num;
-                    if (!skipCh('(') && !skipCh(',')) {
+                    arg2 = vm->num;
+                    if (!skipCh(vm, '(') && !skipCh(vm, ',')) {
                         if (op==opLDC) {
                             break;
                         }
@@ -892,13 +1318,13 @@ int readInstructions(char *fileName)
                     }
 
                     /* arg 3 */
-                    if ((!getNum()) || (num<0) || (num >= NO_REGS))
+                    if ((!getNum(vm)) || (vm->num<0) || (vm->num >= NO_REGS))
                         return error((char *)"Bad second register", lineNo, loc);
-                    arg3 = num;
+                    arg3 = vm->num;
                     break;
                 case opclLIT:
-                    nonBlank();
-                    (wordset = getString()) || getNum() || getChar();
+                    nonBlank(vm);
+                    (wordset = getString(vm)) || getNum(vm) || getChar(vm);
                     break;
                 }
                 
@@ -907,32 +1333,33 @@ int readInstructions(char *fileName)
                 if (wordset) {
                     int len, k;
 
-                    len = strlen(word);
+                    len = strlen(vm->word);
                     for (k=0; k<len; k++) {
-                        setDMem(loc-k, word[k]);
-                        dMemTag[loc-k] = READONLY;
+                        setLit(prog, loc-k, vm->word[k]);
                     }
-                    setDMem(loc+1, len);
-                    dMemTag[loc+1] = READONLY;
+                    setLit(prog, loc+1, len);
                 }
                 else {
-                    setDMem(loc, num);
-                    dMemTag[loc] = READONLY;
+                    setLit(prog, loc, vm->num);
                 }
             }
             else {
-                iMem[loc].iop = op;
-                iMem[loc].iarg1 = arg1;
-                iMem[loc].iarg2 = arg2;
-                iMem[loc].iarg3 = arg3;
-                iMem[loc].comment = getRemaining();
-                iMemTag[loc] = USED;     /* correctly counts assignments to same loc  */
+                prog->iMem[loc].iop = op;
+                prog->iMem[loc].iarg1 = arg1;
+                prog->iMem[loc].iarg2 = arg2;
+                prog->iMem[loc].iarg3 = arg3;
+                prog->iMem[loc].comment = commentsflag ? getRemaining(vm) : emptyString;
+                prog->iMemTag[loc] = USED;     /* correctly counts assignments to same loc  */
+                functionLoaded(prog, loc);
             }
 	}
+        else if (nonBlank(vm)) functionComment(prog, &vm->in_Line[vm->inCol], -1);
 
         /* get next line */
-        fgets(in_Line, LINESIZE - 2, pgm);
+        fgets(vm->in_Line, LINESIZE - 2, pgm);
     }
+    functionsDone(prog);
+    clearMachine(vm);    // with the LIT data in place
     return TRUE;
 }				/* readInstructions */
 
@@ -941,50 +1368,34 @@ int readInstructions(char *fileName)
 
 /********************************************/
 
-int outputLimitFail()
+int outputLimitFail(MACHINE *vm)
 {
-    outputInstrCount++;
-    if (outputInstrCount>outputLimit && outputLimit!=0) return 1;
+    vm->outputInstrCount++;
+    if (vm->outputInstrCount>outputLimit && outputLimit!=0) return 1;
     return 0;
 }
 
 
-STEPRESULT stepTM(void)
+/* execute one instruction, the pc register must already point past it */
+STEPRESULT executeInstruction(MACHINE *vm, INSTRUCTION *currentinstruction)
 {
-    INSTRUCTION currentinstruction;
     long long int r, s, t, d, m;
     int ok;
 
-    pc = reg[PC_REG];
-    if ((pc<0) || (pc>=IADDR_SIZE))
-	return srIMEM_ERR;
-
-    if (pc == breakpoint) {
-	savedbreakpoint = breakpoint;
-	breakpoint = -1;
-	return srHALT;
-    }
-    breakpoint = savedbreakpoint;
-
-    lastpc = pc;
-    reg[PC_REG] = pc + 1;
-    currentinstruction = iMem[pc];
-    instrCount++;
-
     /* get the args to the instruction */
-    if (opClass(currentinstruction.iop) == opclRR) {
-        r = currentinstruction.iarg1;
-        s = currentinstruction.iarg2;
-        t = currentinstruction.iarg3;
+    if (opClass(currentinstruction->iop) == opclRR) {
+        r = currentinstruction->iarg1;
+        s = currentinstruction->iarg2;
+        t = currentinstruction->iarg3;
     }
     else {  /* note s changes its position */
-	r = currentinstruction.iarg1;
-        d = currentinstruction.iarg2;
-	s = currentinstruction.iarg3;
-	m = currentinstruction.iarg2 + reg[s];
+	r = currentinstruction->iarg1;
+        d = currentinstruction->iarg2;
+	s = currentinstruction->iarg3;
+	m = currentinstruction->iarg2 + vm->reg[s];
     }
 
-    switch (currentinstruction.iop) {
+    switch (currentinstruction->iop) {
 	/* RR instructions */
     case opHALT:
         /***********************************/
@@ -997,181 +1408,181 @@ STEPRESULT stepTM(void)
     case opIN:
         /***********************************/
 	do {
-	    if (promptflag) printf("Enter integer value: ");
-	    fflush(stdin);
-	    fflush(stdout);
+	    if (promptflag) fprintf(vm->out, "Enter integer value: ");
+	    fflush(vm->in);
+	    fflush(vm->out);
 
-            fgets(in_Line, LINESIZE - 2, stdin);
+            fgets(vm->in_Line, LINESIZE - 2, vm->in);
             {
                 char *p;
 
-                for (p=in_Line; *p; p++) {
+                for (p=vm->in_Line; *p; p++) {
                     if (*p=='\n') {
                         *p='\0';
                         break;
                     }
                 }
-                lineLen = p-in_Line;
+                vm->lineLen = p-vm->in_Line;
             }
 
-	    if (!promptflag) printf("entered: %s\n", in_Line);
+	    if (!promptflag && !batchflag) fprintf(vm->out, "entered: %s\n", vm->in_Line);
 
-	    inCol = 0;
-	    ok = getNum();
+	    vm->inCol = 0;
+	    ok = getNum(vm);
 	    if (!ok) {
-		printf("Illegal value in input: \"%s\"\n", in_Line);
-                exit(1);
+		fprintf(vm->out, "Illegal value in input: \"%s\"\n", vm->in_Line);
+                machineFault(vm, srINPUT_ERR);
             }
 	    else {
-		reg[r] = num;
+		vm->reg[r] = vm->num;
             }
 	}
 	while (!ok);
-	if (skipCh('#')) return srHALT;
+	if (skipCh(vm, '#')) return srHALT;
 	break;
 
     case opINB:
         /***********************************/
-	if (promptflag) printf("Enter Boolean value: ");
-	fflush(stdin);
-	fflush(stdout);
+	if (promptflag) fprintf(vm->out, "Enter Boolean value: ");
+	fflush(vm->in);
+	fflush(vm->out);
 
-	fgets(in_Line, LINESIZE - 2, stdin);
+	fgets(vm->in_Line, LINESIZE - 2, vm->in);
 	{
 	    char *p;
 
-	    for (p=in_Line; *p; p++) {
+	    for (p=vm->in_Line; *p; p++) {
 		if (*p=='\n') {
 		    *p='\0';
 		    break;
 		}
 	    }
-	    lineLen = p-in_Line;
+	    vm->lineLen = p-vm->in_Line;
 	}
 
-	if (!promptflag) printf("entered: %s\n", in_Line);
+	if (!promptflag && !batchflag) fprintf(vm->out, "entered: %s\n", vm->in_Line);
 
-	inCol = 0;
-	getBool();
-	reg[r] = num;
-	if (skipCh('#')) return srHALT;
+	vm->inCol = 0;
+	getBool(vm);
+	vm->reg[r] = vm->num;
+	if (skipCh(vm, '#')) return srHALT;
 	break;
 
     case opINC:
         /***********************************/
-	fflush(stdin);
-	fflush(stdout);
+	fflush(vm->in);
+	fflush(vm->out);
 
-        while (inCol+1>=lineLen) {
+        while (vm->inCol+1>=vm->lineLen) {
             char *p;
 
-	    if (promptflag) printf("Enter characters: ");
-            fgets(in_Line, LINESIZE - 2, stdin);
+	    if (promptflag) fprintf(vm->out, "Enter characters: ");
+            fgets(vm->in_Line, LINESIZE - 2, vm->in);
 
-            for (p=in_Line; *p; p++) {
+            for (p=vm->in_Line; *p; p++) {
                 if (*p=='\n') {
                     *p='\0';
                     break;
                 }
             }
-            lineLen = p-in_Line;
-            inCol = -1;
+            vm->lineLen = p-vm->in_Line;
+            vm->inCol = -1;
         }
 
-        if (getCh()) {
-            reg[r] = ch;
+        if (getCh(vm)) {
+            vm->reg[r] = vm->ch;
         }
 
 	break;
 
     case opOUT:
-        if (outputLimitFail()) return srOUTPUTLIMIT_ERR;
-	printf("%lld ", reg[r]);
-        fflush(stdout);
+        if (outputLimitFail(vm)) return srOUTPUTLIMIT_ERR;
+	fprintf(vm->out, "%lld ", vm->reg[r]);
+        fflush(vm->out);
 	break;
 
     case opOUTB:
-        if (outputLimitFail()) return srOUTPUTLIMIT_ERR;
-	if (reg[r]) printf("T ");
-	else printf("F ");
-        fflush(stdout);
+        if (outputLimitFail(vm)) return srOUTPUTLIMIT_ERR;
+	if (vm->reg[r]) fprintf(vm->out, "T ");
+	else fprintf(vm->out, "F ");
+        fflush(vm->out);
 	break;
 
     case opOUTC:
-        if (outputLimitFail()) return srOUTPUTLIMIT_ERR;
-	printf("%c", char(reg[r]));
-        fflush(stdout);
+        if (outputLimitFail(vm)) return srOUTPUTLIMIT_ERR;
+	fprintf(vm->out, "%c", char(vm->reg[r]));
+        fflush(vm->out);
 	break;
 
     case opOUTNL:
-        if (outputLimitFail()) return srOUTPUTLIMIT_ERR;
-	printf("\n");
-        fflush(stdout);
+        if (outputLimitFail(vm)) return srOUTPUTLIMIT_ERR;
+	fprintf(vm->out, "\n");
+        fflush(vm->out);
 	break;
 
     case opADD:
-	reg[r] = reg[s] + reg[t];
+	vm->reg[r] = vm->reg[s] + vm->reg[t];
 	break;
 
     case opSUB:
-	reg[r] = reg[s] - reg[t];
+	vm->reg[r] = vm->reg[s] - vm->reg[t];
 	break;
 
     case opMUL:
-	reg[r] = reg[s]*reg[t];
+	vm->reg[r] = vm->reg[s]*vm->reg[t];
 	break;
 
     case opDIV:
-	if (reg[t] != 0)
-	    reg[r] = reg[s]/reg[t];
+	if (vm->reg[t] != 0)
+	    vm->reg[r] = vm->reg[s]/vm->reg[t];
 	else
 	    return srZERODIVIDE;
 	break;
 
     case opMOD:
-	if (reg[t] != 0) {
+	if (vm->reg[t] != 0) {
             long long int tmp;  // r may equal t
 
-	    tmp = reg[s]%reg[t];
-            if (tmp<0) tmp += llabs(reg[t]);  // always return a nonnegative answer
-	    reg[r] = tmp;
+	    tmp = vm->reg[s]%vm->reg[t];
+            if (tmp<0) tmp += llabs(vm->reg[t]);  // always return a nonnegative answer
+	    vm->reg[r] = tmp;
         }
 	else
 	    return srZERODIVIDE;
 	break;
 
     case opAND:
-	reg[r] = reg[s]&reg[t];
+	vm->reg[r] = vm->reg[s]&vm->reg[t];
 	break;
 
     case opOR:
-	reg[r] = reg[s]|reg[t];
+	vm->reg[r] = vm->reg[s]|vm->reg[t];
 	break;
 
     case opXOR:
-	reg[r] = reg[s]^reg[t];
+	vm->reg[r] = vm->reg[s]^vm->reg[t];
 	break;
 
     case opNOT:
-	reg[r] = ~reg[s];
+	vm->reg[r] = ~vm->reg[s];
 	break;
 
     case opNEG:
-	reg[r] = -reg[s];
+	vm->reg[r] = -vm->reg[s];
 	break;
 
     case opSWP:
-        if (reg[r]>reg[s]) {
+        if (vm->reg[r]>vm->reg[s]) {
             long long int tmp;
-            tmp = reg[r];
-            reg[r] = reg[s];
-            reg[s] = tmp;
+            tmp = vm->reg[r];
+            vm->reg[r] = vm->reg[s];
+            vm->reg[s] = tmp;
         }
 	break;
 
     case opRND:
-	if (reg[s] != 0)
-            reg[r] = random()%abs(reg[s]);
+	if (vm->reg[s] != 0)
+            vm->reg[r] = random()%abs(vm->reg[s]);
 	else
 	    return srZERODIVIDE;
 	break;
@@ -1180,10 +1591,10 @@ STEPRESULT stepTM(void)
         int raddr, saddr;
         int i;
 
-        raddr = reg[r];
-        saddr = reg[s];
-        for (i=0; i<reg[t]; i++) {
-            setDMem(raddr, getDMem(saddr));
+        raddr = vm->reg[r];
+        saddr = vm->reg[s];
+        for (i=0; i<vm->reg[t]; i++) {
+            setDMem(vm, raddr, getDMem(vm, saddr));
             raddr--;
             saddr--;
         }
@@ -1194,10 +1605,10 @@ STEPRESULT stepTM(void)
         int raddr, svalue;
         int i;
 
-        raddr = reg[r];
-        svalue = reg[s];
-        for (i=0; i<reg[t]; i++) {
-            setDMem(raddr, svalue);
+        raddr = vm->reg[r];
+        svalue = vm->reg[s];
+        for (i=0; i<vm->reg[t]; i++) {
+            setDMem(vm, raddr, svalue);
             raddr--;
         }
     }
@@ -1211,12 +1622,12 @@ STEPRESULT stepTM(void)
         int raddr, saddr;
 	int i;
 
-        raddr = reg[r];
-        saddr = reg[s];
-        for (i=0; i<reg[t]; i++) {
-            reg[5] = getDMem(raddr);
-            reg[6] = getDMem(saddr);
-            if (reg[5] != reg[6]) break;
+        raddr = vm->reg[r];
+        saddr = vm->reg[s];
+        for (i=0; i<vm->reg[t]; i++) {
+            vm->reg[5] = getDMem(vm, raddr);
+            vm->reg[6] = getDMem(vm, saddr);
+            if (vm->reg[5] != vm->reg[6]) break;
             raddr--;
             saddr--;
         }
@@ -1229,12 +1640,12 @@ STEPRESULT stepTM(void)
         int raddr, saddr;
 	int i;
 
-        raddr = reg[r];
-        saddr = reg[s];
-        for (i=0; i<reg[t]; i++) {
-            reg[5] = raddr;
-            reg[6] = saddr;
-            if (getDMem(raddr) != getDMem(saddr)) break;
+        raddr = vm->reg[r];
+        saddr = vm->reg[s];
+        for (i=0; i<vm->reg[t]; i++) {
+            vm->reg[5] = raddr;
+            vm->reg[6] = saddr;
+            if (getDMem(vm, raddr) != getDMem(vm, saddr)) break;
             raddr--;
             saddr--;
         }
@@ -1243,176 +1654,1318 @@ STEPRESULT stepTM(void)
 
         /*************** RA instructions ********************/
     case opLD:
-	reg[r] = getDMem(m);
+	vm->reg[r] = getDMem(vm, m);
 	break;
     case opST:
-        setDMem(m, reg[r]);
+        setDMem(vm, m, vm->reg[r]);
 	break;
     case opLDA:
-	reg[r] = m;
+	vm->reg[r] = m;
 	break;
     case opLDC:
-	reg[r] = d;
+	vm->reg[r] = d;
 	break;
     case opTLT:
-        reg[r] = (reg[s]<reg[t] ? 1 : 0);
+        vm->reg[r] = (vm->reg[s]<vm->reg[t] ? 1 : 0);
 	break;
     case opSLT:
-        if (reg[r]>=0) reg[r] = (reg[s]<reg[t] ? 1 : 0);
-        else reg[r] = (-reg[s] < -reg[t] ? 1 : 0);
+        if (vm->reg[r]>=0) vm->reg[r] = (vm->reg[s]<vm->reg[t] ? 1 : 0);
+        else vm->reg[r] = (-vm->reg[s] < -vm->reg[t] ? 1 : 0);
 	break;
     case opTGT:
-        reg[r] = (reg[s]>reg[t] ? 1 : 0);
+        vm->reg[r] = (vm->reg[s]>vm->reg[t] ? 1 : 0);
 	break;
     case opSGT:
-        if (reg[r]>=0) reg[r] = (reg[s]>reg[t] ? 1 : 0);
-        else reg[r] = (-reg[s] > -reg[t] ? 1 : 0);
+        if (vm->reg[r]>=0) vm->reg[r] = (vm->reg[s]>vm->reg[t] ? 1 : 0);
+        else vm->reg[r] = (-vm->reg[s] > -vm->reg[t] ? 1 : 0);
 	break;
     case opTLE:
-        reg[r] = (reg[s]<=reg[t] ? 1 : 0);
+        vm->reg[r] = (vm->reg[s]<=vm->reg[t] ? 1 : 0);
 	break;
     case opTGE:
-        reg[r] = (reg[s]>=reg[t] ? 1 : 0);
+        vm->reg[r] = (vm->reg[s]>=vm->reg[t] ? 1 : 0);
 	break;
     case opTEQ:
-        reg[r] = (reg[s]==reg[t] ? 1 : 0);
+        vm->reg[r] = (vm->reg[s]==vm->reg[t] ? 1 : 0);
 	break;
     case opTNE:
-        reg[r] = (reg[s]!=reg[t] ? 1 : 0);
+        vm->reg[r] = (vm->reg[s]!=vm->reg[t] ? 1 : 0);
 	break;
     case opJZR:
-	if (reg[r] == 0)
-	    reg[PC_REG] = m;
+	if (vm->reg[r] == 0)
+	    vm->reg[PC_REG] = m;
 	break;
     case opJNZ:
-	if (reg[r] != 0)
-	    reg[PC_REG] = m;
+	if (vm->reg[r] != 0)
+	    vm->reg[PC_REG] = m;
 	break;
     case opJMP:
-        reg[PC_REG] = m;
+        vm->reg[PC_REG] = m;
 	break;
 
 	/* end of legal instructions */
     }				/* case */
     return srOKAY;
-}				/* stepTM */
+}				/* executeInstruction */
 
 
+/* execute the instruction at the pc */
+STEPRESULT stepMachine(MACHINE *vm)
+{
+    PROGRAM *prog = vm->prog;
 
+    vm->pc = vm->reg[PC_REG];
+    if ((vm->pc<0) || (vm->pc>=prog->iaddrSize))
+	return srIMEM_ERR;
 
-/********************************************/
-void usage()
-{
-    printf("%s\n", versionNumber);
-    printf("\nCommands are:\n");
-    printf(" a(bortLimit <<n>>  Maximum number of instructions between halts (default is %d).\n", DEFAULT_ABORT_LIMIT);
-    printf(" b(reakpoint <<n>>  Set a breakpoint for instr n.  No n means clear breakpoints.\n");
-    printf(" c(lear             Reset TM for new execution of program\n");
-    printf(" d(Mem <b <n>>      Print n dMem locations (counting down) starting at b (n can be negative to count up). No args means all used memory locations.\n");
-    printf(" e(xecStats         Print execution statistics since last load or clear\n");
-    printf(" g(o                Execute TM instructions until HALT\n");
-    printf(" h(elp              Cause this list of commands to be printed\n");
-    printf(" i(Mem <b <n>>      Print n iMem locations (counting up) starting at b.  No args means all used memory locations.\n");
-    printf(" l(oad filename     Load filename into memory (default is last file)\n");
-    printf(" n(ext              Print the next command that will be executed\n");
-    printf(" o(utputLimit <<n>> Maximum combined number of calls to any output instruction (default is %d)\n", DEFAULT_OUTPUT_LIMIT);
-    printf(" p(rint             Toggle printing of total number instructions executed ('go' only)\n");
-    printf(" q(uit              Terminate TM\n");
-    printf(" r(egs              Print the contents of the registers\n");
-    printf(" s(tep <n>          Execute n (default 1) TM instructions\n");
-    printf(" t(race             Toggle instruction tracing (printing) during execution\n");
-    printf(" u(nprompt)         Unprompted for script input\n");
-    printf(" v                  Print the version information\n");
-    printf(" x(it               Terminate TM\n");
-    printf(" = <r> <n>          Set register number r to value n (e.g. set the pc)\n");
-    printf(" < <addr> <value>   Set dMem at addr to value\n");
-    printf(" (empty line does a step)\n");
-    printf("Also a # character placed after input will cause TM to halt\n  after processing the IN or INB commands (e.g. 34#  or f# )\n");
-}
+    vm->lastpc = vm->pc;
+    vm->reg[PC_REG] = vm->pc + 1;
+    vm->instrCount++;
+    if (profileflag) prog->profCount[vm->pc]++;
 
+    return executeInstruction(vm, &prog->iMem[vm->pc]);
+}				/* stepMachine */
 
 
-int doCommand(void)
+STEPRESULT stepTM(MACHINE *vm)
 {
-    char cmd;
-    int i;
-    int printcnt;
-    int stepResult;
-    int loc;
+    vm->pc = vm->reg[PC_REG];
+    if ((vm->pc<0) || (vm->pc>=vm->prog->iaddrSize))
+	return srIMEM_ERR;
 
-    stepcnt = 0;
-    do {
-	if (promptflag) printf("Enter command: ");
-	fflush(stdin);
-	fflush(stdout);
+    if (vm->pc == breakpoint) {
+	savedbreakpoint = breakpoint;
+	breakpoint = -1;
+	return srHALT;
+    }
+    breakpoint = savedbreakpoint;
 
-	fgets(in_Line, LINESIZE - 2, stdin);
-	if (feof(stdin)) {
-	    word[0] = 'q';
-	    word[1] = '\0';
-	    break;
-	}
+    return stepMachine(vm);
+}				/* stepTM */
 
-	{
-	    char *p;
 
-	    for (p=in_Line; *p; p++) {
-		if (*p=='\n') {
-		    *p='\0';
-		    break;
-		}
-	    }
-	    lineLen = p-in_Line;
-	}
-	inCol = 0;
-    }
-    while ((lineLen>0) && !getWord());
 
-    if (lineLen==0) {
-        word[0] = 's';
-        word[1] = '\0';
+/********************************************/
+/* The fast engine.  iMem is predecoded into dCode with the address
+   of the code for each instruction and executed with computed goto.
+   The common instructions are done inline.  Anything rare or that
+   writes the pc other than a jump goes through executeInstruction.
+   There are no breakpoints or tracing here: stepTM is the debugging
+   path. */
+
+/* true if the instruction may change the pc other than as a jump */
+int writesPC(INSTRUCTION *in)
+{
+    switch (in->iop) {
+    case opJZR:
+    case opJNZ:
+    case opJMP:
+    case opST:
+    case opOUT:
+    case opOUTB:
+    case opOUTC:
+    case opOUTNL:
+    case opMOV:
+    case opSET:
+    case opCO:
+    case opCOA:
+        return FALSE;
+    case opSWP:
+        return in->iarg1 == PC_REG || in->iarg2 == PC_REG;
+    default:
+        return in->iarg1 == PC_REG;
     }
+}
 
-    if (! promptflag) printf("command: %s\n", in_Line);
-
-    cmd = word[0];
-    switch (cmd) {
-    case 'l':
-        /***********************************/
-	if (!getWord()) *word = '\0';
-	readInstructions(word);
-	break;
 
-    case 't':
-        /***********************************/
-	traceflag = !traceflag;
-	printf("Tracing now ");
-	if (traceflag)
-	    printf("on.\n");
-	else
-	    printf("off.\n");
-	break;
+/* run from the pc until something other than srOKAY happens or limit
+   steps have been made (0 means no limit).  The result and the steps
+   counted are the same as for calling stepTM that many times.
 
-        /***********************************/
-    case 'u':
-//        printf("\n");
-	promptflag = FALSE;
-	break;
+   The FAST engine keeps only the semantics: no step count or limit
+   and no memory tags.  Stores still check bounds and read only
+   memory, the tags are only looked at when a store falls in the
+   range of the LIT data. */
+template <bool FAST, bool PROFILE>
+STEPRESULT runEngine(MACHINE *vm, int limit, int *steps)
+{
+    static void *handlers[opEND];
+    PROGRAM *prog = vm->prog;
+    long long int *reg = vm->reg;
+    long long int *dMem = vm->dMem;
+    int *dMemTag = vm->dMemTag;
+    int daddrSize = vm->daddrSize;
+    int iaddrSize = prog->iaddrSize;
+    int roLow = prog->roLow, roHigh = prog->roHigh;
+    long long int *profCount = prog->profCount;
+    DECODED *dCode = prog->dCode;
+    DECODED *ip, *last;
+    long long int m;
+    int count, executed;
+    STEPRESULT result;
+
+#define LOC(p)  ((p) - dCode)
+#define COUNT   if (!FAST) {                                          \
+                    if (count == limit) goto done;                    \
+                    count++;                                          \
+                    last = ip;                                        \
+                    if (PROFILE) profCount[LOC(ip)]++;                \
+                }                                                     \
+                reg[PC_REG] = LOC(ip) + 1
+#define NEXT    do { COUNT; goto *ip->handler; } while (0)
+#define STEP    do { ip++; COUNT; } while (0)   // on to the next part of a superinstruction
+#define DO_LD   m = ip->d + reg[ip->s];                               \
+                if (m < 0 || m >= daddrSize) vm->pc = LOC(ip);  /* getDMem reports the fault */ \
+                reg[ip->r] = getDMem(vm, m)
+#define DO_ST   m = ip->d + reg[ip->s];                               \
+                if (FAST && m >= 0 && m < daddrSize && (m < roLow || m > roHigh || dMemTag[m] != READONLY)) { \
+                    dMem[m] = reg[ip->r];                             \
+                }                                                     \
+                else {                                                \
+                    vm->pc = LOC(ip);                                 \
+                    setDMem(vm, m, reg[ip->r]);  /* also reports any fault */ \
+                }
+#define DO_LDA  reg[ip->r] = ip->d + reg[ip->s]
+#define DO_LDC  reg[ip->r] = ip->d
+#define JUMP(a) do { m = (a);                                         \
+                     reg[PC_REG] = m;                                 \
+                     if (m < 0 || m >= iaddrSize) goto imemErr;       \
+                     ip = dCode + m;                                  \
+                     NEXT; } while (0)
+
+    if (handlers[opHALT] == NULL) {
+        int op;
+
+        for (op = 0; op < opEND; op++) handlers[op] = &&generic;
+        handlers[opHALT] = &&halt;
+        handlers[opNOP] = &&nop;
+        handlers[opADD] = &&add;
+        handlers[opSUB] = &&sub;
+        handlers[opMUL] = &&mul;
+        handlers[opDIV] = &&divide;
+        handlers[opMOD] = &&mod;
+        handlers[opAND] = &&andOp;
+        handlers[opOR] = &&orOp;
+        handlers[opXOR] = &&xorOp;
+        handlers[opNOT] = &&notOp;
+        handlers[opNEG] = &&neg;
+        handlers[opTLT] = &&tlt;
+        handlers[opTLE] = &&tle;
+        handlers[opTGT] = &&tgt;
+        handlers[opTGE] = &&tge;
+        handlers[opTEQ] = &&teq;
+        handlers[opTNE] = &&tne;
+        handlers[opLD] = &&ld;
+        handlers[opST] = &&st;
+        handlers[opLDA] = &&lda;
+        handlers[opLDC] = &&ldc;
+        handlers[opJZR] = &&jzr;
+        handlers[opJNZ] = &&jnz;
+        handlers[opJMP] = &&jmp;
+    }
 
-        /***********************************/
-    case 'v':
-        printVersion();
-	break;
+    /* superinstructions: sequences of plain handlers that run in one
+       dispatch.  Jumps into the middle of one still find the plain
+       handlers there. */
+    static void *fuse3[][4] = {
+        {&&ld, &&ld, &&jmp, &&ldLdJmp},        // return
+        {&&lda, &&lda, &&jmp, &&ldaLdaJmp},    // move the frame and call
+        {NULL, NULL, NULL, NULL}
+    };
+    static void *fuse2[][3] = {
+        {&&lda, &&jmp, &&ldaJmp},              // call
+        {&&ld, &&st, &&ldSt},                  // push or store a variable
+        {&&ldc, &&st, &&ldcSt},                // push or store a constant
+        {&&lda, &&st, &&ldaSt},                // push or store what a call returned
+        {&&st, &&ld, &&stLd},
+        {&&st, &&ldc, &&stLdc},
+        {&&st, &&lda, &&stLda},
+        {&&ldc, &&ld, &&ldcLd},                // constant right operand, pop the left
+        {&&ld, &&ld, &&ldLd},                  // variable right operand, pop the left
+        {&&ld, &&add, &&ldAdd},                // pop the left operand and operate
+        {&&ld, &&sub, &&ldSub},
+        {&&ld, &&mul, &&ldMul},
+        {&&ld, &&divide, &&ldDivide},
+        {&&ld, &&mod, &&ldMod},
+        {&&ld, &&andOp, &&ldAnd},
+        {&&ld, &&orOp, &&ldOr},
+        {&&ld, &&tlt, &&ldTlt},
+        {&&ld, &&tle, &&ldTle},
+        {&&ld, &&tgt, &&ldTgt},
+        {&&ld, &&tge, &&ldTge},
+        {&&ld, &&teq, &&ldTeq},
+        {&&ld, &&tne, &&ldTne},
+        {NULL, NULL, NULL}
+    };
+
+    /* the handler addresses belong to this engine */
+    if (prog->dCodeEngine != 1 + FAST + 2*PROFILE) {
+        int loc;
+
+        for (loc = 0; loc < iaddrSize; loc++) {
+            INSTRUCTION *in = &prog->iMem[loc];
+
+            dCode[loc].r = in->iarg1;
+            dCode[loc].s = opClass(in->iop) == opclRR ? in->iarg2 : in->iarg3;
+            dCode[loc].t = in->iarg3;
+            dCode[loc].d = in->iarg2;
+            if (in->iop == opLDA && in->iarg1 == PC_REG) dCode[loc].handler = handlers[opJMP];
+            else if (writesPC(in)) dCode[loc].handler = &&generic;
+            else dCode[loc].handler = handlers[in->iop];
+        }
+        dCode[iaddrSize].handler = &&end;
 
-    case '?':
-    case 'h':
-        /***********************************/
-	usage();
-	break;
+        /* going up, loc+1 and loc+2 still have their plain handlers */
+        for (loc = 0; loc + 1 < iaddrSize; loc++) {
+            void *h0 = dCode[loc].handler, *h1 = dCode[loc + 1].handler, *h2 = dCode[loc + 2].handler;
+            int i;
 
-    case 'p':
-        /***********************************/
-	icountflag = !icountflag;
+            for (i = 0; fuse3[i][0] != NULL; i++) {
+                if (h0 == fuse3[i][0] && h1 == fuse3[i][1] && h2 == fuse3[i][2]) {
+                    dCode[loc].handler = fuse3[i][3];
+                    break;
+                }
+            }
+            if (fuse3[i][0] != NULL) continue;
+            for (i = 0; fuse2[i][0] != NULL; i++) {
+                if (h0 == fuse2[i][0] && h1 == fuse2[i][1]) {
+                    dCode[loc].handler = fuse2[i][2];
+                    break;
+                }
+            }
+        }
+        prog->dCodeEngine = 1 + FAST + 2*PROFILE;
+    }
+    if (steps == NULL) return srOKAY;    // only the predecode
+
+    if (FAST) vm->tagflag = FALSE;
+    if (limit == 0) limit = -1;
+    count = 0;
+    ip = last = NULL;
+    result = srOKAY;
+    m = reg[PC_REG];
+    if (m < 0 || m >= iaddrSize) goto imemErr;
+    ip = dCode + m;
+    NEXT;
+
+halt:
+    result = srHALT;
+    goto done;
+nop:
+    ip++; NEXT;
+add:
+    reg[ip->r] = reg[ip->s] + reg[ip->t]; ip++; NEXT;
+sub:
+    reg[ip->r] = reg[ip->s] - reg[ip->t]; ip++; NEXT;
+mul:
+    reg[ip->r] = reg[ip->s] * reg[ip->t]; ip++; NEXT;
+divide:
+    if (reg[ip->t] == 0) { result = srZERODIVIDE; goto done; }
+    reg[ip->r] = reg[ip->s] / reg[ip->t]; ip++; NEXT;
+mod:
+    if (reg[ip->t] == 0) { result = srZERODIVIDE; goto done; }
+    {
+        long long int tmp;  // r may equal t
+
+        tmp = reg[ip->s] % reg[ip->t];
+        if (tmp<0) tmp += llabs(reg[ip->t]);  // always return a nonnegative answer
+        reg[ip->r] = tmp;
+    }
+    ip++; NEXT;
+andOp:
+    reg[ip->r] = reg[ip->s] & reg[ip->t]; ip++; NEXT;
+orOp:
+    reg[ip->r] = reg[ip->s] | reg[ip->t]; ip++; NEXT;
+xorOp:
+    reg[ip->r] = reg[ip->s] ^ reg[ip->t]; ip++; NEXT;
+notOp:
+    reg[ip->r] = ~reg[ip->s]; ip++; NEXT;
+neg:
+    reg[ip->r] = -reg[ip->s]; ip++; NEXT;
+tlt:
+    reg[ip->r] = reg[ip->s] < reg[ip->t]; ip++; NEXT;
+tle:
+    reg[ip->r] = reg[ip->s] <= reg[ip->t]; ip++; NEXT;
+tgt:
+    reg[ip->r] = reg[ip->s] > reg[ip->t]; ip++; NEXT;
+tge:
+    reg[ip->r] = reg[ip->s] >= reg[ip->t]; ip++; NEXT;
+teq:
+    reg[ip->r] = reg[ip->s] == reg[ip->t]; ip++; NEXT;
+tne:
+    reg[ip->r] = reg[ip->s] != reg[ip->t]; ip++; NEXT;
+ld:
+    DO_LD; ip++; NEXT;
+st:
+    DO_ST; ip++; NEXT;
+lda:
+    DO_LDA; ip++; NEXT;
+ldc:
+    DO_LDC; ip++; NEXT;
+jzr:
+    if (reg[ip->r] == 0) JUMP(ip->d + reg[ip->s]);
+    ip++; NEXT;
+jnz:
+    if (reg[ip->r] != 0) JUMP(ip->d + reg[ip->s]);
+    ip++; NEXT;
+jmp:
+    JUMP(ip->d + reg[ip->s]);
+
+    /* superinstructions, each part is still counted by STEP */
+ldLdJmp:
+    DO_LD; STEP; DO_LD; STEP; goto jmp;
+ldaLdaJmp:
+    DO_LDA; STEP; DO_LDA; STEP; goto jmp;
+ldaJmp:
+    DO_LDA; STEP; goto jmp;
+ldSt:
+    DO_LD; STEP; goto st;
+ldcSt:
+    DO_LDC; STEP; goto st;
+ldaSt:
+    DO_LDA; STEP; goto st;
+stLd:
+    DO_ST; STEP; goto ld;
+stLdc:
+    DO_ST; STEP; goto ldc;
+stLda:
+    DO_ST; STEP; goto lda;
+ldcLd:
+    DO_LDC; STEP; goto ld;
+ldLd:
+    DO_LD; STEP; goto ld;
+ldAdd:
+    DO_LD; STEP; goto add;
+ldSub:
+    DO_LD; STEP; goto sub;
+ldMul:
+    DO_LD; STEP; goto mul;
+ldDivide:
+    DO_LD; STEP; goto divide;
+ldMod:
+    DO_LD; STEP; goto mod;
+ldAnd:
+    DO_LD; STEP; goto andOp;
+ldOr:
+    DO_LD; STEP; goto orOp;
+ldTlt:
+    DO_LD; STEP; goto tlt;
+ldTle:
+    DO_LD; STEP; goto tle;
+ldTgt:
+    DO_LD; STEP; goto tgt;
+ldTge:
+    DO_LD; STEP; goto tge;
+ldTeq:
+    DO_LD; STEP; goto teq;
+ldTne:
+    DO_LD; STEP; goto tne;
+
+generic:
+    vm->pc = LOC(ip);
+    result = executeInstruction(vm, &prog->iMem[vm->pc]);
+    if (result != srOKAY) goto done;
+    JUMP(reg[PC_REG]);
+end:
+    /* ran off the end of instruction memory */
+    ip--;
+    if (!FAST) {
+        count--;
+        last = ip;
+    }
+    reg[PC_REG] = iaddrSize;
+imemErr:
+    /* stepTM counts the step that finds the bad pc */
+    if (!FAST && count == limit) goto done;
+    count++;
+    result = srIMEM_ERR;
+    executed = count - 1;
+    goto report;
+
+done:
+    executed = count;
+report:
+    if (FAST) {
+        vm->tagflag = TRUE;
+        if (ip != NULL) vm->pc = vm->lastpc = LOC(ip);
+    }
+    else {
+        if (last != NULL) vm->pc = vm->lastpc = LOC(last);
+        vm->instrCount += executed;
+    }
+    *steps = count;
+    return result;
+
+#undef LOC
+#undef COUNT
+#undef NEXT
+#undef STEP
+#undef DO_LD
+#undef DO_ST
+#undef DO_LDA
+#undef DO_LDC
+#undef JUMP
+}				/* runEngine */
+
+
+STEPRESULT runTM(MACHINE *vm, int limit, int *steps)
+{
+    if (profileflag) return runEngine<false, true>(vm, limit, steps);
+    return runEngine<false, false>(vm, limit, steps);
+}
+
+
+/* run without any bookkeeping until the program stops */
+STEPRESULT runFast(MACHINE *vm)
+{
+    int steps;
+
+    return runEngine<true, false>(vm, 0, &steps);
+}
+
+
+/********************************************/
+/* x86-64 JIT
+
+   With jitflag on, 'g' runs iMem translated to machine code.  The whole
+   of iMem is translated the first time it runs after a load.  The TM
+   registers stay in reg[]: rbx points at reg, r12 at dMem, r14 at the
+   native address of each instruction (for jumps through a register)
+   and r15 at where to leave the address of the last instruction.
+   Jumps relative to the pc go straight to the target's code.  I/O and
+   the rarer instructions call back into executeInstruction through
+   jitCall.  Like the fast engine there is no instruction count, limit
+   or memory tags. */
+
+#if defined(__x86_64__)
+
+#define RAX 0
+#define RCX 1
+#define REG_DISP(r) (8*(r))       // offset of reg[r] from rbx
+
+typedef STEPRESULT (*JITENTRY)(long long int *reg, long long int *dMem, void **table, int *lastLoc);
+
+typedef struct
+{
+    size_t pos;     // where the rel32 is
+    int loc;        // instruction it jumps to
+} JITFIXUP;
+
+unsigned char *jitBuf = NULL;    // code being generated
+size_t jitLen = 0;
+size_t jitCapacity = 0;
+JITFIXUP *jitFixups = NULL;
+int jitFixupCount = 0;
+int jitFixupCapacity = 0;
+size_t jitExitPos;               // the common exit
+
+void *jitCode = NULL;            // executable copy of jitBuf
+size_t jitCodeSize = 0;
+void **jitTable = NULL;          // native address of each instruction
+MACHINE *jitVm = NULL;           // the machine running the translation
+PROGRAM *jitProg = NULL;         // and the program translated
+
+
+void jitByte(int b)
+{
+    if (jitLen == jitCapacity) {
+        jitCapacity = jitCapacity ? 2 * jitCapacity : 65536;
+        jitBuf = (unsigned char *)realloc(jitBuf, jitCapacity);
+    }
+    jitBuf[jitLen++] = b;
+}
+
+void jitBytes(int n, const char *bytes)
+{
+    int i;
+
+    for (i = 0; i < n; i++) jitByte((unsigned char)bytes[i]);
+}
+
+void jitInt32(long long int v)
+{
+    int i;
+
+    for (i = 0; i < 4; i++) jitByte((v >> (8*i)) & 0xff);
+}
+
+void jitInt64(long long int v)
+{
+    int i;
+
+    for (i = 0; i < 8; i++) jitByte((v >> (8*i)) & 0xff);
+}
+
+int fitsInt32(long long int v)
+{
+    return v >= INT_MIN && v <= INT_MAX;
+}
+
+/* a rel8 to be patched by jitHere */
+size_t jitRel8(int opcode)
+{
+    jitByte(opcode);
+    jitByte(0);
+    return jitLen - 1;
+}
+
+void jitHere(size_t pos)
+{
+    jitBuf[pos] = jitLen - (pos + 1);
+}
+
+/* rel32 to a position already generated */
+void jitRel32To(size_t target)
+{
+    jitInt32((long long int)target - (long long int)(jitLen + 4));
+}
+
+/* rel32 to the code of instruction loc */
+void jitRel32ToLoc(int loc)
+{
+    if (jitFixupCount == jitFixupCapacity) {
+        jitFixupCapacity = jitFixupCapacity ? 2 * jitFixupCapacity : 1024;
+        jitFixups = (JITFIXUP *)realloc(jitFixups, jitFixupCapacity * sizeof(JITFIXUP));
+    }
+    jitFixups[jitFixupCount].pos = jitLen;
+    jitFixups[jitFixupCount].loc = loc;
+    jitFixupCount++;
+    jitInt32(0);
+}
+
+/* x = v */
+void jitMovImm(int x, long long int v)
+{
+    if (fitsInt32(v)) {
+        jitBytes(2, "\x48\xc7");
+        jitByte(0xc0 + x);
+        jitInt32(v);
+    }
+    else {
+        jitByte(0x48);
+        jitByte(0xb8 + x);
+        jitInt64(v);
+    }
+}
+
+/* x = reg[r], reading the pc gives the address after loc */
+void jitLoadReg(int x, int r, int loc)
+{
+    if (r == PC_REG) {
+        jitMovImm(x, loc + 1);
+    }
+    else {
+        jitByte(0x48);
+        jitByte(0x8b);
+        jitByte(0x43 + (x << 3));
+        jitByte(REG_DISP(r));
+    }
+}
+
+/* reg[r] = x */
+void jitStoreReg(int x, int r)
+{
+    jitByte(0x48);
+    jitByte(0x89);
+    jitByte(0x43 + (x << 3));
+    jitByte(REG_DISP(r));
+}
+
+/* rax = d + reg[s] */
+void jitAddress(long long int d, int s, int loc)
+{
+    if (s == PC_REG) {
+        jitMovImm(RAX, d + loc + 1);
+        return;
+    }
+    jitLoadReg(RAX, s, loc);
+    if (d == 0) return;
+    if (fitsInt32(d)) {
+        jitBytes(2, "\x48\x05");         // add rax, imm32
+        jitInt32(d);
+    }
+    else {
+        jitMovImm(RCX, d);
+        jitBytes(3, "\x48\x01\xc8");     // add rax, rcx
+    }
+}
+
+/* call a C function, the arguments are already in edi and rsi */
+void jitCallC(void *fn)
+{
+    jitMovImm(RAX, (long long int)fn);
+    jitBytes(2, "\xff\xd0");             // call rax
+}
+
+/* leave with result, loc is the instruction that was executing */
+void jitExit(STEPRESULT result, int loc)
+{
+    jitByte(0xba);                       // mov edx, loc
+    jitInt32(loc);
+    jitByte(0xb8);                       // mov eax, result
+    jitInt32(result);
+    jitByte(0xe9);                       // jmp exit
+    jitRel32To(jitExitPos);
+}
+
+/* jump from loc to the address in rax */
+void jitJumpRax(int loc)
+{
+    size_t ok;
+
+    jitBytes(2, "\x48\x3d");             // cmp rax, iaddrSize
+    jitInt32(jitProg->iaddrSize);
+    ok = jitRel8(0x72);                  // jb ok
+    jitStoreReg(RAX, PC_REG);
+    jitExit(srIMEM_ERR, loc);
+    jitHere(ok);
+    jitBytes(4, "\x41\xff\x24\xc6");     // jmp [r14 + rax*8]
+}
+
+/* jump from loc to a target known now */
+void jitJumpTo(long long int target, int loc)
+{
+    if (target >= 0 && target < jitProg->iaddrSize) {
+        jitByte(0xe9);
+        jitRel32ToLoc(target);
+    }
+    else {
+        jitMovImm(RAX, target);
+        jitJumpRax(loc);
+    }
+}
+
+/* JZR and JNZ */
+void jitBranch(INSTRUCTION *in, int loc, int ifZero)
+{
+    long long int target;
+    size_t skip;
+
+    jitLoadReg(RCX, in->iarg1, loc);
+    jitBytes(3, "\x48\x85\xc9");         // test rcx, rcx
+    target = in->iarg2 + loc + 1;
+    if (in->iarg3 == PC_REG && target >= 0 && target < jitProg->iaddrSize) {
+        jitByte(0x0f);
+        jitByte(ifZero ? 0x84 : 0x85);   // je/jne target
+        jitRel32ToLoc(target);
+    }
+    else {
+        skip = jitRel8(ifZero ? 0x75 : 0x74);
+        jitAddress(in->iarg2, in->iarg3, loc);
+        jitJumpRax(loc);
+        jitHere(skip);
+    }
+}
+
+
+/* the instructions the JIT can not do itself */
+STEPRESULT jitCall(int loc)
+{
+    jitVm->pc = loc;
+    jitVm->reg[PC_REG] = loc + 1;
+    return executeInstruction(jitVm, &jitProg->iMem[loc]);
+}
+
+/* a load out of bounds, getDMem reports it */
+long long int jitLoadFault(long long int m, int loc)
+{
+    jitVm->pc = loc;
+    return getDMem(jitVm, m);
+}
+
+/* a store out of bounds or into the LIT data, setDMem checks it */
+void jitStoreSlow(long long int m, int loc)
+{
+    jitVm->pc = loc;
+    jitVm->reg[PC_REG] = loc + 1;
+    setDMem(jitVm, m, jitVm->reg[jitProg->iMem[loc].iarg1]);
+}
+
+
+void jitInstruction(INSTRUCTION *in, int loc)
+{
+    int r, s, t;
+    size_t skip, done;
+    static const char setcc[] = {
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        (char)0x9c, 0, (char)0x9e, (char)0x9f, 0, (char)0x9d, (char)0x94, (char)0x95
+    };   // setl, setle, setg, setge, sete, setne for opTLT..opTNE
+
+    r = in->iarg1;
+    s = in->iarg2;
+    t = in->iarg3;
+    switch (in->iop) {
+    case opHALT:
+        jitExit(srHALT, loc);
+        return;
+    case opNOP:
+        return;
+    case opLDA:
+        if (r == PC_REG) {
+            if (t == PC_REG) jitJumpTo(in->iarg2 + loc + 1, loc);
+            else {
+                jitAddress(in->iarg2, t, loc);
+                jitJumpRax(loc);
+            }
+        }
+        else {
+            jitAddress(in->iarg2, t, loc);
+            jitStoreReg(RAX, r);
+        }
+        return;
+    case opLDC:
+        if (r == PC_REG) jitJumpTo(in->iarg2, loc);
+        else {
+            jitMovImm(RAX, in->iarg2);
+            jitStoreReg(RAX, r);
+        }
+        return;
+    case opJMP:
+        if (t == PC_REG) jitJumpTo(in->iarg2 + loc + 1, loc);
+        else {
+            jitAddress(in->iarg2, t, loc);
+            jitJumpRax(loc);
+        }
+        return;
+    case opJZR:
+        jitBranch(in, loc, TRUE);
+        return;
+    case opJNZ:
+        jitBranch(in, loc, FALSE);
+        return;
+    case opST:
+        {
+            size_t slow, rom, fast;
+
+            jitAddress(in->iarg2, t, loc);
+            jitBytes(2, "\x48\x3d");     // cmp rax, daddrSize
+            jitInt32(jitVm->daddrSize);
+            slow = jitRel8(0x73);        // jae slow
+            rom = fast = 0;
+            if (jitProg->roHigh >= 0) {
+                jitBytes(2, "\x48\x3d"); // cmp rax, roLow
+                jitInt32(jitProg->roLow);
+                fast = jitRel8(0x7c);    // jl fast
+                jitBytes(2, "\x48\x3d"); // cmp rax, roHigh
+                jitInt32(jitProg->roHigh);
+                rom = jitRel8(0x7e);     // jle slow
+                jitHere(fast);
+            }
+            jitLoadReg(RCX, r, loc);
+            jitBytes(4, "\x49\x89\x0c\xc4");   // mov [r12 + rax*8], rcx
+            done = jitRel8(0xeb);
+            jitHere(slow);
+            if (jitProg->roHigh >= 0) jitHere(rom);
+            jitBytes(3, "\x48\x89\xc7");        // mov rdi, rax
+            jitByte(0xbe);                       // mov esi, loc
+            jitInt32(loc);
+            jitCallC((void *)jitStoreSlow);
+            jitHere(done);
+        }
+        return;
+    default:
+        break;
+    }
+
+    /* everything else that writes the pc goes through jitCall */
+    if (!writesPC(in)) {
+        switch (in->iop) {
+        case opADD:
+        case opSUB:
+        case opMUL:
+        case opAND:
+        case opOR:
+        case opXOR:
+            jitLoadReg(RAX, s, loc);
+            jitLoadReg(RCX, t, loc);
+            switch (in->iop) {
+            case opADD: jitBytes(3, "\x48\x01\xc8"); break;        // add rax, rcx
+            case opSUB: jitBytes(3, "\x48\x29\xc8"); break;        // sub rax, rcx
+            case opMUL: jitBytes(4, "\x48\x0f\xaf\xc1"); break;    // imul rax, rcx
+            case opAND: jitBytes(3, "\x48\x21\xc8"); break;        // and rax, rcx
+            case opOR:  jitBytes(3, "\x48\x09\xc8"); break;        // or rax, rcx
+            default:    jitBytes(3, "\x48\x31\xc8"); break;        // xor rax, rcx
+            }
+            jitStoreReg(RAX, r);
+            return;
+        case opNOT:
+        case opNEG:
+            jitLoadReg(RAX, s, loc);
+            jitBytes(3, in->iop == opNOT ? "\x48\xf7\xd0" : "\x48\xf7\xd8");
+            jitStoreReg(RAX, r);
+            return;
+        case opTLT:
+        case opTLE:
+        case opTGT:
+        case opTGE:
+        case opTEQ:
+        case opTNE:
+            jitLoadReg(RAX, s, loc);
+            jitLoadReg(RCX, t, loc);
+            jitBytes(3, "\x48\x39\xc8");     // cmp rax, rcx
+            jitByte(0x0f);
+            jitByte((unsigned char)setcc[in->iop]);
+            jitByte(0xc0);                   // setcc al
+            jitBytes(3, "\x0f\xb6\xc0");     // movzx eax, al
+            jitStoreReg(RAX, r);
+            return;
+        case opDIV:
+        case opMOD:
+            jitLoadReg(RCX, t, loc);
+            jitBytes(3, "\x48\x85\xc9");     // test rcx, rcx
+            skip = jitRel8(0x75);            // jnz
+            jitExit(srZERODIVIDE, loc);
+            jitHere(skip);
+            jitLoadReg(RAX, s, loc);
+            jitBytes(5, "\x48\x99\x48\xf7\xf9");     // cqo; idiv rcx
+            if (in->iop == opMOD) {
+                /* always a nonnegative answer */
+                jitBytes(3, "\x48\x85\xd2");         // test rdx, rdx
+                skip = jitRel8(0x79);                // jns
+                jitBytes(3, "\x48\x89\xc8");         // mov rax, rcx
+                jitBytes(3, "\x48\xf7\xd8");         // neg rax
+                jitBytes(4, "\x48\x0f\x4c\xc1");     // cmovl rax, rcx
+                jitBytes(3, "\x48\x01\xc2");         // add rdx, rax
+                jitHere(skip);
+                jitBytes(3, "\x48\x89\xd0");         // mov rax, rdx
+            }
+            jitStoreReg(RAX, r);
+            return;
+        case opLD:
+            jitAddress(in->iarg2, t, loc);
+            jitBytes(2, "\x48\x3d");         // cmp rax, daddrSize
+            jitInt32(jitVm->daddrSize);
+            skip = jitRel8(0x72);            // jb ok
+            jitBytes(3, "\x48\x89\xc7");     // mov rdi, rax
+            jitByte(0xbe);                   // mov esi, loc
+            jitInt32(loc);
+            jitCallC((void *)jitLoadFault);
+            done = jitRel8(0xeb);
+            jitHere(skip);
+            jitBytes(4, "\x49\x8b\x04\xc4"); // mov rax, [r12 + rax*8]
+            jitHere(done);
+            jitStoreReg(RAX, r);
+            return;
+        default:
+            break;
+        }
+    }
+
+    jitByte(0xbf);                       // mov edi, loc
+    jitInt32(loc);
+    jitCallC((void *)jitCall);
+    jitBytes(2, "\x85\xc0");             // test eax, eax
+    jitByte(0xba);                       // mov edx, loc
+    jitInt32(loc);
+    jitBytes(2, "\x0f\x85");             // jnz exit
+    jitRel32To(jitExitPos);
+    if (writesPC(in)) {
+        jitBytes(4, "\x48\x8b\x43\x38");     // mov rax, reg[PC_REG]
+        jitJumpRax(loc);
+    }
+}
+
+
+/* translate all of iMem, FALSE if there is no executable memory */
+int jitCompile()
+{
+    size_t *locPos;
+    size_t size;
+    void *code;
+    int loc, i;
+
+    jitLen = 0;
+    jitFixupCount = 0;
+    locPos = (size_t *)malloc(jitProg->iaddrSize * sizeof(size_t));
+
+    /* entry: save registers keeping the stack aligned for calls,
+       then jump to the instruction at the pc */
+    jitBytes(7, "\x53\x41\x54\x41\x56\x41\x57");    // push rbx, r12, r14, r15
+    jitBytes(4, "\x48\x83\xec\x08");                // sub rsp, 8
+    jitBytes(12, "\x48\x89\xfb\x49\x89\xf4\x49\x89\xd6\x49\x89\xcf");  // rbx, r12, r14, r15 = args
+    jitBytes(4, "\x48\x8b\x43\x38");                // mov rax, reg[PC_REG]
+    jitBytes(4, "\x41\xff\x24\xc6");                // jmp [r14 + rax*8]
+
+    /* exit: eax is the result and edx the last instruction */
+    jitExitPos = jitLen;
+    jitBytes(3, "\x41\x89\x17");                    // mov [r15], edx
+    jitBytes(4, "\x48\x83\xc4\x08");                // add rsp, 8
+    jitBytes(7, "\x41\x5f\x41\x5e\x41\x5c\x5b");    // pop r15, r14, r12, rbx
+    jitByte(0xc3);                                  // ret
+
+    for (loc = 0; loc < jitProg->iaddrSize; loc++) {
+        locPos[loc] = jitLen;
+        jitInstruction(&jitProg->iMem[loc], loc);
+    }
+
+    /* ran off the end of instruction memory */
+    jitMovImm(RAX, jitProg->iaddrSize);
+    jitStoreReg(RAX, PC_REG);
+    jitExit(srIMEM_ERR, jitProg->iaddrSize - 1);
+
+    for (i = 0; i < jitFixupCount; i++) {
+        size_t pos = jitFixups[i].pos;
+        long long int rel = (long long int)locPos[jitFixups[i].loc] - (long long int)(pos + 4);
+        int k;
+
+        for (k = 0; k < 4; k++) jitBuf[pos + k] = (rel >> (8*k)) & 0xff;
+    }
+
+    /* copy to memory that can be executed but not written */
+    if (jitCode != NULL) munmap(jitCode, jitCodeSize);
+    jitCode = NULL;
+    size = (jitLen + 4095) & ~(size_t)4095;
+    code = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED) {
+        free(locPos);
+        return FALSE;
+    }
+    memcpy(code, jitBuf, jitLen);
+    if (mprotect(code, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(code, size);
+        free(locPos);
+        return FALSE;
+    }
+    jitTable = (void **)realloc(jitTable, jitProg->iaddrSize * sizeof(void *));
+    for (loc = 0; loc < jitProg->iaddrSize; loc++) jitTable[loc] = (char *)code + locPos[loc];
+    free(locPos);
+
+    jitCode = code;
+    jitCodeSize = size;
+    jitValid = TRUE;
+    return TRUE;
+}
+
+
+/* run the translated program until it stops */
+STEPRESULT runJIT(MACHINE *vm)
+{
+    STEPRESULT result;
+    int loc;
+
+    if (vm->reg[PC_REG] < 0 || vm->reg[PC_REG] >= vm->prog->iaddrSize) return srIMEM_ERR;
+    if (jitProg != vm->prog) jitValid = FALSE;
+    jitVm = vm;
+    jitProg = vm->prog;
+    if (!jitValid && !jitCompile()) {
+        fprintf(stderr, "No executable memory for the JIT, using the fast engine.\n");
+        jitflag = FALSE;
+        return runFast(vm);
+    }
+
+    vm->tagflag = FALSE;
+    result = ((JITENTRY)jitCode)(vm->reg, vm->dMem, jitTable, &loc);
+    vm->tagflag = TRUE;
+    vm->pc = vm->lastpc = loc;
+    if (result != srIMEM_ERR) vm->reg[PC_REG] = loc + 1;
+
+    return result;
+}
+
+#else
+
+/* no JIT for this machine */
+STEPRESULT runJIT(MACHINE *vm)
+{
+    return runFast(vm);
+}
+
+#endif
+
+
+/********************************************/
+/* the profile */
+
+#define PROFILE_TOP 10     /* blocks and instructions listed */
+
+typedef struct
+{
+    int start, end;        /* an address range, a block or function */
+    int index;             /* opcode or function */
+    long long int entries;
+    long long int count;   /* instructions executed */
+} PROFENTRY;
+
+int compareProfEntries(const void *a, const void *b)
+{
+    long long int ca = ((PROFENTRY *)a)->count, cb = ((PROFENTRY *)b)->count;
+
+    if (ca != cb) return ca < cb ? 1 : -1;
+    return ((PROFENTRY *)a)->start - ((PROFENTRY *)b)->start;
+}
+
+double percent(long long int count, long long int total)
+{
+    return total ? 100.0 * count / total : 0.0;
+}
+
+void writeProfInstruction(PROGRAM *prog, FILE *fp, int loc)
+{
+    INSTRUCTION *in = &prog->iMem[loc];
+
+    fprintf(fp, "%5d: %-5s %lld,", loc, opCodeTab[in->iop], in->iarg1);
+    if (opClass(in->iop) == opclRR) fprintf(fp, "%lld,%lld", in->iarg2, in->iarg3);
+    else fprintf(fp, "%lld(%lld)", in->iarg2, in->iarg3);
+    if (in->comment != NULL && *in->comment != '\0') fprintf(fp, "  %s", in->comment);
+    fprintf(fp, "\n");
+}
+
+/* report the counts kept with -p: opcodes, functions, and the hottest
+   basic blocks and instructions */
+void profileReport(MACHINE *vm, FILE *fp)
+{
+    PROGRAM *prog = vm->prog;
+    PROFENTRY *entries;
+    int *funcOf;
+    char *leader;
+    long long int total;
+    int loc, i, n;
+
+    entries = (PROFENTRY *)calloc(prog->iaddrSize + opEND + prog->funcCount + 1, sizeof(PROFENTRY));
+    funcOf = (int *)malloc(prog->iaddrSize * sizeof(int));
+    leader = (char *)calloc(prog->iaddrSize + 1, 1);
+
+    total = 0;
+    for (loc = 0; loc < prog->iaddrSize; loc++) total += prog->profCount[loc];
+    fprintf(fp, "\nP R O F I L E\n");
+    fprintf(fp, "Instructions executed: %lld\n", total);
+
+    /* opcodes */
+    for (i = 0; i < opEND; i++) {
+        entries[i].index = entries[i].start = i;
+        entries[i].count = 0;
+    }
+    for (loc = 0; loc < prog->iaddrSize; loc++) entries[prog->iMem[loc].iop].count += prog->profCount[loc];
+    qsort(entries, opEND, sizeof(PROFENTRY), compareProfEntries);
+    fprintf(fp, "\n%-8s %14s %7s\n", "Opcode", "Count", "%");
+    for (i = 0; i < opEND && entries[i].count > 0; i++) {
+        fprintf(fp, "%-8s %14lld %7.2f\n", opCodeTab[entries[i].index], entries[i].count,
+                percent(entries[i].count, total));
+    }
+
+    /* functions, the last entry is everything outside them */
+    for (loc = 0; loc < prog->iaddrSize; loc++) funcOf[loc] = prog->funcCount;
+    for (i = 0; i < prog->funcCount; i++) {
+        for (loc = prog->funcRange[i].start; loc <= prog->funcRange[i].end && loc < prog->iaddrSize; loc++) {
+            if (loc >= 0) funcOf[loc] = i;
+        }
+    }
+    for (i = 0; i <= prog->funcCount; i++) {
+        entries[i].index = entries[i].start = i;
+        entries[i].count = 0;
+    }
+    for (loc = 0; loc < prog->iaddrSize; loc++) entries[funcOf[loc]].count += prog->profCount[loc];
+    qsort(entries, prog->funcCount + 1, sizeof(PROFENTRY), compareProfEntries);
+    fprintf(fp, "\n%-24s %14s %7s\n", "Function", "Instructions", "%");
+    for (i = 0; i <= prog->funcCount && entries[i].count > 0; i++) {
+        fprintf(fp, "%-24s %14lld %7.2f\n",
+                entries[i].index < prog->funcCount ? prog->funcRange[entries[i].index].name : "(outside functions)",
+                entries[i].count, percent(entries[i].count, total));
+    }
+
+    /* basic blocks start at 0, function starts, jump targets, return
+       addresses and after anything that may jump */
+    leader[0] = TRUE;
+    for (i = 0; i < prog->funcCount; i++) {
+        if (prog->funcRange[i].start >= 0 && prog->funcRange[i].start < prog->iaddrSize) leader[prog->funcRange[i].start] = TRUE;
+    }
+    for (loc = 0; loc < prog->iaddrSize; loc++) {
+        INSTRUCTION *in = &prog->iMem[loc];
+        long long int target;
+
+        if (prog->iMemTag[loc] != USED) continue;
+        if (in->iop == opHALT || writesPC(in)
+            || in->iop == opJZR || in->iop == opJNZ || in->iop == opJMP) leader[loc + 1] = TRUE;
+        if (opClass(in->iop) == opclRA && in->iarg3 == PC_REG) {
+            target = in->iarg2 + loc + 1;
+            if (target >= 0 && target < prog->iaddrSize
+                && (in->iop == opLDA || in->iop == opJZR || in->iop == opJNZ || in->iop == opJMP)) {
+                leader[target] = TRUE;
+            }
+        }
+    }
+    n = 0;
+    for (loc = 0; loc < prog->iaddrSize; loc++) {
+        if (prog->iMemTag[loc] != USED) continue;
+        if (n == 0 || leader[loc] || prog->iMemTag[loc - 1] != USED || funcOf[loc] != funcOf[loc - 1]) {
+            entries[n].start = loc;
+            entries[n].index = funcOf[loc];
+            entries[n].entries = prog->profCount[loc];
+            entries[n].count = 0;
+            n++;
+        }
+        entries[n - 1].end = loc;
+        entries[n - 1].count += prog->profCount[loc];
+    }
+    qsort(entries, n, sizeof(PROFENTRY), compareProfEntries);
+    fprintf(fp, "\nHottest blocks\n%-13s %-24s %12s %14s %7s\n", "Block", "Function", "Entries", "Instructions", "%");
+    for (i = 0; i < n && i < PROFILE_TOP && entries[i].count > 0; i++) {
+        fprintf(fp, "%5d-%-7d %-24s %12lld %14lld %7.2f\n", entries[i].start, entries[i].end,
+                entries[i].index < prog->funcCount ? prog->funcRange[entries[i].index].name : "",
+                entries[i].entries, entries[i].count, percent(entries[i].count, total));
+    }
+
+    /* instructions */
+    n = 0;
+    for (loc = 0; loc < prog->iaddrSize; loc++) {
+        if (prog->profCount[loc] == 0) continue;
+        entries[n].start = loc;
+        entries[n].count = prog->profCount[loc];
+        n++;
+    }
+    qsort(entries, n, sizeof(PROFENTRY), compareProfEntries);
+    fprintf(fp, "\nHottest instructions\n%14s %7s  %s\n", "Count", "%", "Instruction");
+    for (i = 0; i < n && i < PROFILE_TOP; i++) {
+        fprintf(fp, "%14lld %7.2f  ", entries[i].count, percent(entries[i].count, total));
+        writeProfInstruction(prog, fp, entries[i].start);
+    }
+
+    free(entries);
+    free(funcOf);
+    free(leader);
+}
+
+
+
+
+/********************************************/
+void usage()
+{
+    printf("%s\n", versionNumber);
+    printf("\nCommands are:\n");
+    printf(" a(bortLimit <<n>>  Maximum number of instructions between halts (default is %d).\n", DEFAULT_ABORT_LIMIT);
+    printf(" b(reakpoint <<n>>  Set a breakpoint for instr n.  No n means clear breakpoints.\n");
+    printf(" c(lear             Reset TM for new execution of program\n");
+    printf(" d(Mem <b <n>>      Print n dMem locations (counting down) starting at b (n can be negative to count up). No args means all used memory locations.\n");
+    printf(" e(xecStats         Print execution statistics since last load or clear\n");
+    printf(" f(ast              Toggle fast execution for 'go': no instruction count, limit or memory tags\n");
+    printf(" g(o                Execute TM instructions until HALT\n");
+    printf(" j(it               Toggle running 'go' as x86-64 code, same limits as fast execution\n");
+    printf(" h(elp              Cause this list of commands to be printed\n");
+    printf(" i(Mem <b <n>>      Print n iMem locations (counting up) starting at b.  No args means all used memory locations.\n");
+    printf(" l(oad filename     Load filename into memory (default is last file)\n");
+    printf(" n(ext              Print the next command that will be executed\n");
+    printf(" o(utputLimit <<n>> Maximum combined number of calls to any output instruction (default is %d)\n", DEFAULT_OUTPUT_LIMIT);
+    printf(" p(rint             Toggle printing of total number instructions executed ('go' only)\n");
+    printf(" q(uit              Terminate TM\n");
+    printf(" r(egs              Print the contents of the registers\n");
+    printf(" s(tep <n>          Execute n (default 1) TM instructions\n");
+    printf(" t(race             Toggle instruction tracing (printing) during execution\n");
+    printf(" u(nprompt)         Unprompted for script input\n");
+    printf(" v                  Print the version information\n");
+    printf(" x(it               Terminate TM\n");
+    printf(" = <r> <n>          Set register number r to value n (e.g. set the pc)\n");
+    printf(" < <addr> <value>   Set dMem at addr to value\n");
+    printf(" (empty line does a step)\n");
+    printf("Also a # character placed after input will cause TM to halt\n  after processing the IN or INB commands (e.g. 34#  or f# )\n");
+}
+
+
+
+int doCommand(void)
+{
+    MACHINE *vm = &mainMachine;
+    PROGRAM *prog = vm->prog;
+    char cmd;
+    int i;
+    int printcnt;
+    int stepResult;
+    int loc;
+
+    stepcnt = 0;
+    do {
+	if (promptflag) printf("Enter command: ");
+	fflush(stdin);
+	fflush(stdout);
+
+	fgets(vm->in_Line, LINESIZE - 2, stdin);
+	if (feof(stdin)) {
+	    vm->word[0] = 'q';
+	    vm->word[1] = '\0';
+	    break;
+	}
+
+	{
+	    char *p;
+
+	    for (p=vm->in_Line; *p; p++) {
+		if (*p=='\n') {
+		    *p='\0';
+		    break;
+		}
+	    }
+	    vm->lineLen = p-vm->in_Line;
+	}
+	vm->inCol = 0;
+    }
+    while ((vm->lineLen>0) && !getWord(vm));
+
+    if (vm->lineLen==0) {
+        vm->word[0] = 's';
+        vm->word[1] = '\0';
+    }
+
+    if (! promptflag) printf("command: %s\n", vm->in_Line);
+
+    cmd = vm->word[0];
+    switch (cmd) {
+    case 'l':
+        /***********************************/
+	if (!getWord(vm)) *vm->word = '\0';
+	readInstructions(vm, vm->word);
+	clearListings();
+	break;
+
+    case 't':
+        /***********************************/
+	traceflag = !traceflag;
+	printf("Tracing now ");
+	if (traceflag)
+	    printf("on.\n");
+	else
+	    printf("off.\n");
+	break;
+
+        /***********************************/
+    case 'u':
+//        printf("\n");
+	promptflag = FALSE;
+	break;
+
+        /***********************************/
+    case 'v':
+        printVersion();
+	break;
+
+    case '?':
+    case 'h':
+        /***********************************/
+	usage();
+	break;
+
+    case 'f':
+        /***********************************/
+	fastflag = !fastflag;
+	printf("Fast execution now ");
+	if (fastflag)
+	    printf("on.\n");
+	else
+	    printf("off.\n");
+	break;
+
+    case 'j':
+        /***********************************/
+	jitflag = !jitflag;
+	printf("JIT execution now ");
+	if (jitflag)
+	    printf("on.\n");
+	else
+	    printf("off.\n");
+	break;
+
+    case 'p':
+        /***********************************/
+	icountflag = !icountflag;
 	printf("Printing instruction count now ");
 	if (icountflag)
 	    printf("on.\n");
@@ -1422,8 +2975,8 @@ int doCommand(void)
 
     case 'a':
         /***********************************/
-        if (getNum()) {
-	    abortLimit = abs(num);
+        if (getNum(vm)) {
+	    abortLimit = abs(vm->num);
         }
 	else {
 	    abortLimit = 0;
@@ -1433,8 +2986,8 @@ int doCommand(void)
 
     case 'o':
         /***********************************/
-        if (getNum()) {
-	    outputLimit = abs(num);
+        if (getNum(vm)) {
+	    outputLimit = abs(vm->num);
         }
 	else {
 	    outputLimit = 0;
@@ -1444,31 +2997,31 @@ int doCommand(void)
 
     case 's':
         /***********************************/
-	if (atEOL())
+	if (atEOL(vm))
 	    stepcnt = 1;
-	else if (getNum())
-	    stepcnt = abs(num);
+	else if (getNum(vm))
+	    stepcnt = abs(vm->num);
 	else
 	    printf("Step count?\n");
-        if (! traceflag) writeInstruction(reg[7], NOTRACE);
+        if (! traceflag) writeInstruction(vm, vm->reg[7], NOTRACE);
         break;
 
     case 'e':
         /***********************************/
     { int cnt;
-            printf("EXEC STAT: Number of instructions executed: %d\n", instrCount);
-            printf("EXEC STAT: Number of output instructions executed: %d\n", outputInstrCount);
+            printf("EXEC STAT: Number of instructions executed: %d\n", vm->instrCount);
+            printf("EXEC STAT: Number of output instructions executed: %d\n", vm->outputInstrCount);
 
 	    cnt = 0;
-	    for (i = 0; i<IADDR_SIZE; i++) if (iMemTag[i]==USED) cnt++;
+	    for (i = 0; i<prog->iaddrSize; i++) if (prog->iMemTag[i]==USED) cnt++;
 	    printf("EXEC STAT: Instruction memory used: %d\n", cnt);
 
 	    cnt = 0;
-	    for (i = 0; i<IADDR_SIZE; i++) if (dMemTag[i]>=0) cnt++;
+	    for (i = 0; i<vm->daddrSize; i++) if (vm->dMemTag[i]>0) cnt++;
 	    printf("EXEC STAT: Data memory touched: %d\n", cnt);
 
 	    cnt = 0;
-	    for (i = 0; i<IADDR_SIZE; i++) if (dMemTag[i]==READONLY) cnt++;
+	    for (i = 0; i<vm->daddrSize; i++) if (vm->dMemTag[i]==READONLY) cnt++;
 	    printf("EXEC STAT: Read only memory: %d\n", cnt);
     }
     break;
@@ -1481,18 +3034,18 @@ int doCommand(void)
     case 'r':
         /***********************************/
 	for (i = 0; i<NO_REGS; i++) {
-	    printf("r[%1d]: %-4lld   ", i, reg[i]);
+	    printf("r[%1d]: %-4lld   ", i, vm->reg[i]);
 	    if ((i%4) == 3) printf("\n");
 	}
 	break;
 
     case '=':
         /***********************************/
-	if (getNum()) {
-	    loc = num;
-	    if (getNum()) {
+	if (getNum(vm)) {
+	    loc = vm->num;
+	    if (getNum(vm)) {
 		if (loc<0 || loc>=NO_REGS) printf("%d is not a legal register number\n", loc);
-		else reg[loc] = num;
+		else vm->reg[loc] = vm->num;
 	    }
 	    else printf("Register value?\n");
 	}
@@ -1501,8 +3054,8 @@ int doCommand(void)
 
         /***********************************/
     case 'n':
-	iloc = reg[PC_REG];
-	if ((iloc >= 0) && (iloc<IADDR_SIZE)) writeInstruction(iloc, TRACE);
+	iloc = vm->reg[PC_REG];
+	if ((iloc >= 0) && (iloc<prog->iaddrSize)) writeInstruction(vm, iloc, TRACE);
 	break;
 
     case 'i':
@@ -1511,26 +3064,26 @@ int doCommand(void)
         int usedonly;
 
         usedonly = 0;
-        if (getNum()) {
-            imemStart = num;
-            if (getNum()) {
+        if (getNum(vm)) {
+            imemStart = vm->num;
+            if (getNum(vm)) {
                 imemDown = +1;
-                if (num<0) imemDown = -1;
-                imemCount = abs(num);
+                if (vm->num<0) imemDown = -1;
+                imemCount = abs(vm->num);
             }
         }
         else {
             usedonly = 1;
             imemStart = 0;
-            imemCount = DADDR_SIZE;
+            imemCount = prog->iaddrSize;
         }
         iloc = imemStart;
         printcnt = imemCount;
 
         for (i=0; i<printcnt; i++, iloc+=imemDown) {
-            iloc = (DADDR_SIZE + iloc) % DADDR_SIZE;
-            if (! usedonly || iMemTag[iloc]!=UNUSED) {
-                writeInstruction(iloc, NOTRACE);
+            iloc = (prog->iaddrSize + iloc) % prog->iaddrSize;
+            if (! usedonly || prog->iMemTag[iloc]!=UNUSED) {
+                writeInstruction(vm, iloc, NOTRACE);
             }
         }
     }
@@ -1542,18 +3095,18 @@ int doCommand(void)
         int usedonly;
 
         usedonly = 0;
-        if (getNum()) {
-            dmemStart = num;
-            if (getNum()) {
+        if (getNum(vm)) {
+            dmemStart = vm->num;
+            if (getNum(vm)) {
                 dmemDown = +1;
-                if (num<0) dmemDown = -1;
-                dmemCount = abs(num);
+                if (vm->num<0) dmemDown = -1;
+                dmemCount = abs(vm->num);
             }
         }
         else {
             usedonly = 1;
             dmemStart = 0;
-            dmemCount = DADDR_SIZE;
+            dmemCount = vm->daddrSize;
         }
         dloc = dmemStart;
         printcnt = dmemCount;
@@ -1562,15 +3115,15 @@ int doCommand(void)
         for (i=0; i<printcnt; i++, dloc+=dmemDown) {
             char *c;
 
-            dloc = (DADDR_SIZE + dloc) % DADDR_SIZE;
-            if (! usedonly || dMemTag[dloc]!=UNUSED) {
-                c = niceChar(dMem[dloc]);
-                if (c) printf("%5d: %5lld '%s'", dloc, dMem[dloc], c);
-                else printf("%5d: %5lld %3s", dloc, dMem[dloc], "");
+            dloc = (vm->daddrSize + dloc) % vm->daddrSize;
+            if (! usedonly || vm->dMemTag[dloc]!=UNUSED) {
+                c = niceChar(vm->dMem[dloc]);
+                if (c) printf("%5d: %5lld '%s'", dloc, vm->dMem[dloc], c);
+                else printf("%5d: %5lld %3s", dloc, vm->dMem[dloc], "");
 
-                if (dMemTag[dloc]>=0)
-                    printf("    %3d %s\n", dMemTag[dloc], dMemCmt[dloc]);
-                else if (dMemTag[dloc]==UNUSED) printf("    %s\n", "unused");
+                if (vm->dMemTag[dloc]>0)
+                    printf("    %3d %s\n", vm->dMemTag[dloc]-1, vm->dMemCmt[dloc]);
+                else if (vm->dMemTag[dloc]==UNUSED) printf("    %s\n", "unused");
                 else printf("    %s\n", "readOnly");
             }
         }
@@ -1578,21 +3131,21 @@ int doCommand(void)
     break;
 
     case '<':
-            if (getNum()) {
-                dloc = num;
-                getNum();
+            if (getNum(vm)) {
+                dloc = vm->num;
+                getNum(vm);
             }
-            if (dloc >= 0 && dloc<DADDR_SIZE) {
-                dMem[dloc] = num;
+            if (dloc >= 0 && dloc<vm->daddrSize) {
+                vm->dMem[dloc] = vm->num;
             }
             break;
 
     case 'b':
-	if (atEOL()) {
+	if (atEOL(vm)) {
 	    savedbreakpoint = breakpoint = -1;
 	}
-	else if (getNum())
-	    savedbreakpoint = breakpoint = abs(num);
+	else if (getNum(vm))
+	    savedbreakpoint = breakpoint = abs(vm->num);
 	else
 	    printf("Breakpoint location?\n");
 	break;
@@ -1600,8 +3153,9 @@ int doCommand(void)
 
     case 'c':
         /***********************************/
-	clearMachine();
-	lastpc = 0;
+	clearMachine(vm);
+	clearListings();
+	vm->lastpc = 0;
         stepcnt = 0;
 	break;
 
@@ -1618,27 +3172,33 @@ int doCommand(void)
     stepResult = srOKAY;
     if (stepcnt>0) {
 	if (cmd == 'g') {
-            outputInstrCount = stepcnt = 0;
+            vm->outputInstrCount = stepcnt = 0;
 //	    stepcnt = 0;
-	    while ((stepResult == srOKAY) && ((abortLimit==0) || (stepcnt<abortLimit))) {
-		iloc = reg[PC_REG];
-		if (traceflag) writeInstruction(iloc, TRACE);
-		stepResult = stepTM();
+	    if (!traceflag && breakpoint == -1 && savedbreakpoint == -1) {
+                if (profileflag) stepResult = runTM(vm, abortLimit, &stepcnt);
+                else if (jitflag) stepResult = runJIT(vm);
+                else if (fastflag) stepResult = runFast(vm);
+                else stepResult = runTM(vm, abortLimit, &stepcnt);
+            }
+            else while ((stepResult == srOKAY) && ((abortLimit==0) || (stepcnt<abortLimit))) {
+		iloc = vm->reg[PC_REG];
+		if (traceflag) writeInstruction(vm, iloc, TRACE);
+		stepResult = stepTM(vm);
 		stepcnt++;
 	    }
 	    if ((stepcnt>=abortLimit) && (abortLimit!=0)) {
 		stepResult = srHALT;
 		printf("Abort limit reached! (limit = %d) (see 'a' command in help).\n", abortLimit);
 	    }
-	    if (icountflag)
+	    if (icountflag && stepcnt>0)
 		printf("Number of instructions executed = %d\n", stepcnt);
 	}
 	else {
 	    while ((stepcnt>0) && (stepResult == srOKAY)) {
-		iloc = reg[PC_REG];
+		iloc = vm->reg[PC_REG];
 		if (traceflag)
-		    writeInstruction(iloc, TRACE);
-		stepResult = stepTM();
+		    writeInstruction(vm, iloc, TRACE);
+		stepResult = stepTM(vm);
 		stepcnt--;
 	    }
 	}
@@ -1646,36 +3206,475 @@ int doCommand(void)
 	printf("\nStatus: %s\n", stepResultTab[stepResult]);
 	if (stepResult!=srOKAY) {
 	    printf("Last executed cmd: ");
-	    writeInstruction(lastpc, TRACE);
+	    writeInstruction(vm, vm->lastpc, TRACE);
 	}
-	printf("PC was %d, PC is now %lld\n", lastpc, reg[PC_REG]);
+	printf("PC was %d, PC is now %lld\n", vm->lastpc, vm->reg[PC_REG]);
     }
     return TRUE;
 }				/* doCommand */
 
 
 
+/********************************************/
+void commandLineUsage()
+{
+    printf("Usage: tm [options] [file]\n");
+    printf("  -b     batch: run the program to completion and exit, no prompts\n");
+    printf("  -f     fast: no instruction count, execution limit or memory tags\n");
+    printf("  -j     like -f but run the program translated to x86-64 machine code\n");
+    printf("  -d n   data memory size in words (default is %d)\n", DEFAULT_DADDR_SIZE);
+    printf("  -i n   instruction memory size, grows to fit the program (default is %d)\n", DEFAULT_IADDR_SIZE);
+    printf("  -l n   instruction execution limit, 0 for none (default is %d)\n", DEFAULT_ABORT_LIMIT);
+    printf("  -n     do not load instruction comments\n");
+    printf("  -m f   run the jobs in file f in parallel, a line is: program [input [expected]]\n");
+    printf("  -o n   output instruction limit, 0 for none (default is %d)\n", DEFAULT_OUTPUT_LIMIT);
+    printf("  -p     profile: count the runs of each instruction and report at exit,\n");
+    printf("         'go' then always uses the counting engine\n");
+    printf("  -s a   with -m start the jobs of each program from a snapshot taken at\n");
+    printf("         address a or the first input instruction (-s in for just that)\n");
+    printf("  -w n   worker threads for -m (default is one per processor)\n");
+    printf("Without -b or -m the program is loaded and TM prompts for commands.\n");
+}
+
+
+/* run the loaded program once from the start.  The program output
+   is all that goes to stdout, the report goes to stderr.  Returns the
+   exit status: 0 halted, 1 runtime error, 2 execution limit reached */
+int batchRun()
+{
+    MACHINE *vm = &mainMachine;
+    struct timespec start, stop;
+    STEPRESULT stepResult;
+    int steps;
+    int status;
+
+    vm->outputInstrCount = 0;
+    vm->lineLen = vm->inCol = 0;    // INC must not see what is left of the program file
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (profileflag) stepResult = runTM(vm, abortLimit, &steps);
+    else if (jitflag) stepResult = runJIT(vm);
+    else if (fastflag) stepResult = runFast(vm);
+    else stepResult = runTM(vm, abortLimit, &steps);
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    fflush(stdout);
+
+    if (stepResult == srOKAY) {
+        fprintf(stderr, "Abort limit reached! (limit = %d)\n", abortLimit);
+        status = 2;
+    }
+    else if (stepResult == srHALT) {
+        fprintf(stderr, "Status: %s\n", stepResultTab[stepResult]);
+        status = 0;
+    }
+    else {
+        fprintf(stderr, "Status: %s\n", stepResultTab[stepResult]);
+        fprintf(stderr, "Last executed cmd: %d\n", vm->lastpc);
+        status = 1;
+    }
+    if ((fastflag || jitflag) && !profileflag) fprintf(stderr, "Number of instructions executed = (not counted in fast mode)\n");
+    else fprintf(stderr, "Number of instructions executed = %d\n", vm->instrCount);
+    fprintf(stderr, "Wall time = %.6f s\n",
+            (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1e9);
+    fprintf(stderr, "Exit status = %d\n", status);
+    if (profileflag) profileReport(vm, stderr);
+
+    return status;
+}
+
+
+/********************************************/
+/* Many runs at once (-m jobfile).  Each line of the job file is
+
+       program [input [expected]]
+
+   naming the program, the file it reads ("-" or nothing for no input)
+   and the output it should write (nothing to not check the output).
+   Each program is loaded and predecoded once and its jobs share it.
+   The jobs run on a pool of worker threads, each job on a MACHINE of
+   its own with its output kept in memory.
+
+   With -s each program first runs once with no input up to the
+   snapshot point: the instruction at a given address or the first
+   input instruction, whichever comes first.  Its jobs then start from
+   a copy of that machine instead of from the beginning, so the part
+   of the run that can not depend on the input is only done once. */
+
+typedef struct
+{
+    MACHINE *vm;             // stopped at the snapshot point
+    STEPRESULT result;       // srOKAY if it got there, else how the program ended
+    int steps;               // instructions executed, -1 if not counted
+    char *output;            // what it wrote on the way
+    size_t outputLen;
+} SNAPSHOT;
+
+typedef struct
+{
+    char *program, *input, *expected;
+    PROGRAM *prog;
+    SNAPSHOT *snap;          // where the job starts, NULL for the beginning
+    char *problem;           // why the job could not run, NULL if it ran
+    STEPRESULT result;
+    int steps;               // instructions executed, -1 if not counted
+    char *output;            // what the program wrote
+    size_t outputLen;
+    long long int differs;   // first byte of output not as expected, -1 if none
+} JOB;
+
+JOB *jobs = NULL;
+int jobCount = 0;
+int nextJob = 0;             // the next job for a worker to take
+int workerCount = 0;         // -w, 0 for one per processor
+int snapshotAt = NO_SNAPSHOT;   // -s, an address or SNAPSHOT_AT_INPUT
+
+
+/* the execution limit of a job, the fast engine has none */
+int jobLimit()
+{
+    return (fastflag || jitflag) ? 0 : abortLimit;
+}
+
+
+/* the engine jobs run on, with steps NULL only predecode */
+STEPRESULT runJobEngine(MACHINE *vm, int limit, int *steps)
+{
+    if (fastflag || jitflag) return runEngine<true, false>(vm, 0, steps);
+    return runEngine<false, false>(vm, limit, steps);
+}
+
+
+/* run a fresh machine for prog up to the snapshot point */
+SNAPSHOT *takeSnapshot(PROGRAM *prog)
+{
+    SNAPSHOT *snap;
+    MACHINE *vm;
+    jmp_buf fault;
+    int loc, op;
+
+    snap = (SNAPSHOT *)calloc(1, sizeof(SNAPSHOT));
+    vm = snap->vm = (MACHINE *)calloc(1, sizeof(MACHINE));
+    vm->prog = prog;
+    vm->out = open_memstream(&snap->output, &snap->outputLen);
+    vm->faultJump = &fault;    // there is no input to read, it stops first
+    clearMachine(vm);
+
+    snap->result = (STEPRESULT)setjmp(fault);
+    snap->steps = -1;
+    while (snap->result == srOKAY) {
+        snap->steps = vm->instrCount;
+        loc = vm->reg[PC_REG];
+        if (loc == snapshotAt) break;
+        if (loc >= 0 && loc < prog->iaddrSize) {
+            op = prog->iMem[loc].iop;
+            if (op == opIN || op == opINB || op == opINC) break;
+        }
+        if (jobLimit() != 0 && vm->instrCount >= jobLimit()) break;
+        snap->result = stepMachine(vm);
+        snap->steps = vm->instrCount;
+    }
+    fclose(vm->out);
+    vm->out = NULL;
+    vm->faultJump = NULL;
+
+    return snap;
+}
+
+
+/* start vm where the snapshot machine stopped */
+void copyMachine(MACHINE *vm, MACHINE *from)
+{
+    memcpy(vm->reg, from->reg, sizeof(vm->reg));
+    vm->daddrSize = from->daddrSize;
+    mapDMem(vm);
+    memcpy(vm->dMem, from->dMem, vm->daddrSize * sizeof(long long int));
+    memcpy(vm->dMemTag, from->dMemTag, vm->daddrSize * sizeof(int));
+    memcpy(vm->dMemCmt, from->dMemCmt, vm->daddrSize * sizeof(char *));
+    vm->pc = from->pc;
+    vm->lastpc = from->lastpc;
+    vm->instrCount = from->instrCount;
+    vm->outputInstrCount = from->outputInstrCount;
+    vm->tagflag = TRUE;
+}
+
+
+/* read a whole file, NULL if it can not be read */
+char *readFile(char *fileName, size_t *len)
+{
+    FILE *fp;
+    char *text;
+    size_t capacity, n;
+
+    fp = fopen(fileName, "r");
+    if (fp == NULL) return NULL;
+    capacity = 4096;
+    text = (char *)malloc(capacity);
+    *len = 0;
+    while ((n = fread(text + *len, 1, capacity - *len, fp)) > 0) {
+        *len += n;
+        if (*len == capacity) {
+            capacity *= 2;
+            text = (char *)realloc(text, capacity);
+        }
+    }
+    fclose(fp);
+    return text;
+}
+
+
+void runJob(JOB *job)
+{
+    MACHINE *vm;
+    jmp_buf fault;
+    char *expected;
+    size_t expectedLen, i;
+    int limit;
+
+    job->differs = -1;
+    if (job->prog == NULL) {
+        job->problem = (char *)"program did not load";
+        return;
+    }
+    vm = (MACHINE *)calloc(1, sizeof(MACHINE));
+    vm->prog = job->prog;
+    vm->in = fopen(job->input ? job->input : "/dev/null", "r");
+    if (vm->in == NULL) {
+        job->problem = (char *)"input not found";
+        free(vm);
+        return;
+    }
+    vm->out = open_memstream(&job->output, &job->outputLen);
+    vm->faultJump = &fault;
+    limit = jobLimit();
+    if (job->snap == NULL) clearMachine(vm);
+    else {
+        copyMachine(vm, job->snap->vm);
+        fwrite(job->snap->output, 1, job->snap->outputLen, vm->out);
+        if (limit != 0) limit -= vm->instrCount;
+    }
+
+    job->result = (STEPRESULT)setjmp(fault);
+    if (job->snap != NULL && job->snap->result != srOKAY) {
+        job->result = job->snap->result;    // it ended before the snapshot point
+        job->steps = job->snap->steps;
+    }
+    else if (job->snap != NULL && jobLimit() != 0 && limit <= 0) {
+        job->result = srOKAY;               // and the limit was reached
+        job->steps = vm->instrCount;
+    }
+    else if (job->result == srOKAY) {
+        job->result = runJobEngine(vm, limit, &job->steps);
+        job->steps = vm->instrCount;
+    }
+    else job->steps = -1;    // a fault, the steps were not counted
+    fclose(vm->in);
+    fclose(vm->out);
+    unmapDMem(vm);
+    free(vm);
+
+    if (job->expected != NULL) {
+        expected = readFile(job->expected, &expectedLen);
+        if (expected == NULL) {
+            job->problem = (char *)"expected output not found";
+            return;
+        }
+        for (i = 0; i < expectedLen && i < job->outputLen && expected[i] == job->output[i]; i++);
+        if (i < expectedLen || i < job->outputLen) job->differs = i;
+        free(expected);
+    }
+}
+
+
+void *jobWorker(void *unused)
+{
+    int i;
+
+    while ((i = __sync_fetch_and_add(&nextJob, 1)) < jobCount) runJob(&jobs[i]);
+    return NULL;
+}
+
+
+/* run every job in the job file and report each one.  Returns the exit
+   status: 0 if every job halted with the expected output, 1 if not */
+int runJobs(char *jobFileName)
+{
+    FILE *jobFile;
+    char line[3*WORDSIZE];
+    MACHINE loader;
+    pthread_t *workers;
+    struct timespec start, stop;
+    int i, j, capacity, passed;
+
+    jobFile = fopen(jobFileName, "r");
+    if (jobFile == NULL) {
+        printf("ERROR(runJobs): file '%s' not found\n", jobFileName);
+        return 1;
+    }
+    capacity = 0;
+    while (fgets(line, sizeof(line), jobFile) != NULL) {
+        char *program, *input, *expected;
+
+        program = strtok(line, " \t\n");
+        if (program == NULL || *program == '#') continue;
+        input = strtok(NULL, " \t\n");
+        expected = strtok(NULL, " \t\n");
+        if (jobCount == capacity) {
+            capacity = capacity ? 2 * capacity : 64;
+            jobs = (JOB *)realloc(jobs, capacity * sizeof(JOB));
+        }
+        memset(&jobs[jobCount], 0, sizeof(JOB));
+        jobs[jobCount].program = strdup(program);
+        jobs[jobCount].input = (input && strcmp(input, "-") != 0) ? strdup(input) : NULL;
+        jobs[jobCount].expected = expected ? strdup(expected) : NULL;
+        jobCount++;
+    }
+    fclose(jobFile);
+
+    /* load and predecode each program once, here so the workers only
+       ever read them */
+    memset(&loader, 0, sizeof(loader));
+    loader.in = stdin;
+    loader.out = stdout;
+    for (i = 0; i < jobCount; i++) {
+        for (j = 0; j < i && strcmp(jobs[j].program, jobs[i].program) != 0; j++);
+        if (j < i) {
+            jobs[i].prog = jobs[j].prog;
+            jobs[i].snap = jobs[j].snap;
+            continue;
+        }
+        loader.prog = (PROGRAM *)calloc(1, sizeof(PROGRAM));
+        if (readInstructions(&loader, jobs[i].program)) {
+            runJobEngine(&loader, 0, NULL);
+            jobs[i].prog = loader.prog;
+            if (snapshotAt != NO_SNAPSHOT) jobs[i].snap = takeSnapshot(loader.prog);
+        }
+        unmapDMem(&loader);
+    }
+
+    if (workerCount == 0) workerCount = sysconf(_SC_NPROCESSORS_ONLN);
+    if (workerCount > jobCount) workerCount = jobCount;
+    if (workerCount < 1) workerCount = 1;
+    workers = (pthread_t *)malloc(workerCount * sizeof(pthread_t));
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < workerCount; i++) pthread_create(&workers[i], NULL, jobWorker, NULL);
+    for (i = 0; i < workerCount; i++) pthread_join(workers[i], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    free(workers);
+
+    passed = 0;
+    for (i = 0; i < jobCount; i++) {
+        JOB *job = &jobs[i];
+        int pass;
+
+        pass = job->problem == NULL && job->result == srHALT && job->differs < 0;
+        passed += pass;
+        printf("%s %s %s: ", pass ? "PASS" : "FAIL", job->program, job->input ? job->input : "-");
+        if (job->problem != NULL) printf("%s", job->problem);
+        else if (job->result == srOKAY) printf("Abort limit reached");
+        else printf("%s", stepResultTab[job->result]);
+        if (job->problem == NULL && job->differs >= 0) printf(", output differs at byte %lld", job->differs);
+        if (job->problem == NULL && job->steps >= 0 && !fastflag && !jitflag) printf(", %d instructions", job->steps);
+        printf("\n");
+        free(job->output);
+    }
+    printf("Jobs: %d  passed: %d  failed: %d\n", jobCount, passed, jobCount - passed);
+    fprintf(stderr, "Wall time = %.6f s with %d workers\n",
+            (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1e9, workerCount);
+
+    return passed == jobCount ? 0 : 1;
+}
+
+
 /********************************************/
 /* E X E C U T I O N   B E G I N S   H E R E */
 /********************************************/
 
 int main(int argc, char *argv[])
 {
+    MACHINE *vm = &mainMachine;
+    char *jobFileName = NULL;
+    int c;
+
     srandom(getpid()*332+1);
     initOpCodeTab();
 
-    printVersion();
+    while ((c = getopt(argc, argv, "bd:fi:jl:m:no:ps:w:")) != -1) {
+        switch (c) {
+        case 'b':
+            batchflag = TRUE;
+            promptflag = FALSE;
+            break;
+        case 'd':
+            daddrDefault = atoi(optarg);
+            break;
+        case 'f':
+            fastflag = TRUE;
+            break;
+        case 'j':
+            jitflag = TRUE;
+            break;
+        case 'p':
+            profileflag = TRUE;
+            break;
+        case 'i':
+            iaddrDefault = atoi(optarg);
+            break;
+        case 'l':
+            abortLimit = abs(atoi(optarg));
+            break;
+        case 'm':
+            jobFileName = optarg;
+            break;
+        case 'n':
+            commentsflag = FALSE;
+            break;
+        case 'o':
+            outputLimit = abs(atoi(optarg));
+            break;
+        case 's':
+            snapshotAt = strcmp(optarg, "in") == 0 ? SNAPSHOT_AT_INPUT : abs(atoi(optarg));
+            break;
+        case 'w':
+            workerCount = abs(atoi(optarg));
+            break;
+        default:
+            commandLineUsage();
+            return 1;
+        }
+    }
+    if (argc - optind > 1 || (batchflag && optind == argc && jobFileName == NULL)
+        || (jobFileName != NULL && (optind < argc || profileflag))
+        || (jobFileName == NULL && snapshotAt != NO_SNAPSHOT)
+        || daddrDefault < 1 || iaddrDefault < 1 || iaddrDefault > MAX_IADDR_SIZE) {
+        commandLineUsage();
+        return 1;
+    }
 
     /* guarantee a full clear even if the file load fails */
-    fullClearMachine();
+    vm->prog = &mainProgram;
+    vm->in = stdin;
+    vm->out = stdout;
+    fullClearMachine(vm);
+
+    if (jobFileName != NULL) {
+        batchflag = TRUE;
+        promptflag = FALSE;
+        return runJobs(jobFileName);
+    }
+    if (!batchflag) printVersion();
 
     /* read the program if supplied as an argument */
-    if (argc == 2) readInstructions(argv[1]);
+    if (optind < argc) {
+        if (!readInstructions(vm, argv[optind]) && batchflag) return 1;
+    }
+    clearListings();
+
+    if (batchflag) return batchRun();
 
     /* do stuff */
     while (doCommand());
+    if (profileflag) profileReport(vm, stdout);
 
     printf("Bye.\n");
 
     return 0;
-}
\ No newline at end of file
+}
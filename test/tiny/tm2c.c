@@ -0,0 +1,999 @@
+// // // // // // // // // // // // // // // // // // // // // // // //
+//
+// File: tm2c.c
+// Translates a TM program into a self contained C program
+//
+// The program is read from a listing (.tm) or an object file (.tmo)
+// just as tm reads it.  Each instruction becomes a line or two of C
+// under its own label, the registers are locals and data memory is
+// an array, so the host C compiler can turn it into a native
+// executable.  The executable does the same I/O as running the
+// program with tm -b: program output on stdout, the status report on
+// stderr and the same exit status (0 halted, 1 runtime error).
+//
+// Jumps relative to the pc become gotos.  Jumps through any other
+// register go through a switch over the entry points: address 0 and
+// every address loaded with LDA r,d(7), which is how c- makes return
+// addresses.  Hand written TM code that computes code addresses some
+// other way should be translated with -a to make every address an
+// entry point.
+//
+// Like tm -f there is no instruction count or execution limit.  The
+// output instruction limit defaults to tm's and the executable takes
+// -o n to change it.
+//
+// TO COMPILE: g++ tm2c.c -I../../lib/emitcode -o tm2c
+// TO USE:     tm2c prog.tm && cc -O2 prog.c -o prog && ./prog < input
+//
+
+char *versionNumber = (char *)"tm2c version 1.0";
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include "emitcode.h"
+#include "tmobject.h"
+
+#ifndef TRUE
+#define TRUE 1
+#endif
+#ifndef FALSE
+#define FALSE 0
+#endif
+
+/******* const *******/
+#define   DEFAULT_IADDR_SIZE  10000   /* as in tm */
+#define   DEFAULT_DADDR_SIZE  10000
+#define   MAX_IADDR_SIZE  (1<<24)
+#define   NO_REGS 8
+#define   PC_REG  7
+
+#define   LINESIZE  200
+#define   WORDSIZE  1000
+#define   DEFAULT_OUTPUT_LIMIT 1000
+
+
+/* the names tm accepts, in OpCode order (only 4 characters count) */
+const char *opNames[] = {
+    "HALT", "NOP", "IN", "INB", "INC", "OUT", "OUTB", "OUTC", "OUTNL",
+    "ADD", "SUB", "MUL", "DIV", "MOD", "AND", "OR", "XOR", "NOT", "NEG", "SWP", "RND",
+    "TLT", "SLT", "TLE", "TGT", "SGT", "TGE", "TEQ", "TNE",
+    "MOV", "SET", "CO", "COA",
+    "", // RRLIM
+    "LD", "ST", "LDA", "LDC", "JZR", "JNZ", "JMP",
+    "", // RALIM
+    "LIT"
+};
+
+typedef struct
+{
+    int used;
+    OpCode op;
+    int r, s, t;
+    long long int d;
+} INSTRUCTION;
+
+typedef struct
+{
+    int addr;
+    long long int value;
+} LITDATA;
+
+
+/******** GLOBAL VARIABLES ********/
+int iaddrSize = DEFAULT_IADDR_SIZE;
+int daddrSize = DEFAULT_DADDR_SIZE;
+int allEntries = FALSE;      // -a: every address can be jumped to through a register
+
+INSTRUCTION *iMem = NULL;
+int iMemCapacity = 0;
+int maxLoc = -1;             // highest address holding an instruction
+char *isTarget = NULL;       // a goto refers to the address
+char *isEntry = NULL;        // the dispatch switch has a case for the address
+
+LITDATA *litData = NULL;
+int litCount = 0;
+int litCapacity = 0;
+
+FILE *out;
+
+/* input line scanning, as in tm */
+char in_Line[LINESIZE];
+int lineLen;
+int inCol;
+long long int num;
+char word[WORDSIZE];
+char ch;
+
+
+void fail(const char *format, ...)
+{
+    va_list args;
+
+    printf("ERROR: ");
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+    printf("\n");
+    exit(1);
+}
+
+
+int isRR(OpCode op)
+{
+    return op < OpCode::RRLIM;
+}
+
+
+/* make room for an instruction at loc */
+INSTRUCTION *instructionAt(int loc)
+{
+    if (loc < 0 || loc >= MAX_IADDR_SIZE) {
+        fail("attempting to set out of bounds instruction memory at loc: %d", loc);
+    }
+    if (loc >= iMemCapacity) {
+        int size;
+
+        size = iMemCapacity ? iMemCapacity : 1024;
+        while (size <= loc) size *= 2;
+        iMem = (INSTRUCTION *)realloc(iMem, size * sizeof(INSTRUCTION));
+        memset(iMem + iMemCapacity, 0, (size - iMemCapacity) * sizeof(INSTRUCTION));
+        iMemCapacity = size;
+    }
+    if (loc > maxLoc) maxLoc = loc;
+    if (loc >= iaddrSize) iaddrSize = loc + 1;
+    iMem[loc].used = TRUE;
+
+    return &iMem[loc];
+}
+
+
+void setLit(int addr, long long int value)
+{
+    if (addr < 0) {
+        fail("LIT data at out of bounds data memory loc: %d", addr);
+    }
+    if (litCount == litCapacity) {
+        litCapacity = litCapacity ? 2 * litCapacity : 256;
+        litData = (LITDATA *)realloc(litData, litCapacity * sizeof(LITDATA));
+    }
+    litData[litCount].addr = addr;
+    litData[litCount].value = value;
+    litCount++;
+    if (addr >= daddrSize) daddrSize = addr + 1;
+}
+
+
+
+/********************************************/
+/* scanning, these behave exactly like the routines in tm.c */
+
+int getCh()
+{
+    if (++inCol<lineLen) {
+	ch = in_Line[inCol];
+        return 1;
+    }
+    else {
+	ch = ' ';
+        return 0;
+    }
+}
+
+int nonBlank(void)
+{
+    while ((inCol<lineLen) &&
+	   ((in_Line[inCol] == ' ') || (in_Line[inCol] == '\t'))) inCol++;
+    if (inCol<lineLen) {
+	ch = in_Line[inCol];
+	return TRUE;
+    }
+    else {
+	ch = ' ';
+	return FALSE;
+    }
+}
+
+void getCleanChar(void)
+{
+        getCh();
+        if (ch == '\\') {
+            getCh();
+            if (ch == '0') num = '\0';
+            else if (ch == 't') num = '\t';
+            else if (ch == 'n') num = '\n';
+            else if (ch == '\\') num = '\\';
+            else if (ch == '\'') num = '\'';
+            else num = ch;
+        }
+        else if (ch == '^') {
+            getCh();
+            num = ch;
+            num ^= 0x40;
+        }
+        else {
+            num = ch;
+        }
+}
+
+int getString(void)
+{
+    int i;
+    int ok = FALSE;
+    if (ch == '"') {
+        i = 0;
+        do {
+            getCleanChar();
+            word[i++] = ch;
+        } while (ch != '"');
+        word[i-1] = '\0';
+        ok = TRUE;
+    }
+
+    return ok;
+}
+
+int getChar(void)
+{
+    int ok = FALSE;
+
+    num = 0;
+    if (ch == '\'') {
+        getCleanChar();
+        getCh();
+        if (ch == '\'') {
+            ok = TRUE;
+            getCh();
+        }
+    }
+
+    return ok;
+}
+
+int getNum(void)
+{
+    int sign;
+    long long int term;
+    int ok = FALSE;
+
+    num = 0;
+    nonBlank();
+    do {
+	sign = 1;
+	while ((ch == '+') || (ch == '-')) {
+	    ok = FALSE;
+	    if (ch == '-')
+		sign = -sign;
+	    getCh();
+	}
+	term = 0;
+	while (isdigit(ch)) {
+	    ok = TRUE;
+	    term = term*10 + (ch - '0');
+	    getCh();
+	}
+	num = num + (term*sign);
+    }
+    while ((ch == '+') || (ch == '-'));
+
+    return ok;
+}
+
+int getNumOrChar(void)
+{
+    nonBlank();
+    if ((ch == '+') || (ch == '-') || isdigit(ch)) return getNum();
+    else return getChar();
+}
+
+int getWord(void)
+{
+    int temp = FALSE;
+    int length = 0;
+    if (nonBlank()) {
+	while (isalnum(ch) || ch=='=' || ch=='?') {
+	    if (length<WORDSIZE - 1)
+		word[length++] = ch;
+	    getCh();
+	}
+	word[length] = '\0';
+	temp = (length != 0);
+    }
+    return temp;
+}
+
+int skipCh(char c)
+{
+    int temp = FALSE;
+    if (nonBlank() && (ch == c)) {
+	getCh();
+	temp = TRUE;
+    }
+    return temp;
+}
+
+
+
+/********************************************/
+/* read a TM listing, accepting what tm's readInstructions accepts */
+void readListing(FILE *pgm)
+{
+    int loc, lineNo;
+
+    lineNo = 0;
+    loc = -1;
+    while (fgets(in_Line, LINESIZE - 2, pgm) != NULL) {
+        int opcnt;
+        OpCode op;
+        long long int arg1, arg2, arg3;
+
+	inCol = 0;
+	lineNo++;
+	lineLen = strlen(in_Line) - 1;
+	if (in_Line[lineLen] == '\n')
+	    in_Line[lineLen] = '\0';
+	else
+	    in_Line[++lineLen] = '\0';
+
+	if (!nonBlank() || in_Line[inCol] == '*') continue;
+
+        /* address */
+        if (getNum()) {
+            loc = num;
+            if (!skipCh(':')) fail("Line %d (Address: %d)   Missing colon", lineNo, loc);
+        }
+        else {
+            loc++;
+        }
+
+        /* op code */
+        if (!getWord()) fail("Line %d (Address: %d)   Missing opcode", lineNo, loc);
+        for (opcnt = 0; opcnt <= (int)OpCode::LIT; opcnt++) {
+            if (opNames[opcnt][0] && strncmp(opNames[opcnt], word, 4) == 0) break;
+        }
+        if (opcnt > (int)OpCode::LIT) {
+            fail("Line %d (Address: %d)   Illegal opcode: %s", lineNo, loc, word);
+        }
+        op = (OpCode)opcnt;
+
+        /* args */
+        arg1 = arg2 = arg3 = 0;
+        if (op == OpCode::LIT) {
+            int wordset;
+
+            nonBlank();
+            if ((wordset = getString()) || getNum() || getChar()) {}
+            if (wordset) {
+                int len, k;
+
+                len = strlen(word);
+                for (k=0; k<len; k++) setLit(loc-k, word[k]);
+                setLit(loc+1, len);
+            }
+            else {
+                setLit(loc, num);
+            }
+            continue;
+        }
+        else if (op == OpCode::HALT || op == OpCode::NOP) {
+            // operands are ignored
+        }
+        else if (isRR(op)) {
+            if (!getNum() || num < 0 || num >= NO_REGS) fail("Line %d (Address: %d)   Bad first register", lineNo, loc);
+            arg1 = num;
+            if (!skipCh(',')) fail("Line %d (Address: %d)   Missing comma", lineNo, loc);
+            if (!getNum() || num < 0 || num >= NO_REGS) fail("Line %d (Address: %d)   Bad second register", lineNo, loc);
+            arg2 = num;
+            if (!skipCh(',')) fail("Line %d (Address: %d)   Missing comma", lineNo, loc);
+            if (!getNum() || num < 0 || num >= NO_REGS) fail("Line %d (Address: %d)   Bad third register", lineNo, loc);
+            arg3 = num;
+        }
+        else {
+            if (!getNum() || num < 0 || num >= NO_REGS) fail("Line %d (Address: %d)   Bad first register", lineNo, loc);
+            arg1 = num;
+            if (!skipCh(',')) fail("Line %d (Address: %d)   Missing comma", lineNo, loc);
+            if (!getNumOrChar()) fail("Line %d (Address: %d)   Bad displacement", lineNo, loc);
+            arg2 = num;
+            if (!skipCh('(') && !skipCh(',')) {
+                if (op != OpCode::LDC) fail("Line %d (Address: %d)   Missing left paren", lineNo, loc);
+            }
+            else {
+                if (!getNum() || num < 0 || num >= NO_REGS) fail("Line %d (Address: %d)   Bad second register", lineNo, loc);
+                arg3 = num;
+            }
+        }
+
+        {
+            INSTRUCTION *in = instructionAt(loc);
+
+            in->op = op;
+            in->r = arg1;
+            if (isRR(op)) {
+                in->s = arg2;
+                in->t = arg3;
+                in->d = 0;
+            }
+            else {
+                in->s = arg3;
+                in->t = 0;
+                in->d = arg2;
+            }
+        }
+    }
+}
+
+
+/* read a binary object file (see tmobject.h) */
+void readObject(FILE *pgm)
+{
+    TMOHeader header;
+    TMOInstruction inst;
+    TMOData data;
+    uint32_t i;
+
+    if (fread(&header, sizeof(header), 1, pgm) != 1
+        || header.magic != TMO_MAGIC || header.version != TMO_VERSION) {
+        fail("not a TM object file or wrong version");
+    }
+    for (i = 0; i < header.instrCount; i++) {
+        if (fread(&inst, sizeof(inst), 1, pgm) != 1) fail("object file is truncated");
+        if (inst.op == TMO_UNUSED) continue;
+        if (inst.op < 0 || inst.op >= (int)OpCode::LIT || inst.op == (int)OpCode::RRLIM
+            || inst.arg1 < 0 || inst.arg1 >= NO_REGS || inst.arg3 < 0 || inst.arg3 >= NO_REGS
+            || (inst.op < (int)OpCode::RRLIM && (inst.arg2 < 0 || inst.arg2 >= NO_REGS))) {
+            fail("bad instruction in object file at loc: %u", i);
+        }
+        {
+            INSTRUCTION *in = instructionAt(i);
+
+            in->op = (OpCode)inst.op;
+            in->r = inst.arg1;
+            if (isRR(in->op)) {
+                in->s = inst.arg2;
+                in->t = inst.arg3;
+                in->d = 0;
+            }
+            else {
+                in->s = inst.arg3;
+                in->t = 0;
+                in->d = inst.arg2;
+            }
+        }
+    }
+    for (i = 0; i < header.dataCount; i++) {
+        if (fread(&data, sizeof(data), 1, pgm) != 1) fail("object file is truncated");
+        if (data.addr > INT32_MAX) fail("LIT data at out of bounds data memory loc: %lld", (long long)data.addr);
+        setLit(data.addr, data.value);
+    }
+}
+
+
+void readProgram(char *fileName)
+{
+    FILE *pgm;
+    uint32_t magic;
+
+    pgm = fopen(fileName, "r");
+    if (pgm == NULL) {
+	printf("ERROR(readProgram): file '%s' not found\n", fileName);
+	exit(1);
+    }
+    if (fread(&magic, sizeof(magic), 1, pgm) == 1 && magic == TMO_MAGIC) {
+        rewind(pgm);
+        readObject(pgm);
+    }
+    else {
+        rewind(pgm);
+        readListing(pgm);
+    }
+    fclose(pgm);
+}
+
+
+
+/********************************************/
+/* operands as C expressions.  Reading the pc gives the address of the
+   next instruction, a constant.  Writing the pc writes npc and the
+   instruction then jumps through the dispatch switch. */
+
+char *src(int reg, int loc)
+{
+    static char buf[4][32];
+    static int next = 0;
+    char *s;
+
+    s = buf[next];
+    next = (next + 1) % 4;
+    if (reg == PC_REG) sprintf(s, "%dLL", loc + 1);
+    else sprintf(s, "r%d", reg);
+
+    return s;
+}
+
+const char *dst(int reg)
+{
+    static const char *names[NO_REGS] = {"r0", "r1", "r2", "r3", "r4", "r5", "r6", "npc"};
+
+    return names[reg];
+}
+
+/* d+reg(s) */
+char *address(INSTRUCTION *in, int loc)
+{
+    static char buf[64];
+
+    if (in->s == PC_REG) sprintf(buf, "%lldLL", in->d + loc + 1);
+    else if (in->d == 0) sprintf(buf, "r%d", in->s);
+    else sprintf(buf, "%lldLL + r%d", in->d, in->s);
+
+    return buf;
+}
+
+
+/* jump from loc to a target known now */
+void emitStaticJump(long long int target, int loc)
+{
+    if (target < 0 || target >= iaddrSize) fprintf(out, "{ pc = %d; goto imemErr; }", loc);
+    else if (target > maxLoc || !iMem[target].used) fprintf(out, "goto halt;");
+    else fprintf(out, "goto L%lld;", target);
+}
+
+
+/* jump from loc to d+reg(s) */
+void emitJump(INSTRUCTION *in, int loc)
+{
+    if (in->s == PC_REG) emitStaticJump(in->d + loc + 1, loc);
+    else fprintf(out, "{ npc = %s; pc = %d; goto dispatch; }", address(in, loc), loc);
+}
+
+
+/* find the addresses that need a label or a dispatch case */
+void findTargets()
+{
+    int loc;
+
+    isTarget = (char *)calloc(maxLoc + 2, 1);
+    isEntry = (char *)calloc(maxLoc + 2, 1);
+    if (maxLoc >= 0) isEntry[0] = TRUE;
+    for (loc = 0; loc <= maxLoc; loc++) {
+        INSTRUCTION *in = &iMem[loc];
+        long long int a;
+
+        if (!in->used) {
+            isEntry[loc] = TRUE;   // an empty slot is a HALT
+            continue;
+        }
+        if (allEntries) isEntry[loc] = TRUE;
+        if (isRR(in->op) || in->s != PC_REG) continue;
+        a = in->d + loc + 1;
+        if (a < 0 || a > maxLoc) continue;
+        if (in->op == OpCode::LDA && in->r != PC_REG) isEntry[a] = TRUE;
+        else if (in->op == OpCode::JZR || in->op == OpCode::JNZ || in->op == OpCode::JMP
+                 || (in->op == OpCode::LDA && in->r == PC_REG)) isTarget[a] = TRUE;
+    }
+}
+
+
+void emitInstruction(INSTRUCTION *in, int loc)
+{
+    const char *op = opNames[(int)in->op];
+    const char *r = dst(in->r);
+    char *rs = src(in->r, loc), *s = src(in->s, loc), *t = src(in->t, loc);
+
+    if (isEntry[loc] || isTarget[loc]) fprintf(out, "L%d:\n", loc);
+    if (isRR(in->op)) fprintf(out, "    /* %5d: %-5s %d,%d,%d */ ", loc, op, in->r, in->s, in->t);
+    else fprintf(out, "    /* %5d: %-5s %d,%lld(%d) */ ", loc, op, in->r, in->d, in->s);
+
+    switch (in->op) {
+    case OpCode::HALT: fprintf(out, "goto halt;"); break;
+    case OpCode::NOP: break;
+    case OpCode::IN: fprintf(out, "if (inInt(&%s)) goto halt;", r); break;
+    case OpCode::INB: fprintf(out, "if (inBool(&%s)) goto halt;", r); break;
+    case OpCode::INC: fprintf(out, "inChar(&%s);", r); break;
+    case OpCode::OUT:
+        fprintf(out, "if (outputLimitFail()) { pc = %d; goto outputLimit; } printf(\"%%lld \", %s);", loc, rs);
+        break;
+    case OpCode::OUTB:
+        fprintf(out, "if (outputLimitFail()) { pc = %d; goto outputLimit; } fputs(%s ? \"T \" : \"F \", stdout);", loc, rs);
+        break;
+    case OpCode::OUTC:
+        fprintf(out, "if (outputLimitFail()) { pc = %d; goto outputLimit; } putchar((char)%s);", loc, rs);
+        break;
+    case OpCode::OUTNL:
+        fprintf(out, "if (outputLimitFail()) { pc = %d; goto outputLimit; } putchar('\\n');", loc);
+        break;
+    case OpCode::ADD: fprintf(out, "%s = %s + %s;", r, s, t); break;
+    case OpCode::SUB: fprintf(out, "%s = %s - %s;", r, s, t); break;
+    case OpCode::MUL: fprintf(out, "%s = %s * %s;", r, s, t); break;
+    case OpCode::DIV:
+        fprintf(out, "if (%s == 0) { pc = %d; goto zeroDivide; } %s = %s / %s;", t, loc, r, s, t);
+        break;
+    case OpCode::MOD:
+        fprintf(out, "if (%s == 0) { pc = %d; goto zeroDivide; } tmp = %s %% %s; if (tmp < 0) tmp += llabs(%s); %s = tmp;",
+                t, loc, s, t, t, r);
+        break;
+    case OpCode::AND: fprintf(out, "%s = %s & %s;", r, s, t); break;
+    case OpCode::OR: fprintf(out, "%s = %s | %s;", r, s, t); break;
+    case OpCode::XOR: fprintf(out, "%s = %s ^ %s;", r, s, t); break;
+    case OpCode::NOT: fprintf(out, "%s = ~%s;", r, s); break;
+    case OpCode::NEG: fprintf(out, "%s = -%s;", r, s); break;
+    case OpCode::SWP:
+        if (in->r == PC_REG || in->s == PC_REG) fail("SWP of the pc at %d can not be translated", loc);
+        fprintf(out, "if (%s > %s) { tmp = %s; %s = %s; %s = tmp; }", rs, s, rs, r, s, dst(in->s));
+        break;
+    case OpCode::RND:
+        fprintf(out, "if (%s == 0) { pc = %d; goto zeroDivide; } %s = random() %% llabs(%s);", s, loc, r, s);
+        break;
+    case OpCode::TLT: fprintf(out, "%s = %s < %s;", r, s, t); break;
+    case OpCode::TLE: fprintf(out, "%s = %s <= %s;", r, s, t); break;
+    case OpCode::TGT: fprintf(out, "%s = %s > %s;", r, s, t); break;
+    case OpCode::TGE: fprintf(out, "%s = %s >= %s;", r, s, t); break;
+    case OpCode::TEQ: fprintf(out, "%s = %s == %s;", r, s, t); break;
+    case OpCode::TNE: fprintf(out, "%s = %s != %s;", r, s, t); break;
+    case OpCode::SLT: fprintf(out, "%s = %s >= 0 ? %s < %s : -%s < -%s;", r, rs, s, t, s, t); break;
+    case OpCode::SGT: fprintf(out, "%s = %s >= 0 ? %s > %s : -%s > -%s;", r, rs, s, t, s, t); break;
+    case OpCode::MOV: fprintf(out, "pc = %d; movMem(%s, %s, %s);", loc, rs, s, t); break;
+    case OpCode::SET: fprintf(out, "pc = %d; setMem(%s, %s, %s);", loc, rs, s, t); break;
+    case OpCode::CO: fprintf(out, "pc = %d; coMem(%s, %s, %s, &r5, &r6);", loc, rs, s, t); break;
+    case OpCode::COA: fprintf(out, "pc = %d; coaMem(%s, %s, %s, &r5, &r6);", loc, rs, s, t); break;
+    case OpCode::LD: fprintf(out, "%s = getD(%d, %s);", r, loc, address(in, loc)); break;
+    case OpCode::ST: fprintf(out, "setD(%d, %s, %s);", loc, address(in, loc), rs); break;
+    case OpCode::LDA:
+        if (in->r == PC_REG) emitJump(in, loc);
+        else fprintf(out, "%s = %s;", r, address(in, loc));
+        break;
+    case OpCode::LDC:
+        if (in->r == PC_REG) emitStaticJump(in->d, loc);
+        else fprintf(out, "%s = %lldLL;", r, in->d);
+        break;
+    case OpCode::JZR: fprintf(out, "if (%s == 0) ", rs); emitJump(in, loc); break;
+    case OpCode::JNZ: fprintf(out, "if (%s != 0) ", rs); emitJump(in, loc); break;
+    case OpCode::JMP: emitJump(in, loc); break;
+    default: break;
+    }
+
+    /* anything else that writes the pc jumps to what it wrote */
+    if (in->r == PC_REG && in->op != OpCode::LDA && in->op != OpCode::LDC
+        && in->op != OpCode::JZR && in->op != OpCode::JNZ && in->op != OpCode::JMP
+        && in->op != OpCode::HALT && in->op != OpCode::NOP && in->op != OpCode::ST
+        && in->op != OpCode::MOV && in->op != OpCode::SET && in->op != OpCode::CO && in->op != OpCode::COA
+        && (in->op < OpCode::OUT || in->op > OpCode::OUTNL)) {
+        fprintf(out, " pc = %d; goto dispatch;", loc);
+    }
+    fprintf(out, "\n");
+}
+
+
+/* the support code every translated program starts with.  The input
+   routines are tm's so input is read exactly the same way. */
+static const char *runtime = R"RUNTIME(
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+
+#define LINESIZE 200
+#define WORDSIZE 1000
+
+static long long int *dMem;
+static char *readOnly;
+static int pc;                 /* address reported in errors */
+static int outputLimit = 1000;
+static int outputInstrCount = 0;
+
+static char in_Line[LINESIZE];
+static int lineLen, inCol;
+static long long int num;
+static char ch;
+
+static int getCh(void)
+{
+    if (++inCol < lineLen) { ch = in_Line[inCol]; return 1; }
+    ch = ' ';
+    return 0;
+}
+
+static int nonBlank(void)
+{
+    while (inCol < lineLen && (in_Line[inCol] == ' ' || in_Line[inCol] == '\t')) inCol++;
+    if (inCol < lineLen) { ch = in_Line[inCol]; return 1; }
+    ch = ' ';
+    return 0;
+}
+
+static int getNum(void)
+{
+    int sign, ok = 0;
+    long long int term;
+
+    num = 0;
+    nonBlank();
+    do {
+        sign = 1;
+        while (ch == '+' || ch == '-') {
+            ok = 0;
+            if (ch == '-') sign = -sign;
+            getCh();
+        }
+        term = 0;
+        while (isdigit(ch)) {
+            ok = 1;
+            term = term*10 + (ch - '0');
+            getCh();
+        }
+        num = num + term*sign;
+    } while (ch == '+' || ch == '-');
+    return ok;
+}
+
+static int skipCh(char c)
+{
+    if (nonBlank() && ch == c) { getCh(); return 1; }
+    return 0;
+}
+
+static void readLine(void)
+{
+    char *p;
+
+    fgets(in_Line, LINESIZE - 2, stdin);
+    for (p = in_Line; *p; p++) {
+        if (*p == '\n') { *p = '\0'; break; }
+    }
+    lineLen = p - in_Line;
+}
+
+/* these return 1 when the input asks to halt with # */
+static int inInt(long long int *r)
+{
+    fflush(stdout);
+    readLine();
+    inCol = 0;
+    if (!getNum()) {
+        printf("Illegal value in input: \"%s\"\n", in_Line);
+        exit(1);
+    }
+    *r = num;
+    return skipCh('#');
+}
+
+static int inBool(long long int *r)
+{
+    fflush(stdout);
+    readLine();
+    inCol = 0;
+    nonBlank();
+    num = 1;
+    if (ch == 'F' || ch == 'f' || ch == '0') num = 0;
+    if (nonBlank()) while (isalnum(ch) || ch == '=' || ch == '?') getCh();
+    *r = num;
+    return skipCh('#');
+}
+
+static void inChar(long long int *r)
+{
+    fflush(stdout);
+    while (inCol + 1 >= lineLen) {
+        readLine();
+        inCol = -1;
+    }
+    if (getCh()) *r = ch;
+}
+
+static int outputLimitFail(void)
+{
+    outputInstrCount++;
+    return outputInstrCount > outputLimit && outputLimit != 0;
+}
+
+static long long int getD(int at, int m)
+{
+    if (m < 0 || m >= DADDR_SIZE) {
+        printf("ERROR(getDMem): instruction at addr %d attempting to get out of bounds data memory at loc: %d\n", at, m);
+        exit(1);
+    }
+    return dMem[m];
+}
+
+static void setD(int at, int m, long long int value)
+{
+    if (m < 0 || m >= DADDR_SIZE) {
+        printf("ERROR(setDMem): instruction at addr %d attempting to set out of bounds data memory at loc: %d\n", at, m);
+        exit(1);
+    }
+    if (readOnly[m]) {
+        printf("ERROR(setDMem): instruction at addr %d attempting to set data memory marked as read only at loc: %d\n", at, m);
+        exit(1);
+    }
+    dMem[m] = value;
+}
+
+static void movMem(int raddr, int saddr, long long int count)
+{
+    int i;
+
+    for (i = 0; i < count; i++) setD(pc, raddr--, getD(pc, saddr--));
+}
+
+static void setMem(int raddr, int svalue, long long int count)
+{
+    int i;
+
+    for (i = 0; i < count; i++) setD(pc, raddr--, svalue);
+}
+
+static void coMem(int raddr, int saddr, long long int count, long long int *r5, long long int *r6)
+{
+    int i;
+
+    for (i = 0; i < count; i++) {
+        *r5 = getD(pc, raddr--);
+        *r6 = getD(pc, saddr--);
+        if (*r5 != *r6) break;
+    }
+}
+
+static void coaMem(int raddr, int saddr, long long int count, long long int *r5, long long int *r6)
+{
+    int i;
+
+    for (i = 0; i < count; i++) {
+        *r5 = raddr;
+        *r6 = saddr;
+        if (getD(pc, raddr--) != getD(pc, saddr--)) break;
+    }
+}
+
+static int finish(const char *status, int failed)
+{
+    fflush(stdout);
+    fprintf(stderr, "Status: %s\n", status);
+    if (failed) fprintf(stderr, "Last executed cmd: %d\n", pc);
+    fprintf(stderr, "Exit status = %d\n", failed);
+    return failed;
+}
+)RUNTIME";
+
+
+void translate(char *fileName)
+{
+    int loc, i;
+
+    fprintf(out, "/* %s translated by %s */\n", fileName, versionNumber);
+    fprintf(out, "#define DADDR_SIZE %d\n", daddrSize);
+    fputs(runtime, out);
+
+    fprintf(out, "\nstatic const struct { int addr; long long int value; } lits[] = {\n");
+    for (i = 0; i < litCount; i++) {
+        fprintf(out, "    {%d, %lldLL},\n", litData[i].addr, litData[i].value);
+    }
+    fprintf(out, "    {-1, 0}\n};\n\n");
+
+    fprintf(out, "int main(int argc, char *argv[])\n{\n");
+    fprintf(out, "    long long int r0 = 0, r1 = 0, r2 = 0, r3 = 0, r4 = 0, r5 = 0, r6 = 0;\n");
+    fprintf(out, "    long long int npc, tmp;\n");
+    fprintf(out, "    int c, i;\n\n");
+    fprintf(out, "    while ((c = getopt(argc, argv, \"o:\")) != -1) {\n");
+    fprintf(out, "        if (c != 'o') {\n");
+    fprintf(out, "            printf(\"Usage: %%s [-o output instruction limit, 0 for none]\\n\", argv[0]);\n");
+    fprintf(out, "            return 1;\n");
+    fprintf(out, "        }\n");
+    fprintf(out, "        outputLimit = abs(atoi(optarg));\n");
+    fprintf(out, "    }\n");
+    fprintf(out, "    srandom(getpid()*332+1);\n");
+    fprintf(out, "    dMem = (long long int *)calloc(DADDR_SIZE, sizeof(long long int));\n");
+    fprintf(out, "    readOnly = (char *)calloc(DADDR_SIZE, 1);\n");
+    fprintf(out, "    for (i = 0; lits[i].addr >= 0; i++) {\n");
+    fprintf(out, "        dMem[lits[i].addr] = lits[i].value;\n");
+    fprintf(out, "        readOnly[lits[i].addr] = 1;\n");
+    fprintf(out, "    }\n");
+    fprintf(out, "    dMem[0] = DADDR_SIZE - 1;\n\n");
+
+    /* the program */
+    for (loc = 0; loc <= maxLoc; loc++) {
+        if (iMem[loc].used) {
+            emitInstruction(&iMem[loc], loc);
+        }
+        else {
+            if (isEntry[loc] || isTarget[loc]) fprintf(out, "L%d:\n", loc);
+            fprintf(out, "    /* %5d: empty */ goto halt;\n", loc);
+        }
+    }
+    if (maxLoc + 1 < iaddrSize) fprintf(out, "    goto halt;\n");
+    else fprintf(out, "    pc = %d; goto imemErr;\n", maxLoc);
+
+    /* jumps through a register */
+    fprintf(out, "\ndispatch:\n");
+    fprintf(out, "    switch (npc) {\n");
+    for (loc = 0; loc <= maxLoc; loc++) {
+        if (isEntry[loc]) fprintf(out, "    case %d: goto L%d;\n", loc, loc);
+    }
+    fprintf(out, "    }\n");
+    fprintf(out, "    if (npc < 0 || npc >= %d) goto imemErr;\n", iaddrSize);
+    if (maxLoc + 1 < iaddrSize) fprintf(out, "    if (npc > %d) goto halt;\n", maxLoc);
+    fprintf(out, "    printf(\"ERROR: jump from %%d to %%lld which is not an entry point (translate with tm2c -a)\\n\", pc, npc);\n");
+    fprintf(out, "    exit(1);\n\n");
+
+    fprintf(out, "halt:\n    return finish(\"Halted\", 0);\n");
+    fprintf(out, "imemErr:\n    return finish(\"ERROR: Instruction Memory Fault\", 1);\n");
+    fprintf(out, "zeroDivide:\n    return finish(\"ERROR: Division by 0\", 1);\n");
+    fprintf(out, "outputLimit:\n    return finish(\"ERROR: Output Instruction Limit Exceeded\", 1);\n");
+    fprintf(out, "}\n");
+}
+
+
+void usage()
+{
+    printf("Usage: tm2c [options] file [output]\n");
+    printf("  -a     every address is an entry point for jumps through a register\n");
+    printf("  -d n   data memory size in words (default is %d)\n", DEFAULT_DADDR_SIZE);
+    printf("  -i n   instruction memory size (default is %d)\n", DEFAULT_IADDR_SIZE);
+    printf("The output defaults to the file name with its extension changed to .c\n");
+}
+
+
+/********************************************/
+/* E X E C U T I O N   B E G I N S   H E R E */
+/********************************************/
+
+int main(int argc, char *argv[])
+{
+    char *fileName, *outName;
+    int c;
+
+    while ((c = getopt(argc, argv, "ad:i:")) != -1) {
+        switch (c) {
+        case 'a':
+            allEntries = TRUE;
+            break;
+        case 'd':
+            daddrSize = atoi(optarg);
+            break;
+        case 'i':
+            iaddrSize = atoi(optarg);
+            break;
+        default:
+            usage();
+            return 1;
+        }
+    }
+    if (optind == argc || argc - optind > 2
+        || daddrSize < 1 || iaddrSize < 1 || iaddrSize > MAX_IADDR_SIZE) {
+        usage();
+        return 1;
+    }
+
+    fileName = argv[optind];
+    readProgram(fileName);
+    findTargets();
+
+    if (optind + 1 < argc) {
+        outName = strdup(argv[optind + 1]);
+    }
+    else {
+        char *dot;
+
+        outName = (char *)malloc(strlen(fileName) + 3);
+        strcpy(outName, fileName);
+        dot = strrchr(outName, '.');
+        if (dot == NULL || strchr(dot, '/') != NULL) dot = outName + strlen(outName);
+        strcpy(dot, ".c");
+    }
+    if (strcmp(outName, fileName) == 0) {
+        printf("ERROR: output would overwrite %s\n", fileName);
+        return 1;
+    }
+    out = fopen(outName, "w");
+    if (out == NULL) {
+        printf("ERROR: unable to write %s\n", outName);
+        return 1;
+    }
+    translate(fileName);
+    fclose(out);
+
+    return 0;
+}